@@ -0,0 +1,475 @@
+/* swt_bench.c -- per-stage timings of the SWT pipeline on synthetic text
+
+   Renders pages of random text with a tiny embedded 5x7 bitmap font, then
+   times every stage of the pipeline separately over a number of iterations
+   and prints min/median/p99 latencies and throughput as JSON. The CCA is
+   timed three ways on the same mask: the flood fill the pipeline uses, the
+   block based labeling and a plain pixel by pixel union-find labeling.
+
+Usage:
+   swt_bench [--mp 0.1,1,10] [--density 0.5] [--stroke 2]
+             [--polarity dark|light|both] [--iterations 10]
+             [--images a.jpg,b.png]
+
+   Every combination of the given lists is run. --mp is the image size in
+   megapixels (0.1 to 100), --density the fraction of glyph cells that hold a
+   glyph, --stroke the size of a font pixel (and so the stroke width) in image
+   pixels and --polarity whether the text is dark on light or light on dark.
+   --images runs on those files instead of synthetic pages.
+*/
+
+#define SWT_IMPLEMENTATION
+#include "../swt.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../thirdparty/stb_image.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define BENCH_MAX_VALUES 16
+#define BENCH_STAGE_COUNT 7
+
+static const char *stageNames[BENCH_STAGE_COUNT] = {
+    "grayscale", "threshold",    "cca",      "cca_blocks",
+    "cca_union_find", "stroke_width", "visualize"};
+
+// 5x7 glyphs for A-Z, one byte per row with the leftmost pixel in bit 4
+static const uint8_t font[26][7] = {
+    {0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}, // A
+    {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E}, // B
+    {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E}, // C
+    {0x1E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x1E}, // D
+    {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F}, // E
+    {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10}, // F
+    {0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F}, // G
+    {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}, // H
+    {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E}, // I
+    {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C}, // J
+    {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}, // K
+    {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F}, // L
+    {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11}, // M
+    {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11}, // N
+    {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, // O
+    {0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10}, // P
+    {0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D}, // Q
+    {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11}, // R
+    {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E}, // S
+    {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, // T
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, // U
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04}, // V
+    {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A}, // W
+    {0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11}, // X
+    {0x11, 0x11, 0x0A, 0x04, 0x04, 0x04, 0x04}, // Y
+    {0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F}, // Z
+};
+
+typedef struct {
+  double values[BENCH_MAX_VALUES];
+  int count;
+} BenchList;
+
+static double bench_now_ms(void) {
+#ifdef _WIN32
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (double)counter.QuadPart * 1000.0 / (double)frequency.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+#endif
+}
+
+static unsigned bench_rand(unsigned *state) {
+  *state = *state * 1664525u + 1013904223u;
+  return *state >> 8;
+}
+
+// Fills an RGB page with rows of random glyphs. Each font pixel is a
+// stroke x stroke block, and a glyph cell is left empty with probability
+// 1 - density.
+static void bench_render_text(uint8_t *rgb, int width, int height,
+                              double density, int stroke, int darkOnLight) {
+  const uint8_t paper = darkOnLight ? 235 : 20;
+  const uint8_t ink = darkOnLight ? 20 : 235;
+  const int cellWidth = 6 * stroke, cellHeight = 9 * stroke;
+  unsigned seed = 0x5eed;
+
+  memset(rgb, paper, (size_t)width * height * 3);
+
+  for (int cy = stroke; cy + 7 * stroke <= height; cy += cellHeight) {
+    for (int cx = stroke; cx + 5 * stroke <= width; cx += cellWidth) {
+      if ((bench_rand(&seed) % 1000) >= density * 1000) continue;
+
+      const uint8_t *glyph = font[bench_rand(&seed) % 26];
+      for (int row = 0; row < 7 * stroke; row++) {
+        for (int col = 0; col < 5 * stroke; col++) {
+          if (!(glyph[row / stroke] & (0x10 >> (col / stroke)))) continue;
+
+          uint8_t *pixel = rgb + ((size_t)(cy + row) * width + cx + col) * 3;
+          pixel[0] = pixel[1] = pixel[2] = ink;
+        }
+      }
+    }
+  }
+}
+
+static int bench_compare_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void bench_print_stage(const char *name, double *samples,
+                              int iterations, double megapixels, int last) {
+  qsort(samples, iterations, sizeof(double), bench_compare_double);
+
+  double median = samples[iterations / 2];
+  int p99 = (int)ceil(iterations * 0.99) - 1;
+
+  printf("        \"%s\": {\"min_ms\": %.4f, \"median_ms\": %.4f, "
+         "\"p99_ms\": %.4f, \"mp_per_s\": %.2f}%s\n",
+         name, samples[0], median, samples[p99 < 0 ? 0 : p99],
+         median > 0 ? megapixels / (median / 1000.0) : 0.0, last ? "" : ",");
+}
+
+// Two pass labeling a pixel at a time, with the same union-find the block
+// labeling uses, to compare both against. 8-connected like the pipeline.
+static void bench_union_find_cca(SWTImage *image, SWTComponents *components) {
+  int width = image->width, height = image->height;
+  const uint8_t *data = image->bytes;
+  uint32_t *labels = (uint32_t *)calloc((size_t)width * height, sizeof(uint32_t));
+  uint32_t capacity = 1024, count = 0;
+  uint32_t *parents = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+  size_t *areas = (size_t *)malloc(capacity * sizeof(size_t));
+  uint32_t *ids = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+  if (labels == NULL || parents == NULL || areas == NULL || ids == NULL) {
+    fprintf(stderr, "ERROR: unable to allocate the union-find labels\n");
+    exit(1);
+  }
+
+  for (int y = 0; y < height; y++) {
+    const uint8_t *row = data + (size_t)y * width;
+    uint32_t *labelRow = labels + (size_t)y * width;
+    const uint32_t *labelAbove = y > 0 ? labelRow - width : NULL;
+
+    for (int x = swt__kernels->find_foreground(row, 0, width); x < width;
+         x = swt__kernels->find_foreground(row, x + 1, width)) {
+      // the neighbours already labeled: left, upper left, up, upper right
+      uint32_t neighbours[4] = {x > 0 ? labelRow[x - 1] : 0, 0, 0, 0};
+      if (labelAbove != NULL) {
+        neighbours[1] = x > 0 ? labelAbove[x - 1] : 0;
+        neighbours[2] = labelAbove[x];
+        neighbours[3] = x + 1 < width ? labelAbove[x + 1] : 0;
+      }
+
+      uint32_t label = 0;
+      for (int n = 0; n < 4; n++) {
+        if (neighbours[n] == 0) continue;
+        label = label ? swt__join_blocks(parents, label, neighbours[n]) : neighbours[n];
+      }
+      if (label == 0) {
+        if (count + 1 == capacity) {
+          capacity *= 2;
+          parents = (uint32_t *)realloc(parents, capacity * sizeof(uint32_t));
+          areas = (size_t *)realloc(areas, capacity * sizeof(size_t));
+          ids = (uint32_t *)realloc(ids, capacity * sizeof(uint32_t));
+          if (parents == NULL || areas == NULL || ids == NULL) {
+            fprintf(stderr, "ERROR: unable to allocate the union-find labels\n");
+            exit(1);
+          }
+        }
+        label = ++count;
+        parents[label] = label;
+        areas[label] = 0;
+        ids[label] = 0;
+      }
+      labelRow[x] = label;
+      areas[label]++;
+    }
+  }
+
+  for (uint32_t label = 1; label <= count; label++) {
+    uint32_t root = parents[parents[label]];
+    parents[label] = root;
+    if (root != label) areas[root] += areas[label];
+  }
+
+  // components in the order of their first pixel, lone pixels dropped
+  for (int y = 0; y < height; y++) {
+    const uint8_t *row = data + (size_t)y * width;
+    const uint32_t *labelRow = labels + (size_t)y * width;
+    for (int x = swt__kernels->find_foreground(row, 0, width); x < width;
+         x = swt__kernels->find_foreground(row, x + 1, width)) {
+      uint32_t root = parents[labelRow[x]];
+      if (areas[root] < 2) continue;
+
+      if (ids[root] == 0) {
+        SWTComponent component = {(SWTPoint *)malloc(areas[root] * sizeof(SWTPoint)), 0};
+        if (component.points == NULL || swt__add_component(components, NULL, component) == NULL) {
+          fprintf(stderr, "ERROR: unable to allocate a component\n");
+          exit(1);
+        }
+        ids[root] = (uint32_t)components->itemCount;
+      }
+      SWTComponent *component = &components->items[ids[root] - 1];
+      component->points[component->pointCount].x = x;
+      component->points[component->pointCount].y = y;
+      component->pointCount++;
+    }
+  }
+
+  free(ids);
+  free(areas);
+  free(parents);
+  free(labels);
+}
+
+// Times every stage on `page` (RGB, left as it is) and prints them as one
+// JSON run, `describe` adds the fields saying what the page is
+static void bench_run(const uint8_t *page, int width, int height, int iterations,
+                      int first, void (*describe)(const void *), const void *context) {
+  size_t size = (size_t)width * height * 3;
+  uint8_t *bytes = (uint8_t *)malloc(size);
+  double *samples = (double *)calloc((size_t)iterations * (BENCH_STAGE_COUNT + 1), sizeof(double));
+  if (bytes == NULL || samples == NULL) {
+    fprintf(stderr, "ERROR: unable to allocate a %dx%d page\n", width, height);
+    exit(1);
+  }
+
+  int componentCount = 0;
+  for (int it = 0; it < iterations; it++) {
+    // the pipeline is destructive, every iteration starts from a fresh copy
+    memcpy(bytes, page, size);
+    SWTImage image = {bytes, width, height, 3};
+    SWTData *data = swt_allocate(width * height);
+    SWTComponents *blocks = swt__allocate_components((size_t)width * height);
+    SWTComponents *unionFind = swt__allocate_components((size_t)width * height);
+    double *times = samples + (size_t)it * (BENCH_STAGE_COUNT + 1);
+
+    double start = bench_now_ms();
+    swt_apply_grayscale(&image);
+    double t1 = bench_now_ms();
+    swt_apply_threshold(&image, SWT_THRESHOLD);
+    double t2 = bench_now_ms();
+    swt_connected_component_analysis(&image, data->components);
+    double t3 = bench_now_ms();
+    swt_connected_component_analysis_blocks(&image, blocks);
+    double t4 = bench_now_ms();
+    bench_union_find_cca(&image, unionFind);
+    double t5 = bench_now_ms();
+    for (int i = 0; i < data->components->itemCount; i++) {
+      SWTComponent *component = &data->components->items[i];
+      swt_add_result(data->results, component,
+                     swt_compute_stroke_width_for_component(&image, component), 0);
+    }
+    double t6 = bench_now_ms();
+    swt_visualize_text_on_image(&image, data->results, 20);
+    double t7 = bench_now_ms();
+
+    times[0] = t1 - start;
+    times[1] = t2 - t1;
+    times[2] = t3 - t2;
+    times[3] = t4 - t3;
+    times[4] = t5 - t4;
+    times[5] = t6 - t5;
+    times[6] = t7 - t6;
+    // the pipeline only runs one of the labelings
+    times[7] = times[0] + times[1] + times[2] + times[5] + times[6];
+
+    if (blocks->itemCount != data->components->itemCount ||
+        unionFind->itemCount != data->components->itemCount) {
+      fprintf(stderr, "ERROR: the labelings found %d, %d and %d components\n",
+              data->components->itemCount, blocks->itemCount, unionFind->itemCount);
+      exit(1);
+    }
+    componentCount = data->components->itemCount;
+    swt__free_components(unionFind);
+    swt__free_components(blocks);
+    swt_free(data);
+  }
+
+  printf("%s    {\n", first ? "" : ",\n");
+  printf("      \"width\": %d, \"height\": %d, \"megapixels\": %.3f,\n", width,
+         height, width * (double)height / 1e6);
+  describe(context);
+  printf("      \"components\": %d,\n", componentCount);
+  printf("      \"stages\": {\n");
+
+  // samples are stored per iteration, gather them per stage
+  double *stage = (double *)malloc(sizeof(double) * iterations);
+  for (int s = 0; s <= BENCH_STAGE_COUNT; s++) {
+    for (int it = 0; it < iterations; it++) {
+      stage[it] = samples[(size_t)it * (BENCH_STAGE_COUNT + 1) + s];
+    }
+    bench_print_stage(s < BENCH_STAGE_COUNT ? stageNames[s] : "total", stage,
+                      iterations, width * (double)height / 1e6,
+                      s == BENCH_STAGE_COUNT);
+  }
+  printf("      }\n    }");
+  fflush(stdout);
+
+  free(stage);
+  free(samples);
+  free(bytes);
+}
+
+typedef struct {
+  double density;
+  int stroke;
+  int darkOnLight;
+} BenchPage;
+
+static void bench_describe_page(const void *context) {
+  const BenchPage *page = (const BenchPage *)context;
+  printf("      \"density\": %.3f, \"stroke\": %d, \"polarity\": \"%s\",\n",
+         page->density, page->stroke, page->darkOnLight ? "dark-on-light" : "light-on-dark");
+}
+
+static void bench_describe_image(const void *context) {
+  printf("      \"image\": \"%s\",\n", (const char *)context);
+}
+
+static void bench_run_page(double megapixels, double density, int stroke,
+                           int darkOnLight, int iterations, int first) {
+  int width = (int)sqrt(megapixels * 1e6 * 4.0 / 3.0);
+  int height = (int)(megapixels * 1e6 / width);
+
+  uint8_t *page = (uint8_t *)malloc((size_t)width * height * 3);
+  if (page == NULL) {
+    fprintf(stderr, "ERROR: unable to allocate a %dx%d page\n", width, height);
+    exit(1);
+  }
+  bench_render_text(page, width, height, density, stroke, darkOnLight);
+
+  BenchPage context = {density, stroke, darkOnLight};
+  bench_run(page, width, height, iterations, first, bench_describe_page, &context);
+  free(page);
+}
+
+static void bench_run_image(const char *path, int iterations, int first) {
+  int width, height, channels;
+  uint8_t *page = stbi_load(path, &width, &height, &channels, 3);
+  if (page == NULL) {
+    fprintf(stderr, "ERROR: unable to load %s\n", path);
+    exit(1);
+  }
+  bench_run(page, width, height, iterations, first, bench_describe_image, path);
+  stbi_image_free(page);
+}
+
+static int bench_parse_list(const char *arg, BenchList *list) {
+  char *end;
+  list->count = 0;
+
+  while (*arg && list->count < BENCH_MAX_VALUES) {
+    double value = strtod(arg, &end);
+    if (end == arg) return 0;
+    list->values[list->count++] = value;
+    arg = *end == ',' ? end + 1 : end;
+  }
+
+  return list->count > 0;
+}
+
+static double bench_list_min(const BenchList *list) {
+  double min = list->values[0];
+  for (int i = 1; i < list->count; i++) {
+    if (list->values[i] < min) min = list->values[i];
+  }
+  return min;
+}
+
+// Splits a comma separated list of paths in place
+static int bench_parse_paths(char *arg, char **paths, int *count) {
+  *count = 0;
+  while (*arg && *count < BENCH_MAX_VALUES) {
+    paths[(*count)++] = arg;
+    char *comma = strchr(arg, ',');
+    if (comma == NULL) break;
+    *comma = '\0';
+    arg = comma + 1;
+  }
+  return *count > 0;
+}
+
+int main(int argc, char **argv) {
+  BenchList megapixels = {{0.1, 1, 10}, 3};
+  BenchList densities = {{0.5}, 1};
+  BenchList strokes = {{2}, 1};
+  int polarities[2] = {1, 0}, polarityCount = 1;
+  int iterations = 10;
+  char *images[BENCH_MAX_VALUES];
+  int imageCount = 0;
+
+  for (int i = 1; i < argc; i++) {
+    char empty[1] = "";
+    char *value = i + 1 < argc ? argv[i + 1] : empty;
+    int ok = 1;
+
+    if (strcmp(argv[i], "--mp") == 0) {
+      ok = bench_parse_list(value, &megapixels) && bench_list_min(&megapixels) > 0;
+    } else if (strcmp(argv[i], "--density") == 0) {
+      ok = bench_parse_list(value, &densities);
+    } else if (strcmp(argv[i], "--stroke") == 0) {
+      // strokes are whole pixels
+      ok = bench_parse_list(value, &strokes) && bench_list_min(&strokes) >= 1;
+    } else if (strcmp(argv[i], "--iterations") == 0) {
+      iterations = atoi(value);
+      ok = iterations > 0;
+    } else if (strcmp(argv[i], "--images") == 0) {
+      ok = bench_parse_paths(value, images, &imageCount);
+    } else if (strcmp(argv[i], "--polarity") == 0) {
+      if (strcmp(value, "dark") == 0) {
+        polarities[0] = 1, polarityCount = 1;
+      } else if (strcmp(value, "light") == 0) {
+        polarities[0] = 0, polarityCount = 1;
+      } else if (strcmp(value, "both") == 0) {
+        polarities[0] = 1, polarities[1] = 0, polarityCount = 2;
+      } else {
+        ok = 0;
+      }
+    } else {
+      ok = 0;
+    }
+
+    if (!ok) {
+      fprintf(stderr,
+              "Usage: %s [--mp 0.1,1,10] [--density 0.5] [--stroke 2] "
+              "[--polarity dark|light|both] [--iterations 10] "
+              "[--images a.jpg,b.png]\n",
+              argv[0]);
+      return 1;
+    }
+    i++;
+  }
+
+  printf("{\n  \"isa\": \"%s\",\n  \"iterations\": %d,\n  \"runs\": [\n",
+         swt_get_isa(), iterations);
+
+  int first = 1;
+  for (int i = 0; i < imageCount; i++) {
+    bench_run_image(images[i], iterations, first);
+    first = 0;
+  }
+  for (int m = 0; m < megapixels.count && imageCount == 0; m++) {
+    for (int d = 0; d < densities.count; d++) {
+      for (int s = 0; s < strokes.count; s++) {
+        for (int p = 0; p < polarityCount; p++) {
+          bench_run_page(megapixels.values[m], densities.values[d],
+                         (int)strokes.values[s], polarities[p], iterations, first);
+          first = 0;
+        }
+      }
+    }
+  }
+
+  printf("\n  ]\n}\n");
+  return 0;
+}
@@ -2,6 +2,7 @@
 
 set CC=gcc
 set CFLAGS=-Wall -Wextra -pedantic
+set LIBS=-lpthread
 set SRCS=main.c
 set OUT=swt.exe
 
@@ -15,6 +16,12 @@ if "%1" == "TEST" (
     set OUT=swt_test.exe
 )
 
+if "%1" == "BENCH" (
+    set CFLAGS=%CFLAGS% -O2
+    set SRCS=./bench/swt_bench.c
+    set OUT=swt_bench.exe
+)
+
 
 
-%CC% %CFLAGS% %SRCS% -o %OUT%
+%CC% %CFLAGS% %SRCS% -o %OUT% %LIBS%
@@ -1,3 +1,7 @@
+#ifdef __linux__
+#define _GNU_SOURCE // memfd_create
+#endif
+
 #define SWT_IMPLEMENTATION
 #include "swt.h"
 
@@ -7,36 +11,1677 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "thirdparty/stb_image_write.h"
 
-int main(int argc, char** argv) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <input> <output>\n", argv[0]);
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#define CONFIDENCE_THRESHOLD 20
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s <input> <output> [--format F] [--pyramid N] [--tiles N] [--threads N]\n"
+            "       %s --batch <dir|glob|-> [--out results.jsonl] [--threads N]\n"
+            "              [--visualize <dir>] [--format F] [--confidence N] [--pyramid N]\n"
+            "              [--triage MS] [--deadline MS] [--memory MB] [--top N]\n"
+            "       %s --serve <socket> [--threads N] [--confidence N] [--deadline MS]\n"
+            "              [--memory MB]\n"
+            "       %s --client <socket> [--raw] <image>...\n"
+            "       %s --stream <width>x<height> [--ring N] [--confidence N] [--incremental N]\n"
+            "\n"
+            "  --batch       process every image in a directory, matching a glob, or\n"
+            "                listed one per line on stdin (-)\n"
+            "  --out         JSON lines file with per-image results (default: stdout)\n"
+            "  --threads     number of worker threads (default: 4)\n"
+            "  --visualize   also write the highlighted images to this directory\n"
+            "  --format      output written for every image: jpg, png (uncompressed),\n"
+            "                pnm, raw, mask (PBM of the text pixels), label (16 bit PGM\n"
+            "                of component ids) or none; by default it follows the\n"
+            "                extension of <output>, or jpg\n"
+            "  --confidence  components at or below this stroke width are text (default: %d)\n"
+            "  --pyramid     look for text on the image halved up to N times first, and\n"
+            "                only run at full resolution around what was found there\n"
+            "  --tiles       split the image into tiles of N x N pixels that are worked\n"
+            "                on by --threads threads, for very large scans\n"
+            "  --triage      skip images without any text, found by a quick check that\n"
+            "                takes at most MS milliseconds (0: no limit)\n"
+            "  --deadline    stop working on an image after MS milliseconds and report\n"
+            "                the text found so far, marked with a deadline status\n"
+            "  --memory      work within about MB megabytes per image besides the image\n"
+            "                itself, halving images that need more (reported as scale)\n"
+            "  --top         only report the N text components with the thinnest strokes\n"
+            "  --serve       keep running and answer requests on a unix domain socket\n"
+            "  --client      send images to a running server and print the results;\n"
+            "                with --raw they are decoded to gray here and passed as a memfd\n"
+            "  --stream      read raw 8 bit gray frames of the given size from stdin\n"
+            "                (eg. ffmpeg -f rawvideo -pix_fmt gray -) and write one JSON\n"
+            "                line per frame to stdout\n"
+            "  --ring        number of frame buffers in flight (default: 4)\n"
+            "  --incremental only reprocess the parts of a frame that changed since the\n"
+            "                previous one, starting over every N frames (0: never)\n",
+            program, program, program, program, program, CONFIDENCE_THRESHOLD);
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+typedef struct {
+    char **items;
+    int count;
+    int capacity;
+} PathList;
+
+static void path_list_push(PathList *paths, const char *path) {
+    if (paths->count == paths->capacity) {
+        paths->capacity = paths->capacity ? paths->capacity * 2 : 64;
+        paths->items = (char **)realloc(paths->items, paths->capacity * sizeof(char *));
+        SWT_IF_NO_MEMORY_EXIT(paths->items);
+    }
+
+    paths->items[paths->count] = (char *)malloc(strlen(path) + 1);
+    SWT_IF_NO_MEMORY_EXIT(paths->items[paths->count]);
+    strcpy(paths->items[paths->count], path);
+    paths->count++;
+}
+
+static void path_list_free(PathList *paths) {
+    for (int i = 0; i < paths->count; i++) {
+        free(paths->items[i]);
+    }
+    free(paths->items);
+}
+
+// `source` is either "-" for a newline separated list on stdin, a directory
+// (not recursed into) or a glob pattern
+static int collect_paths(const char *source, PathList *paths) {
+    if (strcmp(source, "-") == 0) {
+        char line[4096];
+        while (fgets(line, sizeof(line), stdin)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] != '\0') path_list_push(paths, line);
+        }
+        return 1;
+    }
+
+    struct stat info;
+    if (stat(source, &info) == 0 && S_ISDIR(info.st_mode)) {
+        DIR *dir = opendir(source);
+        if (dir == NULL) return 0;
+
+        struct dirent *entry;
+        char path[4096];
+        while ((entry = readdir(dir)) != NULL) {
+            snprintf(path, sizeof(path), "%s/%s", source, entry->d_name);
+            if (stat(path, &info) == 0 && S_ISREG(info.st_mode)) {
+                path_list_push(paths, path);
+            }
+        }
+        closedir(dir);
+        return 1;
+    }
+
+#ifndef _WIN32
+    glob_t matches;
+    if (glob(source, 0, NULL, &matches) == 0) {
+        for (size_t i = 0; i < matches.gl_pathc; i++) {
+            path_list_push(paths, matches.gl_pathv[i]);
+        }
+        globfree(&matches);
+        return 1;
+    }
+#endif
+
+    return 0;
+}
+
+static void json_write_string(FILE *out, const char *text) {
+    fputc('"', out);
+    for (; *text; text++) {
+        unsigned char c = (unsigned char)*text;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+/*
+   Image loading
+
+   Binary 8 bit PGM (P5) and PBM (P4) files are memory mapped instead of
+   decoded. PGM pixels are used straight out of the mapping, which is private
+   so the in place pre-processing only copies the pages it writes to. PBM bits
+   are expanded into a mask directly, skipping grayscale and threshold.
+   Everything else is decoded by stb_image.
+*/
+
+typedef struct {
+    SWTImage image;
+    int isMask;       // already binary, see swt_apply_stroke_width_transform_to_mask
+    uint8_t *decoded; // owned pixels (stb_image or an expanded PBM), if any
+    void *mapping;
+    size_t mappingSize;
+} LoadedImage;
+
+#ifndef _WIN32
+
+// Parses a P4/P5 header, *offset is where the pixels start
+static int pnm_parse_header(const uint8_t *bytes, size_t size, int *format,
+                            int *width, int *height, int *maxValue, size_t *offset) {
+    if (size < 3 || bytes[0] != 'P' || (bytes[1] != '4' && bytes[1] != '5')) return 0;
+    *format = bytes[1] - '0';
+
+    int values[3] = { 0, 0, 1 };
+    int valueCount = *format == 5 ? 3 : 2;
+    size_t i = 2;
+
+    for (int v = 0; v < valueCount; v++) {
+        // whitespace and comments may appear between any two header values
+        for (;;) {
+            while (i < size && (bytes[i] == ' ' || bytes[i] == '\t' || bytes[i] == '\r' || bytes[i] == '\n')) i++;
+            if (i < size && bytes[i] == '#') {
+                while (i < size && bytes[i] != '\n') i++;
+                continue;
+            }
+            break;
+        }
+
+        if (i >= size || bytes[i] < '0' || bytes[i] > '9') return 0;
+        while (i < size && bytes[i] >= '0' && bytes[i] <= '9') {
+            values[v] = values[v] * 10 + (bytes[i] - '0');
+            if (values[v] > 1 << 24) return 0;
+            i++;
+        }
+    }
+
+    // exactly one whitespace byte separates the header from the pixels
+    if (i >= size) return 0;
+    *width = values[0];
+    *height = values[1];
+    *maxValue = values[2];
+    *offset = i + 1;
+    return *width > 0 && *height > 0;
+}
+
+static int load_mapped_image(const char *path, LoadedImage *loaded) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < 3) {
+        close(fd);
+        return 0;
+    }
+
+    size_t size = (size_t)info.st_size;
+    uint8_t *bytes = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (bytes == MAP_FAILED) return 0;
+
+    int format, width, height, maxValue;
+    size_t offset;
+    if (!pnm_parse_header(bytes, size, &format, &width, &height, &maxValue, &offset)) {
+        munmap(bytes, size);
+        return 0;
+    }
+
+    if (format == 5 && maxValue == 255 && offset + (size_t)width * height <= size) {
+        loaded->image = (SWTImage){ bytes + offset, width, height, 1 };
+        loaded->mapping = bytes;
+        loaded->mappingSize = size;
+        return 1;
+    }
+
+    int stride = (width + 7) / 8;
+    if (format == 4 && offset + (size_t)stride * height <= size) {
+        loaded->decoded = (uint8_t *)malloc((size_t)width * height);
+        SWT_IF_NO_MEMORY_EXIT(loaded->decoded);
+        loaded->image = (SWTImage){ loaded->decoded, width, height, 1 };
+        swt_unpack_mask(bytes + offset, stride, &loaded->image);
+        loaded->isMask = 1;
+        munmap(bytes, size);
+        return 1;
+    }
+
+    // 16 bit or rescaled PGMs go through stb_image
+    munmap(bytes, size);
+    return 0;
+}
+
+#endif // _WIN32
+
+// `channels` is passed on to stb_image as the requested channel count
+static int load_image(const char *path, int channels, LoadedImage *loaded) {
+    memset(loaded, 0, sizeof(*loaded));
+
+#ifndef _WIN32
+    if (load_mapped_image(path, loaded)) return 1;
+#endif
+
+    int width, height, fileChannels;
+    loaded->decoded = stbi_load(path, &width, &height, &fileChannels, channels);
+    if (!loaded->decoded) return 0;
+
+    loaded->image = (SWTImage){ loaded->decoded, width, height, channels ? channels : fileChannels };
+    return 1;
+}
+
+static void release_image(LoadedImage *loaded) {
+#ifndef _WIN32
+    if (loaded->mapping) munmap(loaded->mapping, loaded->mappingSize);
+#endif
+    // stbi_image_free is plain free unless STBI_FREE is overridden
+    if (loaded->decoded) stbi_image_free(loaded->decoded);
+    memset(loaded, 0, sizeof(*loaded));
+}
+
+// `pyramidLevels` > 0 runs the coarse to fine variant, which needs to know
+// what counts as text up front
+static void apply_transform(LoadedImage *loaded, SWTData *data, int pyramidLevels,
+                            int confidenceThreshold) {
+    if (loaded->isMask) {
+        swt_apply_stroke_width_transform_to_mask(&loaded->image, data->components, data->results);
+    } else if (pyramidLevels > 0) {
+        swt_apply_stroke_width_transform_pyramid(&loaded->image, data->components, data->results,
+                                                 pyramidLevels, confidenceThreshold);
+    } else {
+        swt_apply_stroke_width_transform(&loaded->image, data->components, data->results);
+    }
+}
+
+// Hands back `data` ready for an image of `size` pixels, only reallocating
+// when it is too small
+static SWTData *reuse_data(SWTData *data, size_t size) {
+    if (data == NULL || data->size < size) {
+        if (data) swt_free(data);
+        return swt_allocate(size);
+    }
+
+    swt_reset(data);
+    return data;
+}
+
+/*
+   Output formats
+
+   The JPEG encoder is often slower than the detection itself, so the other
+   formats are all written uncompressed: binary PNM, raw bytes, and PNG with
+   stored (uncompressed) deflate blocks. Besides the highlighted image, the
+   text pixels can be written as a PBM mask and the components as a 16 bit
+   PGM label image, where 0 is background and component i is i + 1.
+*/
+
+typedef enum {
+    OUTPUT_JPG,
+    OUTPUT_PNG,
+    OUTPUT_PNM,
+    OUTPUT_RAW,
+    OUTPUT_MASK,
+    OUTPUT_LABEL,
+    OUTPUT_NONE,
+} OutputFormat;
+
+static const char *outputNames[] = { "jpg", "png", "pnm", "raw", "mask", "label", "none" };
+
+static int output_format_parse(const char *name, OutputFormat *format) {
+    for (int i = 0; i < (int)(sizeof(outputNames) / sizeof(outputNames[0])); i++) {
+        if (strcmp(name, outputNames[i]) == 0) {
+            *format = (OutputFormat)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static OutputFormat output_format_from_path(const char *path) {
+    const char *extension = strrchr(path, '.');
+    if (extension == NULL) return OUTPUT_JPG;
+    extension++;
+
+    if (strcmp(extension, "png") == 0) return OUTPUT_PNG;
+    if (strcmp(extension, "pgm") == 0 || strcmp(extension, "ppm") == 0) return OUTPUT_PNM;
+    if (strcmp(extension, "pbm") == 0) return OUTPUT_MASK;
+    if (strcmp(extension, "raw") == 0) return OUTPUT_RAW;
+    return OUTPUT_JPG;
+}
+
+static const char *output_extension(OutputFormat format, int channels) {
+    switch (format) {
+    case OUTPUT_PNG: return "png";
+    case OUTPUT_PNM: return channels == 1 ? "pgm" : "ppm";
+    case OUTPUT_RAW: return "raw";
+    case OUTPUT_MASK: return "pbm";
+    case OUTPUT_LABEL: return "pgm";
+    default: return "jpg";
+    }
+}
+
+// One image on its way to disk. The highlighted formats carry the loaded
+// image itself, masks and labels are rendered into `bytes` up front so the
+// SWTData can be reused while the file is being written.
+typedef struct OutputTask {
+    char path[4096];
+    OutputFormat format;
+    LoadedImage loaded;
+    uint8_t *bytes;
+    size_t size;
+    int width;
+    int height;
+    struct OutputTask *next;
+} OutputTask;
+
+// Takes ownership of `loaded` unless the format only needs the results
+static OutputTask *output_task_create(const char *path, OutputFormat format, LoadedImage *loaded,
+                                      SWTData *data, int confidenceThreshold) {
+    OutputTask *task = (OutputTask *)calloc(1, sizeof(OutputTask));
+    SWT_IF_NO_MEMORY_EXIT(task);
+    snprintf(task->path, sizeof(task->path), "%s", path);
+    task->format = format;
+    task->width = loaded->image.width;
+    task->height = loaded->image.height;
+
+    if (format == OUTPUT_MASK) {
+        // PBM rows are padded to whole bytes, set bits are black
+        int stride = (task->width + 7) / 8;
+        task->size = (size_t)stride * task->height;
+        task->bytes = (uint8_t *)calloc(task->size, 1);
+        SWT_IF_NO_MEMORY_EXIT(task->bytes);
+
+        for (int i = 0; i < data->results->itemCount; i++) {
+            if (data->results->confidences[i] > confidenceThreshold) continue;
+
+            SWTComponent *component = data->results->components[i];
+            for (int j = 0; j < component->pointCount; j++) {
+                SWTPoint point = component->points[j];
+                task->bytes[point.y * stride + point.x / 8] |= 0x80 >> (point.x % 8);
+            }
+        }
+    } else if (format == OUTPUT_LABEL) {
+        // 16 bit PGM samples are big endian, ids past 65535 saturate
+        task->size = (size_t)task->width * task->height * 2;
+        task->bytes = (uint8_t *)calloc(task->size, 1);
+        SWT_IF_NO_MEMORY_EXIT(task->bytes);
+
+        for (int i = 0; i < data->components->itemCount; i++) {
+            SWTComponent *component = &data->components->items[i];
+            int label = i + 1 < 65535 ? i + 1 : 65535;
+
+            for (int j = 0; j < component->pointCount; j++) {
+                SWTPoint point = component->points[j];
+                size_t index = ((size_t)point.y * task->width + point.x) * 2;
+                task->bytes[index] = (uint8_t)(label >> 8);
+                task->bytes[index + 1] = (uint8_t)label;
+            }
+        }
+    } else {
+        swt_visualize_text_on_image(&loaded->image, data->results, confidenceThreshold);
+        task->loaded = *loaded;
+        memset(loaded, 0, sizeof(*loaded));
+    }
+
+    return task;
+}
+
+static void output_task_free(OutputTask *task) {
+    release_image(&task->loaded);
+    free(task->bytes);
+    free(task);
+}
+
+static uint32_t crcTable[256];
+
+static void crc_init_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        crcTable[i] = c;
+    }
+}
+
+static uint32_t crc_update(uint32_t crc, const uint8_t *bytes, size_t size) {
+    for (size_t i = 0; i < size; i++) crc = crcTable[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+// Streams the IDAT payload: a zlib stream made of stored deflate blocks
+typedef struct {
+    FILE *file;
+    uint32_t crc;
+    uint32_t adlerA;
+    uint32_t adlerB;
+    size_t remaining;  // uncompressed bytes not yet written
+    size_t blockLeft;  // bytes left in the current stored block
+} PngStoredWriter;
+
+static void png_write_be32(FILE *file, uint32_t value, uint32_t *crc) {
+    uint8_t bytes[4] = { (uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value };
+    fwrite(bytes, 1, 4, file);
+    if (crc) *crc = crc_update(*crc, bytes, 4);
+}
+
+static void png_stored_write(PngStoredWriter *writer, const uint8_t *bytes, size_t size) {
+    while (size > 0) {
+        if (writer->blockLeft == 0) {
+            size_t length = writer->remaining < 65535 ? writer->remaining : 65535;
+            uint8_t header[5] = {
+                (uint8_t)(length == writer->remaining), // BFINAL, BTYPE 00
+                (uint8_t)length, (uint8_t)(length >> 8),
+                (uint8_t)~length, (uint8_t)(~length >> 8),
+            };
+            fwrite(header, 1, sizeof(header), writer->file);
+            writer->crc = crc_update(writer->crc, header, sizeof(header));
+            writer->blockLeft = length;
+        }
+
+        size_t count = size < writer->blockLeft ? size : writer->blockLeft;
+        fwrite(bytes, 1, count, writer->file);
+        writer->crc = crc_update(writer->crc, bytes, count);
+        for (size_t i = 0; i < count; i++) {
+            writer->adlerA = (writer->adlerA + bytes[i]) % 65521;
+            writer->adlerB = (writer->adlerB + writer->adlerA) % 65521;
+        }
+
+        writer->blockLeft -= count;
+        writer->remaining -= count;
+        bytes += count;
+        size -= count;
+    }
+}
+
+static int write_png_stored(const char *path, const SWTImage *image) {
+    static const uint8_t colorTypes[5] = { 0, 0, 4, 2, 6 };
+    if (image->channels < 1 || image->channels > 4) return 0;
+
+    FILE *file = fopen(path, "wb");
+    if (!file) return 0;
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    fwrite(signature, 1, sizeof(signature), file);
+
+    uint8_t header[17] = { 'I', 'H', 'D', 'R' };
+    for (int i = 0; i < 4; i++) {
+        header[4 + i] = (uint8_t)(image->width >> (24 - 8 * i));
+        header[8 + i] = (uint8_t)(image->height >> (24 - 8 * i));
+    }
+    header[12] = 8; // bit depth
+    header[13] = colorTypes[image->channels];
+    png_write_be32(file, 13, NULL);
+    fwrite(header, 1, sizeof(header), file);
+    png_write_be32(file, crc_update(0xffffffffu, header, sizeof(header)) ^ 0xffffffffu, NULL);
+
+    // every row is prefixed with filter type 0 (none)
+    size_t rowSize = (size_t)image->width * image->channels;
+    size_t rawSize = (rowSize + 1) * image->height;
+    size_t blocks = (rawSize + 65534) / 65535;
+    PngStoredWriter writer = { file, 0xffffffffu, 1, 0, rawSize, 0 };
+
+    png_write_be32(file, (uint32_t)(2 + blocks * 5 + rawSize + 4), NULL);
+    static const uint8_t idat[6] = { 'I', 'D', 'A', 'T', 0x78, 0x01 };
+    fwrite(idat, 1, sizeof(idat), file);
+    writer.crc = crc_update(writer.crc, idat, sizeof(idat));
+
+    static const uint8_t filter = 0;
+    for (int y = 0; y < image->height; y++) {
+        png_stored_write(&writer, &filter, 1);
+        png_stored_write(&writer, image->bytes + y * rowSize, rowSize);
+    }
+    png_write_be32(file, (writer.adlerB << 16) | writer.adlerA, &writer.crc);
+    png_write_be32(file, writer.crc ^ 0xffffffffu, NULL);
+
+    static const uint8_t end[12] = { 0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xae, 0x42, 0x60, 0x82 };
+    fwrite(end, 1, sizeof(end), file);
+
+    return fclose(file) == 0;
+}
+
+static int write_pnm(const char *path, const char *magic, int width, int height, int maxValue,
+                     const uint8_t *bytes, size_t size) {
+    FILE *file = fopen(path, "wb");
+    if (!file) return 0;
+
+    if (maxValue) {
+        fprintf(file, "%s\n%d %d\n%d\n", magic, width, height, maxValue);
+    } else if (magic) {
+        fprintf(file, "%s\n%d %d\n", magic, width, height);
+    }
+
+    size_t written = fwrite(bytes, 1, size, file);
+    return (fclose(file) == 0) & (written == size);
+}
+
+static int output_task_write(OutputTask *task) {
+    SWTImage *image = &task->loaded.image;
+    size_t imageSize = (size_t)image->width * image->height * image->channels;
+
+    switch (task->format) {
+    case OUTPUT_JPG:
+        return stbi_write_jpg(task->path, image->width, image->height, image->channels, image->bytes, 100);
+    case OUTPUT_PNG:
+        return write_png_stored(task->path, image);
+    case OUTPUT_PNM:
+        if (image->channels != 1 && image->channels != 3) return 0;
+        return write_pnm(task->path, image->channels == 1 ? "P5" : "P6", image->width, image->height,
+                         255, image->bytes, imageSize);
+    case OUTPUT_RAW:
+        return write_pnm(task->path, NULL, 0, 0, 0, image->bytes, imageSize);
+    case OUTPUT_MASK:
+        return write_pnm(task->path, "P4", task->width, task->height, 0, task->bytes, task->size);
+    case OUTPUT_LABEL:
+        return write_pnm(task->path, "P5", task->width, task->height, 65535, task->bytes, task->size);
+    default:
+        return 1;
+    }
+}
+
+// A bounded queue drained by one encoder thread, so writing the output of one
+// image overlaps with detecting text in the next
+typedef struct {
+    OutputTask *head;
+    OutputTask *tail;
+    int count;
+    int capacity;
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+} OutputQueue;
+
+static void output_queue_push(OutputQueue *queue, OutputTask *task) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->capacity) pthread_cond_wait(&queue->notFull, &queue->lock);
+
+    if (queue->tail) {
+        queue->tail->next = task;
+    } else {
+        queue->head = task;
+    }
+    queue->tail = task;
+    queue->count++;
+
+    pthread_cond_signal(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void output_queue_close(OutputQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = 1;
+    pthread_cond_signal(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void *output_encoder(void *arg) {
+    OutputQueue *queue = (OutputQueue *)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        while (queue->head == NULL && !queue->closed) pthread_cond_wait(&queue->notEmpty, &queue->lock);
+
+        OutputTask *task = queue->head;
+        if (task) {
+            queue->head = task->next;
+            if (queue->head == NULL) queue->tail = NULL;
+            queue->count--;
+            pthread_cond_signal(&queue->notFull);
+        }
+        pthread_mutex_unlock(&queue->lock);
+        if (task == NULL) break;
+
+        if (!output_task_write(task)) {
+            fprintf(stderr, "ERROR: unable to write %s\n", task->path);
+        }
+        output_task_free(task);
+    }
+
+    return NULL;
+}
+
+typedef struct {
+    PathList *paths;
+    int next;
+    pthread_mutex_t lock;
+
+    FILE *out;
+    pthread_mutex_t outLock;
+
+    const char *visualizeDir;
+    OutputFormat format;
+    OutputQueue output;
+    int pyramidLevels;
+    int triage;
+    double triageBudgetMs;
+    double deadlineMs; // per image, from before it is decoded, 0 for none
+    size_t memoryBudget; // per image, 0 for none
+    int confidenceThreshold;
+    int top; // boxes reported per image, 0 for all
+    int failures;
+} BatchJob;
+
+static int compare_ints(const void *a, const void *b) {
+    return (*(const int *)a > *(const int *)b) - (*(const int *)a < *(const int *)b);
+}
+
+static void batch_write_result(BatchJob *job, const char *path, SWTImage *image,
+                               SWTData *data, SWTStats *stats, double decodeMs,
+                               double triageMs) {
+    pthread_mutex_lock(&job->outLock);
+    FILE *out = job->out;
+
+    fputs("{\"path\": ", out);
+    json_write_string(out, path);
+    fprintf(out, ", \"width\": %d, \"height\": %d, \"components\": %d",
+            image->width, image->height, data->components->itemCount);
+    fprintf(out,
+            ", \"timings\": {\"decode_ms\": %.3f, \"triage_ms\": %.3f, \"grayscale_ms\": %.3f, "
+            "\"threshold_ms\": %.3f, \"cca_ms\": %.3f, \"stroke_width_ms\": %.3f, "
+            "\"total_ms\": %.3f}",
+            decodeMs, triageMs, stats->grayscaleMs, stats->thresholdMs, stats->ccaMs,
+            stats->strokeWidthMs, stats->totalMs);
+    if (data->results->status == SWT_STATUS_DEADLINE) {
+        fputs(", \"status\": \"deadline\"", out);
+    } else if (data->results->status == SWT_STATUS_NO_MEMORY) {
+        fputs(", \"status\": \"no_memory\"", out);
+    }
+    // the image was halved to fit the memory budget, boxes are scaled back
+    int scale = data->results->scale > 1 ? data->results->scale : 1;
+    if (scale > 1) {
+        fprintf(out, ", \"scale\": %d", scale);
+    }
+    if (data->results->degraded & SWT_DEGRADED_SKIPPED) {
+        fputs(", \"skipped\": true", out);
+    }
+
+    // --top keeps the thinnest strokes, still listed in scan order
+    SWTFilter filter = {0};
+    filter.set = SWT_FILTER_MAX_CONFIDENCE;
+    filter.maxConfidence = job->confidenceThreshold;
+    int *indices = (int *)malloc((data->results->itemCount + 1) * sizeof(int));
+    int count = indices ? swt_filter_results(data->results, &filter, indices) : 0;
+    if (job->top > 0 && count > job->top) {
+        count = swt_select_top_results(data->results, indices, count, job->top);
+        qsort(indices, count, sizeof(int), compare_ints);
+    }
+
+    fputs(", \"text\": [", out);
+    for (int n = 0; n < count; n++) {
+        int i = indices[n];
+        SWTBox box = swt_get_result_box(data->results, i);
+        box = (SWTBox){box.x * scale, box.y * scale, box.width * scale, box.height * scale};
+        fprintf(out, "%s{\"x\": %d, \"y\": %d, \"width\": %d, \"height\": %d, \"confidence\": %.1f}",
+                n == 0 ? "" : ", ", box.x, box.y, box.width, box.height,
+                data->results->confidences[i]);
+    }
+    fputs("]}\n", out);
+    free(indices);
+
+    pthread_mutex_unlock(&job->outLock);
+}
+
+static void batch_write_error(BatchJob *job, const char *path, const char *error) {
+    pthread_mutex_lock(&job->outLock);
+    fputs("{\"path\": ", job->out);
+    json_write_string(job->out, path);
+    fputs(", \"error\": ", job->out);
+    json_write_string(job->out, error);
+    fputs("}\n", job->out);
+    job->failures++;
+    pthread_mutex_unlock(&job->outLock);
+}
+
+// Every worker keeps one SWTData around and only grows it when an image is
+// larger than anything it has seen so far
+static void *batch_worker(void *arg) {
+    BatchJob *job = (BatchJob *)arg;
+    SWTData *data = NULL;
+    SWTStats stats;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        int index = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (index >= job->paths->count) break;
+
+        const char *path = job->paths->items[index];
+
+        double start = now_ms();
+        double deadline = job->deadlineMs > 0 ? swt_now_ms() + job->deadlineMs : 0;
+        LoadedImage loaded;
+        // always decoded to gray, so the results don't depend on the output
+        // format; the highlighted image is the binarized one either way
+        if (!load_image(path, 1, &loaded)) {
+            batch_write_error(job, path, "unable to load image");
+            continue;
+        }
+        double decodeMs = now_ms() - start;
+
+        SWTImage *image = &loaded.image;
+        SWTImage original = *image;
+        data = reuse_data(data, (size_t)image->width * image->height);
+        if (data == NULL) {
+            batch_write_error(job, path, "out of memory");
+            release_image(&loaded);
+            continue;
+        }
+        data->results->stats = &stats;
+        data->results->deadlineMs = deadline;
+        data->results->memoryBudget = job->memoryBudget;
+
+        // images triage is sure have no text skip the transform, when it runs
+        // out of time they are processed anyway
+        int hasText = 1;
+        double triageMs = 0;
+        if (job->triage && !loaded.isMask) {
+            start = now_ms();
+            SWTTriage triage = swt_triage_text(image, job->confidenceThreshold, job->triageBudgetMs);
+            triageMs = now_ms() - start;
+            hasText = triage.containsText || triage.timedOut;
+        }
+
+        if (hasText) {
+            apply_transform(&loaded, data, job->pyramidLevels, job->confidenceThreshold);
+        } else {
+            memset(&stats, 0, sizeof(stats));
+        }
+
+        batch_write_result(job, path, &original, data, &stats, decodeMs, triageMs);
+
+        if (job->visualizeDir && job->format != OUTPUT_NONE) {
+            const char *name = strrchr(path, '/');
+            name = name ? name + 1 : path;
+
+            char output[4096];
+            snprintf(output, sizeof(output), "%s/%s.%s", job->visualizeDir, name,
+                     output_extension(job->format, image->channels));
+
+            output_queue_push(&job->output,
+                              output_task_create(output, job->format, &loaded, data, job->confidenceThreshold));
+        }
+        release_image(&loaded);
+    }
+
+    if (data) swt_free(data);
+    return NULL;
+}
+
+static int run_batch(int argc, char **argv) {
+    const char *source = NULL, *outPath = NULL;
+    BatchJob job;
+    memset(&job, 0, sizeof(job));
+    job.confidenceThreshold = CONFIDENCE_THRESHOLD;
+    int threadCount = 4;
+
+    for (int i = 1; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (value == NULL) {
+            usage(argv[0]);
+            return 1;
+        }
+
+        if (strcmp(argv[i], "--batch") == 0) {
+            source = value;
+        } else if (strcmp(argv[i], "--out") == 0) {
+            outPath = value;
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            threadCount = atoi(value);
+        } else if (strcmp(argv[i], "--visualize") == 0) {
+            job.visualizeDir = value;
+        } else if (strcmp(argv[i], "--format") == 0) {
+            if (!output_format_parse(value, &job.format)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--confidence") == 0) {
+            job.confidenceThreshold = atoi(value);
+        } else if (strcmp(argv[i], "--pyramid") == 0) {
+            job.pyramidLevels = atoi(value);
+        } else if (strcmp(argv[i], "--triage") == 0) {
+            job.triage = 1;
+            job.triageBudgetMs = atof(value);
+        } else if (strcmp(argv[i], "--deadline") == 0) {
+            job.deadlineMs = atof(value);
+        } else if (strcmp(argv[i], "--memory") == 0) {
+            job.memoryBudget = (size_t)(atof(value) * 1024 * 1024);
+        } else if (strcmp(argv[i], "--top") == 0) {
+            job.top = atoi(value);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+        i++;
+    }
+
+    if (source == NULL || threadCount < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    PathList paths = {0};
+    if (!collect_paths(source, &paths)) {
+        fprintf(stderr, "ERROR: no images found for %s\n", source);
+        return 1;
+    }
+
+    job.out = stdout;
+    if (outPath && (job.out = fopen(outPath, "w")) == NULL) {
+        fprintf(stderr, "ERROR: unable to open %s\n", outPath);
+        path_list_free(&paths);
+        return 1;
+    }
+
+    job.paths = &paths;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_mutex_init(&job.outLock, NULL);
+
+    // the lookup tables are shared, build them before any worker starts
+    swt_init_tables();
+    crc_init_table();
+
+    if (threadCount > paths.count) threadCount = paths.count ? paths.count : 1;
+    pthread_t *threads = (pthread_t *)malloc(threadCount * sizeof(pthread_t));
+    SWT_IF_NO_MEMORY_EXIT(threads);
+
+    // a couple of images per worker may wait for the encoder
+    job.output.capacity = threadCount * 2;
+    pthread_mutex_init(&job.output.lock, NULL);
+    pthread_cond_init(&job.output.notEmpty, NULL);
+    pthread_cond_init(&job.output.notFull, NULL);
+    pthread_t encoder;
+    pthread_create(&encoder, NULL, output_encoder, &job.output);
+
+    for (int i = 0; i < threadCount; i++) {
+        pthread_create(&threads[i], NULL, batch_worker, &job);
+    }
+    for (int i = 0; i < threadCount; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    output_queue_close(&job.output);
+    pthread_join(encoder, NULL);
+
+    free(threads);
+    if (job.out != stdout) fclose(job.out);
+    pthread_mutex_destroy(&job.lock);
+    pthread_mutex_destroy(&job.outLock);
+    pthread_mutex_destroy(&job.output.lock);
+    pthread_cond_destroy(&job.output.notEmpty);
+    pthread_cond_destroy(&job.output.notFull);
+    path_list_free(&paths);
+
+    return job.failures ? 1 : 0;
+}
+
+#ifdef __linux__
+
+/*
+   Server mode
+
+   A client connects to the unix domain socket and sends any number of
+   requests over the same connection, each one answered before the next is
+   read. A request either names an image file for the server to decode, or
+   carries raw pixels in a memfd passed along with SCM_RIGHTS which the server
+   maps privately and processes in place, only the pages it writes to are
+   copied and the client's buffer is left alone. The memfd has to be sealed
+   against shrinking, growing and writing, so the client can't pull the pages
+   out from under the mapping.
+
+   Every worker thread accepts connections on its own and keeps a warm
+   SWTData, the lookup tables are shared and built once at startup.
+
+   All fields are in host byte order, this never leaves the machine.
+*/
+
+#define SERVE_MAGIC 0x31545753 // "SWT1"
+#define SERVE_MAX_PATH 4096
+// a pixel memfd must carry all of these
+#define SERVE_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
+
+enum { SERVE_REQUEST_PATH = 0, SERVE_REQUEST_PIXELS = 1 };
+
+typedef struct {
+    uint32_t magic;
+    uint32_t kind;
+    uint32_t width;      // SERVE_REQUEST_PIXELS only
+    uint32_t height;     // SERVE_REQUEST_PIXELS only
+    uint32_t channels;   // SERVE_REQUEST_PIXELS only, 1 (gray) or 3 (rgb)
+    uint32_t pathLength; // SERVE_REQUEST_PATH only, the path follows
+} ServeRequest;
+
+// SERVE_PARTIAL replies carry the boxes found before the deadline, or before
+// running out of memory
+enum { SERVE_OK = 0, SERVE_PARTIAL = 1, SERVE_BAD_REQUEST = -1, SERVE_LOAD_FAILED = -2,
+       SERVE_NO_MEMORY = -3 };
+
+typedef struct {
+    uint32_t magic;
+    int32_t status;
+    uint32_t width;
+    uint32_t height;
+    uint32_t componentCount;
+    uint32_t boxCount; // this many ServeBox follow
+    float milliseconds;
+} ServeReply;
+
+typedef struct {
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+    float confidence;
+} ServeBox;
+
+typedef struct {
+    int listener;
+    int confidenceThreshold;
+    double deadlineMs; // per request, from when it was read, 0 for none
+    size_t memoryBudget; // per request, 0 for none
+} ServeJob;
+
+static int read_full(int fd, void *buffer, size_t size) {
+    uint8_t *bytes = (uint8_t *)buffer;
+    while (size > 0) {
+        ssize_t n = read(fd, bytes, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        bytes += n;
+        size -= (size_t)n;
+    }
+    return 1;
+}
+
+static int write_full(int fd, const void *buffer, size_t size) {
+    const uint8_t *bytes = (const uint8_t *)buffer;
+    while (size > 0) {
+        ssize_t n = write(fd, bytes, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        bytes += n;
+        size -= (size_t)n;
+    }
+    return 1;
+}
+
+// Reads a request header along with the file descriptor that may come with
+// it. *fd is -1 if there was none.
+static int serve_receive(int connection, ServeRequest *request, int *fd) {
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { request, sizeof(ServeRequest) };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    *fd = -1;
+    ssize_t n;
+    do {
+        n = recvmsg(connection, &message, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return 0;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+
+    // a stream socket may split the header, the descriptor arrives with the
+    // first byte
+    return read_full(connection, (uint8_t *)request + n, sizeof(ServeRequest) - (size_t)n);
+}
+
+static int serve_reply(int connection, SWTData *data, int32_t status,
+                       SWTImage *image, double milliseconds, int confidenceThreshold) {
+    ServeReply reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.magic = SERVE_MAGIC;
+    reply.status = status;
+    reply.milliseconds = (float)milliseconds;
+
+    ServeBox *boxes = NULL;
+    if (status >= SERVE_OK) {
+        boxes = (ServeBox *)malloc((data->results->itemCount + 1) * sizeof(ServeBox));
+        if (boxes == NULL) reply.status = SERVE_NO_MEMORY;
+    }
+
+    if (boxes != NULL) {
+        reply.width = image->width;
+        reply.height = image->height;
+        reply.componentCount = data->components->itemCount;
+        // boxes on an image halved to fit the memory budget are scaled back
+        int scale = data->results->scale > 1 ? data->results->scale : 1;
+
+        for (int i = 0; i < data->results->itemCount; i++) {
+            if (data->results->confidences[i] > confidenceThreshold) continue;
+
+            SWTBox box = swt_get_result_box(data->results, i);
+            ServeBox *out = &boxes[reply.boxCount++];
+            out->x = box.x * scale;
+            out->y = box.y * scale;
+            out->width = box.width * scale;
+            out->height = box.height * scale;
+            out->confidence = data->results->confidences[i];
+        }
+    }
+
+    int ok = write_full(connection, &reply, sizeof(reply)) &&
+             write_full(connection, boxes, reply.boxCount * sizeof(ServeBox));
+    free(boxes);
+    return ok;
+}
+
+static void serve_connection(ServeJob *job, int connection, SWTData **data) {
+    ServeRequest request;
+    int fd;
+
+    while (serve_receive(connection, &request, &fd)) {
+        double start = now_ms();
+        double deadline = job->deadlineMs > 0 ? swt_now_ms() + job->deadlineMs : 0;
+        LoadedImage loaded;
+        memset(&loaded, 0, sizeof(loaded));
+        uint8_t *mapped = NULL;
+        size_t mappedSize = 0;
+        int32_t status = SERVE_OK;
+
+        if (request.magic != SERVE_MAGIC) {
+            status = SERVE_BAD_REQUEST;
+        } else if (request.kind == SERVE_REQUEST_PATH) {
+            char path[SERVE_MAX_PATH + 1];
+            if (request.pathLength == 0 || request.pathLength > SERVE_MAX_PATH ||
+                !read_full(connection, path, request.pathLength)) {
+                status = SERVE_BAD_REQUEST;
+            } else {
+                path[request.pathLength] = '\0';
+                if (!load_image(path, 1, &loaded)) status = SERVE_LOAD_FAILED;
+            }
+        } else if (request.kind == SERVE_REQUEST_PIXELS && fd >= 0) {
+            struct stat info;
+            mappedSize = (size_t)request.width * request.height * request.channels;
+            if ((request.channels != 1 && request.channels != 3) || request.width == 0 || request.height == 0 ||
+                request.width > 65535 || request.height > 65535 ||
+                (fcntl(fd, F_GET_SEALS) & SERVE_SEALS) != SERVE_SEALS ||
+                fstat(fd, &info) != 0 || (size_t)info.st_size < mappedSize) {
+                status = SERVE_BAD_REQUEST;
+            } else {
+                mapped = (uint8_t *)mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+                if (mapped == MAP_FAILED) {
+                    mapped = NULL;
+                    status = SERVE_LOAD_FAILED;
+                } else {
+                    loaded.image = (SWTImage){ mapped, (int)request.width, (int)request.height,
+                                               (int)request.channels };
+                }
+            }
+        } else {
+            status = SERVE_BAD_REQUEST;
+        }
+
+        if (fd >= 0) close(fd);
+
+        SWTImage original = loaded.image;
+        if (status == SERVE_OK) {
+            *data = reuse_data(*data, (size_t)loaded.image.width * loaded.image.height);
+            if (*data == NULL) status = SERVE_NO_MEMORY;
+        }
+        if (status == SERVE_OK) {
+            (*data)->results->deadlineMs = deadline;
+            (*data)->results->memoryBudget = job->memoryBudget;
+            apply_transform(&loaded, *data, 0, job->confidenceThreshold);
+            if ((*data)->results->status != SWT_STATUS_OK) status = SERVE_PARTIAL;
+        }
+
+        int ok = serve_reply(connection, *data, status, &original, now_ms() - start,
+                             job->confidenceThreshold);
+
+        release_image(&loaded);
+        if (mapped) munmap(mapped, mappedSize);
+        // a malformed request leaves the stream in an unknown state
+        if (!ok || status == SERVE_BAD_REQUEST) break;
+    }
+
+    close(connection);
+}
+
+static void *serve_worker(void *arg) {
+    ServeJob *job = (ServeJob *)arg;
+    SWTData *data = NULL;
+
+    for (;;) {
+        int connection = accept(job->listener, NULL, NULL);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept");
+            break;
+        }
+        serve_connection(job, connection, &data);
+    }
+
+    if (data) swt_free(data);
+    return NULL;
+}
+
+static int serve_address(const char *path, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "ERROR: socket path too long: %s\n", path);
+        return 0;
+    }
+    strcpy(address->sun_path, path);
+    return 1;
+}
+
+static int run_serve(int argc, char **argv) {
+    const char *socketPath = NULL;
+    ServeJob job = { -1, CONFIDENCE_THRESHOLD, 0, 0 };
+    int threadCount = 4;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--serve") == 0) {
+            socketPath = argv[i + 1];
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            threadCount = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--confidence") == 0) {
+            job.confidenceThreshold = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--deadline") == 0) {
+            job.deadlineMs = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "--memory") == 0) {
+            job.memoryBudget = (size_t)(atof(argv[i + 1]) * 1024 * 1024);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    struct sockaddr_un address;
+    if (socketPath == NULL || argc % 2 == 0 || threadCount < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!serve_address(socketPath, &address)) return 1;
+
+    job.listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(socketPath);
+    if (job.listener < 0 ||
+        bind(job.listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(job.listener, 64) != 0) {
+        perror("ERROR: unable to listen");
         return 1;
     }
 
-    const char* input_filename = argv[1];
-    const char* output_filename = argv[2];
+    signal(SIGPIPE, SIG_IGN);
+    swt_init_tables();
 
+    pthread_t *threads = (pthread_t *)malloc(threadCount * sizeof(pthread_t));
+    SWT_IF_NO_MEMORY_EXIT(threads);
+    for (int i = 0; i < threadCount; i++) {
+        pthread_create(&threads[i], NULL, serve_worker, &job);
+    }
+    fprintf(stderr, "listening on %s with %d threads\n", socketPath, threadCount);
+
+    for (int i = 0; i < threadCount; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    close(job.listener);
+    unlink(socketPath);
+    return 0;
+}
+
+static int client_send_pixels(int connection, const char *path) {
     int width, height, channels;
-    uint8_t* image_data = stbi_load(input_filename, &width, &height, &channels, 0);
-    if (!image_data) {
+    uint8_t *pixels = stbi_load(path, &width, &height, &channels, 1);
+    if (!pixels) {
+        fprintf(stderr, "ERROR: unable to load %s\n", path);
+        return 0;
+    }
+
+    size_t size = (size_t)width * height;
+    int fd = memfd_create("swt-pixels", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    int ok = fd >= 0 && write_full(fd, pixels, size) && fcntl(fd, F_ADD_SEALS, SERVE_SEALS) == 0;
+    stbi_image_free(pixels);
+    if (!ok) {
+        perror("ERROR: unable to fill memfd");
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+
+    ServeRequest request = { SERVE_MAGIC, SERVE_REQUEST_PIXELS, (uint32_t)width, (uint32_t)height, 1, 0 };
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = { &request, sizeof(request) };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    ok = sendmsg(connection, &message, 0) == (ssize_t)sizeof(request);
+    close(fd);
+    return ok;
+}
+
+static int client_send_path(int connection, const char *path) {
+    char absolute[PATH_MAX];
+    if (realpath(path, absolute) == NULL) {
+        fprintf(stderr, "ERROR: unable to resolve %s\n", path);
+        return 0;
+    }
+
+    ServeRequest request = { SERVE_MAGIC, SERVE_REQUEST_PATH, 0, 0, 0, (uint32_t)strlen(absolute) };
+    return write_full(connection, &request, sizeof(request)) &&
+           write_full(connection, absolute, request.pathLength);
+}
+
+static int run_client(int argc, char **argv) {
+    struct sockaddr_un address;
+    int raw = 0, first = 3;
+
+    if (argc < 4) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (strcmp(argv[3], "--raw") == 0) {
+        raw = 1;
+        first = 4;
+    }
+    if (!serve_address(argv[2], &address)) return 1;
+
+    int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connection < 0 || connect(connection, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        perror("ERROR: unable to connect");
+        return 1;
+    }
+
+    int failures = 0;
+    for (int i = first; i < argc; i++) {
+        int sent = raw ? client_send_pixels(connection, argv[i]) : client_send_path(connection, argv[i]);
+        if (!sent) {
+            failures++;
+            continue;
+        }
+
+        ServeReply reply;
+        if (!read_full(connection, &reply, sizeof(reply)) || reply.magic != SERVE_MAGIC) {
+            fprintf(stderr, "ERROR: bad reply from server\n");
+            close(connection);
+            return 1;
+        }
+
+        printf("%s: status %d, %ux%u, %u components, %u text boxes, %.3f ms\n", argv[i],
+               reply.status, reply.width, reply.height, reply.componentCount, reply.boxCount,
+               reply.milliseconds);
+
+        for (uint32_t b = 0; b < reply.boxCount; b++) {
+            ServeBox box;
+            if (!read_full(connection, &box, sizeof(box))) {
+                close(connection);
+                return 1;
+            }
+            printf("  %d %d %d %d %.1f\n", box.x, box.y, box.width, box.height, box.confidence);
+        }
+
+        if (reply.status < SERVE_OK) failures++;
+    }
+
+    close(connection);
+    return failures ? 1 : 0;
+}
+
+#endif // __linux__
+
+/*
+   Stream mode
+
+   Frames are read from stdin, run through SWT and their results written to
+   stdout by three threads, so reading the next frame and writing the previous
+   one's results overlap with the detection itself. They hand frames over
+   through a fixed ring of preallocated slots: the reader blocks when every
+   slot is in flight, so memory stays flat no matter how long the stream is.
+*/
+
+typedef struct {
+    uint8_t *pixels;
+    long long frame;
+    int componentCount;
+    double milliseconds;
+
+    // text boxes of the frame, grown on demand and then reused
+    SWTBox *boxes;
+    float *confidences;
+    int boxCount;
+    int boxCapacity;
+} StreamSlot;
+
+typedef struct {
+    StreamSlot *slots;
+    int slotCount;
+    int width;
+    int height;
+    int confidenceThreshold;
+    int incremental;
+    int keyframeInterval;
+
+    // frames read, processed and written so far, slot i holds frame
+    // i % slotCount
+    long long readCount;
+    long long processedCount;
+    long long writtenCount;
+    int readerDone;
+    int workerDone;
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} Stream;
+
+static void *stream_reader(void *arg) {
+    Stream *stream = (Stream *)arg;
+    size_t frameSize = (size_t)stream->width * stream->height;
+
+    for (;;) {
+        pthread_mutex_lock(&stream->lock);
+        while (stream->readCount - stream->writtenCount == stream->slotCount) {
+            pthread_cond_wait(&stream->changed, &stream->lock);
+        }
+        StreamSlot *slot = &stream->slots[stream->readCount % stream->slotCount];
+        pthread_mutex_unlock(&stream->lock);
+
+        // a trailing partial frame is dropped
+        int complete = fread(slot->pixels, 1, frameSize, stdin) == frameSize;
+
+        pthread_mutex_lock(&stream->lock);
+        if (complete) {
+            slot->frame = stream->readCount++;
+        } else {
+            stream->readerDone = 1;
+        }
+        pthread_cond_broadcast(&stream->changed);
+        pthread_mutex_unlock(&stream->lock);
+
+        if (!complete) break;
+    }
+
+    return NULL;
+}
+
+static void stream_collect_boxes(Stream *stream, StreamSlot *slot, SWTData *data) {
+    slot->boxCount = 0;
+    slot->componentCount = data->components->itemCount;
+
+    for (int i = 0; i < data->results->itemCount; i++) {
+        if (data->results->confidences[i] > stream->confidenceThreshold) continue;
+
+        if (slot->boxCount == slot->boxCapacity) {
+            slot->boxCapacity = slot->boxCapacity ? slot->boxCapacity * 2 : 256;
+            slot->boxes = (SWTBox *)realloc(slot->boxes, slot->boxCapacity * sizeof(SWTBox));
+            slot->confidences = (float *)realloc(slot->confidences, slot->boxCapacity * sizeof(float));
+            SWT_IF_NO_MEMORY_EXIT(slot->boxes);
+            SWT_IF_NO_MEMORY_EXIT(slot->confidences);
+        }
+
+        slot->boxes[slot->boxCount] = swt_get_result_box(data->results, i);
+        slot->confidences[slot->boxCount] = data->results->confidences[i];
+        slot->boxCount++;
+    }
+}
+
+static void *stream_worker(void *arg) {
+    Stream *stream = (Stream *)arg;
+    SWTData *data = NULL;
+    SWTVideo *video = NULL;
+    if (stream->incremental) {
+        video = swt_video_create(stream->width, stream->height);
+        SWT_IF_NO_MEMORY_EXIT(video);
+    } else {
+        data = swt_allocate((size_t)stream->width * stream->height);
+        SWT_IF_NO_MEMORY_EXIT(data);
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&stream->lock);
+        while (stream->processedCount == stream->readCount && !stream->readerDone) {
+            pthread_cond_wait(&stream->changed, &stream->lock);
+        }
+        if (stream->processedCount == stream->readCount) {
+            stream->workerDone = 1;
+            pthread_cond_broadcast(&stream->changed);
+            pthread_mutex_unlock(&stream->lock);
+            break;
+        }
+        StreamSlot *slot = &stream->slots[stream->processedCount % stream->slotCount];
+        pthread_mutex_unlock(&stream->lock);
+
+        double start = now_ms();
+        SWTImage image = { slot->pixels, stream->width, stream->height, 1 };
+        if (video) {
+            // start over now and then so nothing carried forward goes stale
+            if (stream->keyframeInterval > 0 && slot->frame > 0 &&
+                slot->frame % stream->keyframeInterval == 0) {
+                swt_video_free(video);
+                video = swt_video_create(stream->width, stream->height);
+                SWT_IF_NO_MEMORY_EXIT(video);
+            }
+            swt_video_apply(video, &image);
+            stream_collect_boxes(stream, slot, video->data);
+        } else {
+            swt_reset(data);
+            swt_apply_stroke_width_transform(&image, data->components, data->results);
+            stream_collect_boxes(stream, slot, data);
+        }
+        slot->milliseconds = now_ms() - start;
+
+        pthread_mutex_lock(&stream->lock);
+        stream->processedCount++;
+        pthread_cond_broadcast(&stream->changed);
+        pthread_mutex_unlock(&stream->lock);
+    }
+
+    if (video) swt_video_free(video);
+    if (data) swt_free(data);
+    return NULL;
+}
+
+static void *stream_writer(void *arg) {
+    Stream *stream = (Stream *)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&stream->lock);
+        while (stream->writtenCount == stream->processedCount && !stream->workerDone) {
+            pthread_cond_wait(&stream->changed, &stream->lock);
+        }
+        if (stream->writtenCount == stream->processedCount) {
+            pthread_mutex_unlock(&stream->lock);
+            break;
+        }
+        StreamSlot *slot = &stream->slots[stream->writtenCount % stream->slotCount];
+        pthread_mutex_unlock(&stream->lock);
+
+        printf("{\"frame\": %lld, \"components\": %d, \"ms\": %.3f, \"text\": [",
+               slot->frame, slot->componentCount, slot->milliseconds);
+        for (int i = 0; i < slot->boxCount; i++) {
+            SWTBox box = slot->boxes[i];
+            printf("%s{\"x\": %d, \"y\": %d, \"width\": %d, \"height\": %d, \"confidence\": %.1f}",
+                   i ? ", " : "", box.x, box.y, box.width, box.height, slot->confidences[i]);
+        }
+        printf("]}\n");
+        fflush(stdout);
+
+        pthread_mutex_lock(&stream->lock);
+        stream->writtenCount++;
+        pthread_cond_broadcast(&stream->changed);
+        pthread_mutex_unlock(&stream->lock);
+    }
+
+    return NULL;
+}
+
+static int run_stream(int argc, char **argv) {
+    Stream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.slotCount = 4;
+    stream.confidenceThreshold = CONFIDENCE_THRESHOLD;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--stream") == 0) {
+            if (sscanf(argv[i + 1], "%dx%d", &stream.width, &stream.height) != 2) {
+                stream.width = 0;
+            }
+        } else if (strcmp(argv[i], "--ring") == 0) {
+            stream.slotCount = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--confidence") == 0) {
+            stream.confidenceThreshold = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--incremental") == 0) {
+            stream.incremental = 1;
+            stream.keyframeInterval = atoi(argv[i + 1]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc % 2 == 0 || stream.width <= 0 || stream.height <= 0 || stream.slotCount < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    stream.slots = (StreamSlot *)calloc(stream.slotCount, sizeof(StreamSlot));
+    SWT_IF_NO_MEMORY_EXIT(stream.slots);
+    for (int i = 0; i < stream.slotCount; i++) {
+        stream.slots[i].pixels = (uint8_t *)malloc((size_t)stream.width * stream.height);
+        SWT_IF_NO_MEMORY_EXIT(stream.slots[i].pixels);
+    }
+
+    pthread_mutex_init(&stream.lock, NULL);
+    pthread_cond_init(&stream.changed, NULL);
+    swt_init_tables();
+
+    pthread_t reader, worker, writer;
+    pthread_create(&reader, NULL, stream_reader, &stream);
+    pthread_create(&worker, NULL, stream_worker, &stream);
+    pthread_create(&writer, NULL, stream_writer, &stream);
+    pthread_join(reader, NULL);
+    pthread_join(worker, NULL);
+    pthread_join(writer, NULL);
+
+    for (int i = 0; i < stream.slotCount; i++) {
+        free(stream.slots[i].pixels);
+        free(stream.slots[i].boxes);
+        free(stream.slots[i].confidences);
+    }
+    free(stream.slots);
+    pthread_cond_destroy(&stream.changed);
+    pthread_mutex_destroy(&stream.lock);
+
+    return 0;
+}
+
+static int run_single(const char *input_filename, const char *output_filename, OutputFormat format,
+                      int pyramidLevels, int tileSize, int threadCount) {
+    LoadedImage loaded;
+    if (!load_image(input_filename, 0, &loaded)) {
         fprintf(stderr, "ERROR: unable to load image\n");
         return 1;
     }
 
-    SWTImage image = { image_data, width, height, channels };
-    SWTData *data = swt_allocate(width * height);
+    SWTImage *image = &loaded.image;
+    SWTData *data = swt_allocate((size_t)image->width * image->height);
+    SWT_IF_NO_MEMORY_EXIT(data);
 
-    swt_apply_stroke_width_transform(&image, data->components, data->results);
+    if (tileSize > 0 && !loaded.isMask) {
+        // the halo fits text a few times taller than the thickest stroke
+        // that still counts as text, bigger components get stitched
+        swt_apply_stroke_width_transform_tiled(image, data->components, data->results, tileSize,
+                                               4 * CONFIDENCE_THRESHOLD, threadCount);
+    } else {
+        apply_transform(&loaded, data, pyramidLevels, CONFIDENCE_THRESHOLD);
+    }
 
-    swt_visualize_text_on_image(&image, data->results, /*confidenceThreshold*/ 20);
+    int failed = 0;
+    if (format != OUTPUT_NONE) {
+        crc_init_table();
+        OutputTask *task = output_task_create(output_filename, format, &loaded, data,
+                                              /*confidenceThreshold*/ CONFIDENCE_THRESHOLD);
+        if (!output_task_write(task)) {
+            fprintf(stderr, "ERROR: unable to write image\n");
+            failed = 1;
+        }
+        output_task_free(task);
+    }
 
     swt_free(data);
+    release_image(&loaded);
+    return failed;
+}
 
-    if (!stbi_write_jpg(output_filename, image.width, image.height, image.channels, image.bytes, 100)) {
-        fprintf(stderr, "ERROR: unable to write image\n");
-        stbi_image_free(image.bytes);
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0) {
+        return run_batch(argc, argv);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--stream") == 0) {
+        return run_stream(argc, argv);
+    }
+
+    if (argc > 1 && (strcmp(argv[1], "--serve") == 0 || strcmp(argv[1], "--client") == 0)) {
+#ifdef __linux__
+        return strcmp(argv[1], "--serve") == 0 ? run_serve(argc, argv) : run_client(argc, argv);
+#else
+        fprintf(stderr, "ERROR: %s is only supported on linux\n", argv[1]);
         return 1;
+#endif
     }
-    stbi_image_free(image.bytes);
-    return 0;
+
+    if (argc < 3 || argc % 2 == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    OutputFormat format = output_format_from_path(argv[2]);
+    int pyramidLevels = 0, tileSize = 0, threadCount = 4;
+    for (int i = 3; i < argc; i += 2) {
+        if (strcmp(argv[i], "--format") == 0 && output_format_parse(argv[i + 1], &format)) continue;
+        if (strcmp(argv[i], "--pyramid") == 0) {
+            pyramidLevels = atoi(argv[i + 1]);
+            continue;
+        }
+        if (strcmp(argv[i], "--tiles") == 0) {
+            tileSize = atoi(argv[i + 1]);
+            continue;
+        }
+        if (strcmp(argv[i], "--threads") == 0) {
+            threadCount = atoi(argv[i + 1]);
+            continue;
+        }
+        usage(argv[0]);
+        return 1;
+    }
+
+    return run_single(argv[1], argv[2], format, pyramidLevels, tileSize, threadCount);
 }
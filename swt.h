@@ -18,6 +18,25 @@ Usage:
 
    Define SWT_ASSERT to avoid using <assert.h>
 
+   Every byte the library allocates goes through SWT_MALLOC, SWT_REALLOC and
+   SWT_FREE (define all three to swap out the C allocator), or through an
+   SWTAllocator passed to the _with functions at runtime.
+
+   The pixel kernels have SSE2, AVX2 and AVX-512 variants that are picked at
+   runtime. Define SWT_NO_SIMD to only build the plain C ones, or set the
+   SWT_FORCE_ISA environment variable ("scalar", "sse2", "avx2", "avx512") to
+   pin one, eg. for testing.
+
+   The tiled transform runs on several threads through pthreads, define
+   SWT_NO_THREADS to build without them.
+
+   Components are 8-connected unless SWTComponents.connectivity says 4.
+   Define SWT_CONNECTIVITY to 4 or 8 to build only that flood fill.
+
+   Define SWT_COMPACT_POINTS to store points as two 16 bit coordinates, half
+   the memory for images up to 65535 pixels a side. swt_pack_component packs
+   a component further into a delta encoded byte stream.
+
    SWTImage image = {
        .bytes = image_data,
        .width = width,
@@ -28,41 +47,100 @@ Usage:
    For most cases, you can just call the primary function. For that, you first need to allocate the necessary space:
 
     SWTData *data = swt_allocate(width * height);
+    // or swt_allocate_with(width * height, &allocator)
 
     swt_apply_stroke_width_transform(&image, data->components, data->results);
     swt_visualize_text_on_image(&image, data->results, 4); // 4 is the confidence threshold
 
+   To get per-stage timings and counters for a run, point the results at an
+   SWTStats before calling it (define SWT_NO_STATS to compile this out):
+
+    SWTStats stats;
+    data->results->stats = &stats;
+
    You must then also free the allocated memory.
 
     swt_free(data);
 
+   Or, to process another image of at most the same size with it, reset it.
+
+    swt_reset(data);
+
    Additionally, SWT exposes all the functions used for pre-processing and allocation publicly. Extensive documentation is provided further down.
 
 Functions for primary transformation:
 
+    SWTData *swt_allocate(size_t size);
+    SWTData *swt_allocate_with(size_t size, const SWTAllocator *allocator);
+    void swt_reset(SWTData *data);
+    void swt_free(SWTData *data);
     void swt_apply_stroke_width_transform(SWTImage *image, SWTComponents *components, SWTResults *results);
-    SWTResults *swt_allocate_results(int count);
-    void swt_free_results(SWTResults *results);
-    float swt_compute_stroke_width_for_component(SWTImage *image, SWTComponent *currentComponent);
+    void swt_apply_stroke_width_transform_to_mask(SWTImage *mask, SWTComponents *components, SWTResults *results);
+    void swt_apply_stroke_width_transform_pyramid(SWTImage *image, SWTComponents *components, SWTResults *results, int levels, int confidenceThreshold);
+    void swt_apply_stroke_width_transform_tiled(SWTImage *image, SWTComponents *components, SWTResults *results, int tileSize, int halo, int threads);
+    SWTTriage swt_triage_text(const SWTImage *image, int confidenceThreshold, double budgetMs);
+    SWTTriage swt_triage_text_with(const SWTImage *image, int confidenceThreshold, double budgetMs, const SWTAllocator *allocator);
+    int swt_compute_stroke_width_for_component(SWTImage *image, SWTComponent *currentComponent);
+    int swt_pack_component(const SWTComponent *component, SWTPackedComponent *packed, const SWTAllocator *allocator);
+    int swt_unpack_component(const SWTPackedComponent *packed, SWTPoint *points);
+    void swt_free_packed_component(SWTPackedComponent *packed, const SWTAllocator *allocator);
+    int swt_compute_stroke_width_for_packed(SWTImage *image, const SWTPackedComponent *packed);
+
+Functions for video:
+
+    SWTVideo *swt_video_create(int width, int height);
+    SWTVideo *swt_video_create_with(int width, int height, const SWTAllocator *allocator);
+    void swt_video_apply(SWTVideo *video, SWTImage *frame);
+    void swt_video_free(SWTVideo *video);
 
 Functions for CCA:
 
-    SWTComponents *swt_allocate_components(int size);
+    SWTComponents *swt__allocate_components(size_t size);
     void swt_connected_component_analysis(SWTImage *image, SWTComponents *components);
-    void swt_free_components(SWTComponents *components);
+    void swt_connected_component_analysis_blocks(SWTImage *image, SWTComponents *components);
+    void swt__free_components(SWTComponents *components);
+    SWTBox swt_compute_component_box(SWTComponent *component);
+    SWTLabels *swt_label_components(const SWTImage *image, int connectivity, const SWTAllocator *allocator);
+    void swt_free_labels(SWTLabels *labels);
+    uint32_t swt_get_label(const SWTLabels *labels, int x, int y);
+    SWTLabelIterator swt_iterate_label(const SWTLabels *labels, uint32_t label);
+    int swt_next_label_point(SWTLabelIterator *iterator, SWTPoint *point);
+    int swt_get_label_points(const SWTLabels *labels, uint32_t label, SWTPoint *points);
+    SWTLabels *swt_label_components_blocks(const SWTImage *image, const SWTAllocator *allocator);
+    int swt_compute_stroke_width_for_label(SWTImage *image, const SWTLabels *labels, uint32_t label);
+
+Functions for results:
+
+    SWTResult swt_get_result(const SWTResults *results, int i);
+    int swt_add_result(SWTResults *results, SWTComponent *component, float confidence, float variation);
+    int swt_filter_results(const SWTResults *results, const SWTFilter *filter, int *indices);
+    int swt_select_top_results(const SWTResults *results, int *indices, int count, int k);
+    SWTBox swt_get_result_box(const SWTResults *results, int i);
+    void swt_visualize_text_on_image(SWTImage *image, SWTResults *results, const int confidenceThreshold);
 
 Processing and filter functions:
 
+    void swt_init_tables(void);
+    const char *swt_get_isa(void);
+    double swt_now_ms(void);
     SWTSobelNode swt_compute_sobel_for_point(SWTImage *image, SWTPoint point);
     void swt_apply_grayscale(SWTImage *image);
     void swt_apply_threshold(SWTImage *image, const int threshold);
+    uint8_t swt_compute_otsu_threshold(SWTImage *image);
+    void swt_unpack_mask(const uint8_t *bits, int stride, SWTImage *image);
+    void swt_downsample_2x(const SWTImage *src, SWTImage *dst);
 */
 
 #ifndef SWT_H_
 #define SWT_H_
 
-#include <math.h> // pow, atan2, sqrt, floor, ceil
+#include <math.h> // atan, cos, sin, sqrt, floor (tables are built once)
+#include <stddef.h> // size_t
+#include <stdint.h> // uint8_t, uint64_t, SIZE_MAX
+#include <stdio.h> // perror
 #include <stdlib.h> // qsort, malloc, calloc, free
+#include <limits.h> // INT_MAX
+#include <float.h> // FLT_MAX
 #include <string.h> // memcpy
 
 #ifndef SWT_ASSERT
@@ -79,36 +157,216 @@ Processing and filter functions:
 #endif
 #endif 
 
-typedef unsigned char uint8_t;
-
+#ifdef SWT_COMPACT_POINTS
+// Half the memory and bandwidth of the default points, for images up to
+// SWT_MAX_DIMENSION pixels a side. Larger ones are halved to fit the same way
+// as for SWTResults.memoryBudget, flagged SWT_DEGRADED_TOO_LARGE (the pyramid
+// and tiled variants fall back to the plain transform for them), video
+// contexts can't be created for them.
+typedef struct {
+  uint16_t x;
+  uint16_t y;
+} SWTPoint;
+#define SWT_MAX_DIMENSION 65535
+#else
 typedef struct {
   int x;
   int y;
 } SWTPoint;
+#define SWT_MAX_DIMENSION INT_MAX
+#endif // SWT_COMPACT_POINTS
 
 typedef struct {
   SWTPoint *points;
   int pointCount;
 } SWTComponent;
 
+// Axis aligned bounding box, x/y is the top left corner
+typedef struct {
+  int x;
+  int y;
+  int width;
+  int height;
+} SWTBox;
+
+// A component's points as a byte stream, see swt_pack_component. Each point
+// is the difference to the one before it (the first to 0, 0), x then y, as
+// zigzag varints, so neighbouring pixels take 2 bytes.
+typedef struct {
+  uint8_t *bytes;
+  size_t size;
+  int pointCount;
+  SWTBox box;
+} SWTPackedComponent;
+
+// Runtime allocator, eg. a per tenant arena. `user` is handed back on every
+// call. realloc and free are only ever called on memory from the same
+// allocator, which has to outlive everything allocated from it. The tiled
+// transform calls it from all of its threads at once, so with threads > 1
+// the callbacks have to be thread safe.
+typedef struct {
+  void *(*malloc)(size_t size, void *user);
+  void *(*realloc)(void *ptr, size_t size, void *user);
+  void (*free)(void *ptr, void *user);
+  void *user;
+} SWTAllocator;
+
 typedef struct {
   SWTComponent *items;
   int itemCount;
+  int capacity; // grows as needed, pointers into items don't survive that
+  // 4 or 8, how the CCA joins pixels into components. 0 is 8, which keeps
+  // thin and anti-aliased glyphs in one piece. Ignored when SWT_CONNECTIVITY
+  // is defined.
+  int connectivity;
+  // where the items and points come from, NULL for SWT_MALLOC and co. A run
+  // takes its scratch from the allocator of the components it fills.
+  const SWTAllocator *allocator;
 } SWTComponents;
 
+// Area and bounding box of one label, see SWTLabels
 typedef struct {
-  SWTComponent *component; // holds a reference to a component elsewhere
-  float confidence;
-} SWTResult;
+  int area;
+  SWTBox box;
+} SWTLabelStats;
+
+// A label per pixel instead of point lists, from swt_label_components. The
+// components are numbered from 1 in the order swt_connected_component_analysis
+// finds them, 0 is background and lone pixels. Labels are 16 bit while they
+// fit and move to labels32 past 65535, swt_get_label reads either.
+typedef struct {
+  uint16_t *labels16;
+  uint32_t *labels32; // NULL while the labels fit 16 bits
+  int width;
+  int height;
+  SWTLabelStats *stats; // stats[label - 1]
+  int labelCount;
+  int status;   // SWT_STATUS_NO_MEMORY when labeling stopped short
+  int degraded; // SWT_DEGRADED_SKIPPED when components too large were left out
+
+  // private
+  int capacity;
+  const SWTAllocator *allocator;
+} SWTLabels;
+
+// Walks the pixels of one label inside its bounding box, in scan order
+typedef struct {
+  const SWTLabels *labels;
+  uint32_t label;
+  int x;
+  int y;
+  int remaining; // pixels left to find
+} SWTLabelIterator;
+
+// Counters filled by swt_apply_stroke_width_transform when
+// SWTResults.stats is set. Defining SWT_NO_STATS compiles the bookkeeping out
+// entirely, the struct is then left zeroed.
+typedef struct {
+  // stage timings in milliseconds, from a monotonic clock
+  double grayscaleMs;
+  double thresholdMs;
+  double ccaMs;
+  double strokeWidthMs;
+  double totalMs;
+
+  long long pixels;
+  long long foregroundPixels; // pixels that ended up in a component
+  int components;
+
+  long long raysCast;
+  long long raySteps;
+
+  long long allocations;
+  long long allocatedBytes;
+  long long scratchBytes; // temporary buffers currently alive
+  long long peakScratchBytes;
+} SWTStats;
+
+// Why a transform stopped, see SWTResults.status
+#define SWT_STATUS_OK 0
+#define SWT_STATUS_DEADLINE 1  // deadlineMs passed, the results are partial
+#define SWT_STATUS_CANCELLED 2 // *cancel was set, the results are partial
+#define SWT_STATUS_NO_MEMORY 3 // an allocation failed, the results are partial
+
+// What a run gave up to stay within SWTResults.memoryBudget
+#define SWT_DEGRADED_DOWNSCALED 1 // the image was halved to fit, see SWTResults.scale
+#define SWT_DEGRADED_SKIPPED 2    // components too large to afford were left out
+// the image was over SWT_MAX_DIMENSION a side (only with SWT_COMPACT_POINTS)
+// and halved even without a budget, see SWTResults.scale
+#define SWT_DEGRADED_TOO_LARGE 4
 
 typedef struct {
-  SWTResult *items;
+  // One row per measured component, kept as parallel arrays so filtering
+  // only reads the columns it tests, see swt_filter_results
+  SWTComponent **components; // references into an SWTComponents
+  float *confidences;        // median stroke width, smaller is more text like
+  float *variations;         // standard deviation of the widths over their mean
+  int *areas;                // pixels in the component
+  int *lefts;                // bounding box, see swt_compute_component_box
+  int *tops;
+  int *widths;
+  int *heights;
   int itemCount;
+  int capacity;
+  SWTStats *stats; // optional, NULL unless the caller wants statistics
+
+  // Optional bounds on a run, checked between stages and every few
+  // components. deadlineMs is on the swt_now_ms() clock (0 for none), cancel
+  // may be set from another thread. When either trips the transform returns
+  // early with the components it got to, and status says why.
+  double deadlineMs;
+  const volatile int *cancel;
+  int status;
+
+  // Optional cap in bytes on what a run allocates on top of the image and
+  // swt_allocate (0 for none), honoured by swt_apply_stroke_width_transform
+  // and _to_mask. Rather than fail, a run that would go over halves the image
+  // until it fits (scale is the factor) and leaves out components it can't
+  // afford, `degraded` says which. With scale > 1 the mask is left at the
+  // smaller size, the points are in its coordinates and the widths are
+  // scaled back up.
+  size_t memoryBudget;
+  int degraded;
+  int scale;
+
+  // private
+  size_t memoryUsed;
+  const SWTAllocator *allocator;
 } SWTResults;
 
+// Which bounds of an SWTFilter apply
+#define SWT_FILTER_MAX_CONFIDENCE 0x01
+#define SWT_FILTER_MAX_VARIATION 0x02
+#define SWT_FILTER_MIN_AREA 0x04
+#define SWT_FILTER_MAX_AREA 0x08
+#define SWT_FILTER_MIN_HEIGHT 0x10
+#define SWT_FILTER_MAX_HEIGHT 0x20
+#define SWT_FILTER_MAX_ASPECT 0x40
+
+// A row of SWTResults, as returned by swt_get_result. Results used to be
+// stored as an array of these.
+typedef struct {
+  SWTComponent *component;
+  float confidence;
+} SWTResult;
+
+// Bounds for swt_filter_results, all inclusive. Only the ones whose bit is in
+// `set` apply, so a zeroed filter lets everything through.
+typedef struct {
+  int set; // SWT_FILTER_* bits
+  float maxConfidence;
+  float maxVariation;
+  int minArea;
+  int maxArea;
+  int minHeight;
+  int maxHeight;
+  float maxAspect; // box width over height
+} SWTFilter;
+
 typedef struct {
   SWTComponents *components;
   SWTResults *results;
+  size_t size; // number of pixels this was allocated for
 } SWTData;
 
 typedef struct {
@@ -120,11 +378,60 @@ typedef struct {
 
 typedef struct {
   int magnitude;
-  int direction;
+  int direction; // quantized angle, 0..SWT_DIRECTIONS-1 counter-clockwise from +x
   int gradientX;
   int gradientY;
 } SWTSobelNode;
 
+// State kept between the frames of a video, see swt_video_apply
+typedef struct {
+  int width;
+  int height;
+  SWTData *data; // components and results of the last frame
+  int *ids;      // stable id of each component in data, kept while it's unchanged
+  int reused;    // components carried over unchanged from the previous frame
+  int dirtyTiles; // tiles whose mask changed since the previous frame
+  int tileCount;
+
+  // private
+  int frames;
+  int nextId;
+  int tilesX;
+  int tilesY;
+  uint8_t *previous; // binary mask of the previous frame
+  uint8_t *dirty;    // per tile, 1 if it changed, 2 if a neighbour did
+  int *labels;       // component id per pixel, 0 for none, -1 for lone pixels
+                     // (and ones that ran out of memory)
+  SWTPoint *queue;
+  int queueCapacity;
+  const SWTAllocator *allocator;
+} SWTVideo;
+
+// Outcome of swt_triage_text
+typedef struct {
+  int containsText; // a tile held enough glyph like components
+  int timedOut;     // the budget ran out first, containsText is then 0
+  int tilesChecked; // tiles the pipeline actually ran on
+  int tileCount;    // tiles the image was split into
+  SWTBox tile;      // where the text was found
+  int outOfMemory;  // an allocation failed and the search stopped there
+} SWTTriage;
+
+// Gradient directions are quantized to this many angles (a power of two from 8
+// to 2048) so the stroke width pass can look rays up instead of calling
+// atan2/cos/sin
+#ifndef SWT_DIRECTIONS
+#define SWT_DIRECTIONS 256
+#endif // SWT_DIRECTIONS
+
+#if SWT_DIRECTIONS < 8 || SWT_DIRECTIONS > 2048 || (SWT_DIRECTIONS & (SWT_DIRECTIONS - 1))
+#error "SWT_DIRECTIONS must be a power of two from 8 to 2048"
+#endif
+
+#if defined(SWT_CONNECTIVITY) && SWT_CONNECTIVITY != 4 && SWT_CONNECTIVITY != 8
+#error "SWT_CONNECTIVITY must be 4 or 8"
+#endif
+
 #ifndef SWT_CLR_BLACK
 #define SWT_CLR_BLACK 0
 #endif // SWT_CLR_BLACK
@@ -146,6 +453,8 @@ typedef struct {
 #define SWT_THRESHOLD 128
 #endif // SWT_THRESHOLD
 
+// The library itself reports failed allocations through SWTResults.status
+// and NULL returns, this is left for programs built on it
 #ifndef SWT_IF_NO_MEMORY_EXIT
 #define SWT_IF_NO_MEMORY_EXIT(ptr)                                             \
   do {                                                                         \
@@ -156,10 +465,19 @@ typedef struct {
   } while (0)
 #endif // SWT_IF_NO_MEMORY_EXIT
 
-// These functions manage the memory for the stroke width component 
-SWTDEF SWTData* swt_allocate(int size);
+// These functions manage the memory for the stroke width component. `size` is
+// the number of pixels, offsets into images are size_t throughout so images
+// past 2^31 pixels work, the component and result arrays grow as needed.
+// swt_allocate returns NULL when out of memory. swt_allocate_with takes
+// everything, the SWTData included, from `allocator` (NULL for SWT_MALLOC).
+SWTDEF SWTData* swt_allocate(size_t size);
+SWTDEF SWTData *swt_allocate_with(size_t size, const SWTAllocator *allocator);
 SWTDEF void swt_free(SWTData *data);
 
+// Drops the components and results of a previous run so the same SWTData can
+// be used for another image of at most data->size pixels
+SWTDEF void swt_reset(SWTData *data);
+
 // The below is the primary function, it encapsulates the logic for calling CCA,
 // looping through the results and computing the stroke width likelihood for
 // them. Instructs on how to use this are given at the top
@@ -167,14 +485,93 @@ SWTDEF void swt_apply_stroke_width_transform(SWTImage *image,
                                              SWTComponents *components,
                                              SWTResults *results);
 
+// Same as above for an image that is already a binary mask (single channel,
+// SWT_CLR_WHITE foreground on SWT_CLR_BLACK), grayscale and threshold are
+// skipped. See swt_unpack_mask for bilevel inputs like PBM files.
+SWTDEF void swt_apply_stroke_width_transform_to_mask(SWTImage *mask,
+                                                     SWTComponents *components,
+                                                     SWTResults *results);
+
+// Coarse to fine variant for large images. The image is halved up to `levels`
+// times, text is looked for at the smallest level and the full resolution
+// transform only runs inside the (padded, merged) regions found there.
+// `confidenceThreshold` is the same as for swt_visualize_text_on_image and
+// decides which coarse components count as text. The image is left in gray.
+SWTDEF void swt_apply_stroke_width_transform_pyramid(SWTImage *image,
+                                                     SWTComponents *components,
+                                                     SWTResults *results,
+                                                     int levels,
+                                                     int confidenceThreshold);
+
+// Variant for very large images that spreads the work over `threads`
+// threads. The image is cut into tileSize x tileSize tiles that are labeled
+// and measured separately, each with a `halo` pixel margin around it;
+// components reaching past the halo of the tile they start in are stitched
+// together on the whole image afterwards, so make the halo as large as the
+// biggest text expected. Components and results are the same, and in the same
+// order, as from swt_apply_stroke_width_transform. The image is binarized in
+// place.
+SWTDEF void swt_apply_stroke_width_transform_tiled(SWTImage *image,
+                                                   SWTComponents *components,
+                                                   SWTResults *results,
+                                                   int tileSize, int halo,
+                                                   int threads);
+
+// Cheap check for whether an image holds any text at all, to skip the full
+// transform on the ones that don't. The image is split into tiles that are
+// visited most edges first, stopping at the first one with a few glyph like
+// components in it. Tiles too flat to hold text are never looked at. A
+// `budgetMs` <= 0 means no time limit. The image is not modified.
+SWTDEF SWTTriage swt_triage_text(const SWTImage *image, int confidenceThreshold,
+                                 double budgetMs);
+SWTDEF SWTTriage swt_triage_text_with(const SWTImage *image, int confidenceThreshold,
+                                      double budgetMs, const SWTAllocator *allocator);
+
+// Incremental transform for video from a static camera. Each frame's mask is
+// compared to the previous one tile by tile; components clear of any changed
+// tile keep their points, stroke width and id, only the rest is labeled and
+// measured again. Frames must all be width x height and are binarized in
+// place, the results are in video->data until the next frame. Create returns
+// NULL without memory; a frame that runs out of it has status
+// SWT_STATUS_NO_MEMORY, may miss components, and is best followed by a fresh
+// context.
+//
+//    SWTVideo *video = swt_video_create(width, height);
+//    for (each frame) {
+//      swt_video_apply(video, &frame);
+//      swt_visualize_text_on_image(&frame, video->data->results, 4);
+//    }
+//    swt_video_free(video);
+SWTDEF SWTVideo *swt_video_create(int width, int height);
+SWTDEF SWTVideo *swt_video_create_with(int width, int height,
+                                       const SWTAllocator *allocator);
+SWTDEF void swt_video_apply(SWTVideo *video, SWTImage *frame);
+SWTDEF void swt_video_free(SWTVideo *video);
+
 // This function actually carries out the "computation" part of the SWT, it
 // loops through each point in the given components, calculates their gradient
 // direction and extracts a stroke width and returns the median of all the
-// widths in the component
+// widths in the component, or -1 when its scratch memory can't be allocated
 SWTDEF int
 swt_compute_stroke_width_for_component(SWTImage *image,
                                        SWTComponent *currentComponent);
 
+// Packed point streams for components kept around for long, eg. across video
+// frames or a whole batch. Pack returns 0 when out of memory; `allocator` may
+// be NULL and has to be the same for the free. Unpack writes the points back
+// to `points`, which needs room for packed->pointCount, and returns how many
+// it wrote, fewer if the stream ends early. The stroke width variant decodes
+// the points as it goes and gives the same width; it leaves out points past
+// the end of the stream or outside packed->box.
+SWTDEF int swt_pack_component(const SWTComponent *component,
+                              SWTPackedComponent *packed,
+                              const SWTAllocator *allocator);
+SWTDEF int swt_unpack_component(const SWTPackedComponent *packed, SWTPoint *points);
+SWTDEF void swt_free_packed_component(SWTPackedComponent *packed,
+                                      const SWTAllocator *allocator);
+SWTDEF int swt_compute_stroke_width_for_packed(SWTImage *image,
+                                               const SWTPackedComponent *packed);
+
 // Does a Connective Component Analysis for the image, it DOES NOT handle
 // binarization, is must be handled outside.
 // Usage:
@@ -183,11 +580,61 @@ swt_compute_stroke_width_for_component(SWTImage *image,
 //        swt__allocate_components(image->width, image->height);
 //    swt_connected_component_analysis(image, components);
 //    swt__free_components(components);
-SWTDEF SWTComponents *swt__allocate_components(int size);
+SWTDEF SWTComponents *swt__allocate_components(size_t size);
 SWTDEF void swt_connected_component_analysis(SWTImage *image,
                                              SWTComponents *components);
 SWTDEF void swt__free_components(SWTComponents *components);
 
+// The same components from a block based two pass labeling instead of the
+// flood fill, see swt__label_blocks. The points of a component come out in
+// scan order. It is only for 8-connectivity, with 4 it falls back to
+// swt_connected_component_analysis.
+SWTDEF void swt_connected_component_analysis_blocks(SWTImage *image,
+                                                    SWTComponents *components);
+
+// Bounding box of all the points in a component
+SWTDEF SWTBox swt_compute_component_box(SWTComponent *component);
+
+// CCA that only writes a label image and per label stats, no points are
+// copied out. Takes the same binary images as swt_connected_component_analysis
+// and a `connectivity` like SWTComponents.connectivity, returns NULL without
+// memory. Points are found on demand from a label's bounding box, either one
+// at a time with the iterator or all at once into `points` (room for the
+// label's area, returns the count).
+//
+//    SWTLabels *labels = swt_label_components(image, 0, NULL);
+//    SWTLabelIterator it = swt_iterate_label(labels, 1);
+//    SWTPoint point;
+//    while (swt_next_label_point(&it, &point)) { ... }
+//    swt_free_labels(labels);
+SWTDEF SWTLabels *swt_label_components(const SWTImage *image, int connectivity,
+                                       const SWTAllocator *allocator);
+SWTDEF void swt_free_labels(SWTLabels *labels);
+SWTDEF uint32_t swt_get_label(const SWTLabels *labels, int x, int y);
+SWTDEF SWTLabelIterator swt_iterate_label(const SWTLabels *labels, uint32_t label);
+SWTDEF int swt_next_label_point(SWTLabelIterator *iterator, SWTPoint *point);
+SWTDEF int swt_get_label_points(const SWTLabels *labels, uint32_t label, SWTPoint *points);
+// The same 8-connected labels from the block based labeling
+SWTDEF SWTLabels *swt_label_components_blocks(const SWTImage *image,
+                                              const SWTAllocator *allocator);
+
+// Stroke width of a label, reading its points straight off the label image
+SWTDEF int swt_compute_stroke_width_for_label(SWTImage *image,
+                                              const SWTLabels *labels,
+                                              uint32_t label);
+
+// Builds the direction lookup tables used by the sobel and stroke width code.
+// They are built lazily on first use, call this once up front if the library
+// is going to be used from several threads at the same time.
+SWTDEF void swt_init_tables(void);
+
+// Name of the instruction set the pixel kernels were dispatched to, one of
+// "scalar", "sse2", "avx2" or "avx512"
+SWTDEF const char *swt_get_isa(void);
+
+// Milliseconds on a monotonic clock, the time base of SWTResults.deadlineMs
+SWTDEF double swt_now_ms(void);
+
 // This function computes the gradient info via sobel operator, for the pixel
 // located at (x, y)
 // Usage:
@@ -200,380 +647,4379 @@ SWTDEF SWTSobelNode swt_compute_sobel_for_point(SWTImage *image,
                                                 SWTPoint point);
 
 // pre-processing apply filters destructively, eg they will resize and/or
-// modify the image->bytes
+// modify the image->bytes. Grayscale leaves single channel images untouched.
 SWTDEF void swt_apply_grayscale(SWTImage *image);
 SWTDEF void swt_apply_threshold(SWTImage *image, const int threshold);
 
 // Computes a threshold for the image based on the image itself
 SWTDEF uint8_t swt_compute_otsu_threshold(SWTImage *image);
 
+// Expands a 1 bit per pixel bitmap (rows of `stride` bytes, most significant
+// bit first, set bits are ink like in PBM) into a mask for
+// swt_apply_stroke_width_transform_to_mask. image->bytes must hold
+// width * height bytes, channels is set to 1.
+SWTDEF void swt_unpack_mask(const uint8_t *bits, int stride, SWTImage *image);
+
+// Halves the image with a 2x2 box filter, an odd last row or column is
+// dropped. dst->bytes must hold (width / 2) * (height / 2) * channels bytes
+// and may be the same buffer as src->bytes.
+SWTDEF void swt_downsample_2x(const SWTImage *src, SWTImage *dst);
+
+// Result i as a single struct, see SWTResult
+SWTDEF SWTResult swt_get_result(const SWTResults *results, int i);
+
+// Appends a result for `component`, filling in its area and box. Returns 0 if
+// the columns couldn't grow (or the memory budget is spent).
+SWTDEF int swt_add_result(SWTResults *results, SWTComponent *component,
+                          float confidence, float variation);
+
+// Writes the index of every result within `filter` to `indices`, which needs
+// room for results->itemCount of them, in order and returns how many there
+// are. The columns are tested several rows at a time by the pixel kernels.
+SWTDEF int swt_filter_results(const SWTResults *results, const SWTFilter *filter,
+                              int *indices);
+
+// Reorders indices[0..count) so the first k of them are the results with
+// the smallest confidence, ties going to the lower index, and returns k
+// clamped to count. Takes expected O(count) time, the k aren't sorted.
+SWTDEF int swt_select_top_results(const SWTResults *results, int *indices,
+                                  int count, int k);
+
+// Bounding box of result i, from its columns
+SWTDEF SWTBox swt_get_result_box(const SWTResults *results, int i);
+
+// Marks the components of every result with a confidence of at most
+// confidenceThreshold in gray
 SWTDEF void swt_visualize_text_on_image(SWTImage *image, SWTResults *results, const int confidenceThreshold);
 
 #endif // SWT_H_
 
 #ifdef SWT_IMPLEMENTATION
 
-SWTDEF void swt_connected_component_analysis(SWTImage *image,
-                                             SWTComponents *components) {
-  int width = image->width, height = image->height;
-  uint8_t *data = image->bytes;
+#if !defined(SWT_MALLOC) && !defined(SWT_REALLOC) && !defined(SWT_FREE)
+#define SWT_MALLOC(size) malloc(size)
+#define SWT_REALLOC(ptr, size) realloc(ptr, size)
+#define SWT_FREE(ptr) free(ptr)
+// zeroed memory straight from the C allocator, which gets it for free
+#define SWT__CALLOC(count, size) calloc(count, size)
+#elif !defined(SWT_MALLOC) || !defined(SWT_REALLOC) || !defined(SWT_FREE)
+#error "define all of SWT_MALLOC, SWT_REALLOC and SWT_FREE, or none of them"
+#endif
 
-  /*
-  const int directions[8][2] = {{-1, 0},  {1, 0},  {0, -1}, {0, 1},
-                                {-1, -1}, {-1, 1}, {1, -1}, {1, 1}};
-  const int cardinals = 8;
+/*
+   Pixel kernels
 
-  */
+   The inner loops of the pre-processing and CCA passes are written once in
+   plain C and once per SIMD instruction set. The best variant the CPU
+   supports is picked at runtime the first time swt_init_tables() runs. Set the
+   SWT_FORCE_ISA environment variable to one of "scalar", "sse2", "avx2" or
+   "avx512" to pin a variant (it is clamped to what the CPU supports), or
+   define SWT_NO_SIMD to build the scalar kernels only.
 
-    const int directions[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
-    const int cardinals = 4;
+   Every variant produces bit-identical output to the scalar one.
+*/
 
+#if !defined(SWT_NO_SIMD) && defined(__GNUC__) &&                             \
+    (defined(__x86_64__) || defined(__i386__))
+#define SWT__X86 1
+#include <immintrin.h>
+#endif
 
-  int *visited = (int *)calloc(width * height, sizeof(int));
-  SWTPoint *queue = (SWTPoint *)malloc(width * height * sizeof(SWTPoint));
+// SWTFilter with the bounds that don't apply opened all the way, so every
+// test is a plain compare
+typedef struct {
+  float maxConfidence;
+  float maxVariation;
+  float maxAspect;
+  int minArea;
+  int maxArea;
+  int minHeight;
+  int maxHeight;
+} SWTFilterBounds;
 
-  for (int i = 0; i < height; i++) {
-    for (int j = 0; j < width; j++) {
-      if (data[i * width + j] == SWT_CLR_WHITE || visited[i * width + j])
-        continue;
+typedef struct {
+  const char *name;
+  // rgb -> gray, gray may alias rgb
+  void (*grayscale)(const uint8_t *rgb, uint8_t *gray, int count);
+  void (*threshold)(uint8_t *bytes, int count, int threshold);
+  void (*histogram)(const uint8_t *bytes, int count, int *histogram);
+  // gradients for `count` pixels of `row`, reading one pixel either side
+  void (*sobel_row)(const uint8_t *above, const uint8_t *row,
+                    const uint8_t *below, int count, int16_t *gradientX,
+                    int16_t *gradientY);
+  // index of the first pixel in [start, end) that isn't background, or end
+  int (*find_foreground)(const uint8_t *row, int start, int end);
+  // 2x2 box average of two rows into `count` pixels, rounding to nearest
+  void (*downsample_row)(const uint8_t *top, const uint8_t *bottom,
+                         uint8_t *out, int count);
+  // number of bytes that differ between a and b
+  int (*count_changes)(const uint8_t *a, const uint8_t *b, int count);
+  // indices of the results from `start` on that are within the bounds,
+  // returns how many were written
+  int (*filter_results)(const SWTResults *results, int start,
+                        const SWTFilterBounds *bounds, int *indices);
+} SWTKernels;
+
+// gray = (30r + 59g + 11b) / 100, the division done as a multiply and shift
+// that is exact for every sum up to 255 * 100
+#define SWT__GRAY_R 30
+#define SWT__GRAY_G 59
+#define SWT__GRAY_B 11
+#define SWT__GRAY_DIV_MUL 41944
+#define SWT__GRAY_DIV_SHIFT 22
+
+static void swt__grayscale_scalar(const uint8_t *rgb, uint8_t *gray,
+                                  int count) {
+  for (int i = 0; i < count; i++) {
+    int sum = SWT__GRAY_R * rgb[i * 3] + SWT__GRAY_G * rgb[i * 3 + 1] +
+              SWT__GRAY_B * rgb[i * 3 + 2];
+    gray[i] = (uint8_t)((sum * SWT__GRAY_DIV_MUL) >> SWT__GRAY_DIV_SHIFT);
+  }
+}
 
-      SWTComponent currentComponent;
-      currentComponent.pointCount = 0;
-      currentComponent.points =
-          (SWTPoint *)malloc(width * height * sizeof(SWTPoint));
+static void swt__threshold_scalar(uint8_t *bytes, int count, int threshold) {
+  for (int i = 0; i < count; i++) {
+    bytes[i] = bytes[i] > threshold ? SWT_CLR_BLACK : SWT_CLR_WHITE;
+  }
+}
 
-      int qEnd = 0, qBegin = 0;
+// Four interleaved banks so consecutive equal pixels (the common case) don't
+// serialize on the same counter; a histogram scatter gains nothing from
+// vector registers, so every ISA shares this one
+static void swt__histogram_scalar(const uint8_t *bytes, int count,
+                                  int *histogram) {
+  int banks[4][256] = {{0}};
+  int i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    banks[0][bytes[i]]++;
+    banks[1][bytes[i + 1]]++;
+    banks[2][bytes[i + 2]]++;
+    banks[3][bytes[i + 3]]++;
+  }
+  for (; i < count; i++) {
+    banks[0][bytes[i]]++;
+  }
 
-      queue[qEnd] = (SWTPoint){j, i};
-      qEnd++;
-      visited[i * width + j] = 1;
+  for (int v = 0; v < 256; v++) {
+    histogram[v] += banks[0][v] + banks[1][v] + banks[2][v] + banks[3][v];
+  }
+}
 
-      while (qEnd > qBegin) {
-        int x = queue[qBegin].x, y = queue[qBegin].y;
-        qBegin++;
+static void swt__sobel_row_scalar(const uint8_t *above, const uint8_t *row,
+                                  const uint8_t *below, int count,
+                                  int16_t *gradientX, int16_t *gradientY) {
+  for (int x = 0; x < count; x++) {
+    gradientX[x] = (int16_t)((above[x + 1] - above[x - 1]) +
+                             2 * (row[x + 1] - row[x - 1]) +
+                             (below[x + 1] - below[x - 1]));
+    gradientY[x] = (int16_t)((below[x - 1] + 2 * below[x] + below[x + 1]) -
+                             (above[x - 1] + 2 * above[x] + above[x + 1]));
+  }
+}
 
-        for (int d = 0; d < cardinals; d++) {
-          int xx = x + directions[d][0];
-          int yy = y + directions[d][1];
+static int swt__find_foreground_scalar(const uint8_t *row, int start,
+                                       int end) {
+  while (start < end && row[start] == SWT_CLR_BLACK) {
+    start++;
+  }
+  return start;
+}
 
-          if (xx < 0 || xx >= width || yy < 0 || yy >= height)
-            continue;
-          if (data[yy * width + xx] == SWT_CLR_BLACK ||
-              visited[yy * width + xx])
-            continue;
+static void swt__downsample_row_scalar(const uint8_t *top,
+                                       const uint8_t *bottom, uint8_t *out,
+                                       int count) {
+  for (int x = 0; x < count; x++) {
+    out[x] = (uint8_t)((top[2 * x] + top[2 * x + 1] + bottom[2 * x] +
+                        bottom[2 * x + 1] + 2) >> 2);
+  }
+}
 
-          queue[qEnd] = (SWTPoint){xx, yy};
-          qEnd++;
-          visited[yy * width + xx] = 1;
+static int swt__count_changes_scalar(const uint8_t *a, const uint8_t *b,
+                                     int count) {
+  int changes = 0;
+  for (int i = 0; i < count; i++) {
+    changes += a[i] != b[i];
+  }
+  return changes;
+}
 
-          currentComponent.points[currentComponent.pointCount] =
-              (SWTPoint){xx, yy};
-          currentComponent.pointCount++;
-        }
-      }
+// Branch free, the index is always written and only kept by moving on
+static int swt__filter_results_scalar(const SWTResults *results, int start,
+                                      const SWTFilterBounds *bounds,
+                                      int *indices) {
+  int count = 0;
+  for (int i = start; i < results->itemCount; i++) {
+    int keep = (results->confidences[i] <= bounds->maxConfidence) &
+               (results->variations[i] <= bounds->maxVariation) &
+               (results->areas[i] >= bounds->minArea) &
+               (results->areas[i] <= bounds->maxArea) &
+               (results->heights[i] >= bounds->minHeight) &
+               (results->heights[i] <= bounds->maxHeight) &
+               ((float)results->widths[i] <= bounds->maxAspect * (float)results->heights[i]);
+    indices[count] = i;
+    count += keep;
+  }
+  return count;
+}
 
-      if (currentComponent.pointCount > 0) {
-        components->items[components->itemCount] = currentComponent;
-        components->itemCount++;
-      } else {
-        free(currentComponent.points);
-      }
+static const SWTKernels swt__kernels_scalar = {
+    "scalar",
+    swt__grayscale_scalar,
+    swt__threshold_scalar,
+    swt__histogram_scalar,
+    swt__sobel_row_scalar,
+    swt__find_foreground_scalar,
+    swt__downsample_row_scalar,
+    swt__count_changes_scalar,
+    swt__filter_results_scalar,
+};
+
+#ifdef SWT__X86
+
+#define SWT__TARGET_SSE2 __attribute__((target("sse2")))
+#define SWT__TARGET_AVX2 __attribute__((target("avx2")))
+#define SWT__TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512bw,bmi2")))
+
+// x > threshold is computed as max(x, threshold + 1) == x since SSE2 and AVX2
+// only have signed byte compares
+SWT__TARGET_SSE2
+static void swt__threshold_sse2(uint8_t *bytes, int count, int threshold) {
+  int i = 0;
+
+  if (threshold < 255) {
+    const __m128i limit = _mm_set1_epi8((char)(threshold + 1));
+    const __m128i black = _mm_set1_epi8((char)SWT_CLR_BLACK);
+    const __m128i white = _mm_set1_epi8((char)SWT_CLR_WHITE);
+
+    for (; i + 16 <= count; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(bytes + i));
+      __m128i above = _mm_cmpeq_epi8(_mm_max_epu8(v, limit), v);
+      v = _mm_or_si128(_mm_and_si128(above, black),
+                       _mm_andnot_si128(above, white));
+      _mm_storeu_si128((__m128i *)(bytes + i), v);
     }
   }
 
-  free(visited);
-  free(queue);
+  swt__threshold_scalar(bytes + i, count - i, threshold);
 }
 
-SWTDEF void swt_apply_grayscale(SWTImage *image) {
-  SWT_ASSERT(image->channels == 3);
+SWT__TARGET_SSE2
+static void swt__sobel_row_sse2(const uint8_t *above, const uint8_t *row,
+                                const uint8_t *below, int count,
+                                int16_t *gradientX, int16_t *gradientY) {
+  const __m128i zero = _mm_setzero_si128();
+  int x = 0;
+
+#define SWT__LOAD8(p) _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p)), zero)
+  for (; x + 8 <= count; x += 8) {
+    __m128i al = SWT__LOAD8(above + x - 1), ac = SWT__LOAD8(above + x),
+            ar = SWT__LOAD8(above + x + 1);
+    __m128i rl = SWT__LOAD8(row + x - 1), rr = SWT__LOAD8(row + x + 1);
+    __m128i bl = SWT__LOAD8(below + x - 1), bc = SWT__LOAD8(below + x),
+            br = SWT__LOAD8(below + x + 1);
+
+    __m128i dr = _mm_sub_epi16(rr, rl);
+    __m128i gx = _mm_add_epi16(_mm_add_epi16(_mm_sub_epi16(ar, al), _mm_sub_epi16(br, bl)),
+                               _mm_add_epi16(dr, dr));
+    __m128i top = _mm_add_epi16(_mm_add_epi16(al, ar), _mm_add_epi16(ac, ac));
+    __m128i bottom = _mm_add_epi16(_mm_add_epi16(bl, br), _mm_add_epi16(bc, bc));
+
+    _mm_storeu_si128((__m128i *)(gradientX + x), gx);
+    _mm_storeu_si128((__m128i *)(gradientY + x), _mm_sub_epi16(bottom, top));
+  }
+#undef SWT__LOAD8
 
-  int imageSize = image->width * image->height;
+  swt__sobel_row_scalar(above + x, row + x, below + x, count - x,
+                        gradientX + x, gradientY + x);
+}
 
-  uint8_t *grayscaleImage = (uint8_t *)malloc(imageSize * sizeof(uint8_t));
-  SWT_IF_NO_MEMORY_EXIT(grayscaleImage);
+SWT__TARGET_SSE2
+static int swt__find_foreground_sse2(const uint8_t *row, int start, int end) {
+  const __m128i black = _mm_set1_epi8((char)SWT_CLR_BLACK);
 
-  for (int i = 0; i < imageSize; i++) {
-    uint8_t r = image->bytes[i * 3];
-    uint8_t g = image->bytes[i * 3 + 1];
-    uint8_t b = image->bytes[i * 3 + 2];
-    grayscaleImage[i] = (uint8_t)(0.3 * r + 0.59 * g + 0.11 * b);
+  for (; start + 16 <= end; start += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(row + start));
+    unsigned background = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, black));
+    if (background != 0xFFFF) {
+      return start + __builtin_ctz(~background);
+    }
   }
 
-  memcpy(image->bytes, grayscaleImage, imageSize * sizeof(uint8_t));
-  image->channels = 1;
-  free(grayscaleImage);
+  return swt__find_foreground_scalar(row, start, end);
 }
 
-// TODO: this will break black on white
- SWTDEF void swt_apply_threshold(SWTImage * image, const int threshold) {
-   for (int y = 0; y < image->height; y++) {
-     for (int x = 0; x < image->width; x++) {
-       int index = (y * image->width + x) * image->channels;
-       if (image->bytes[index] > threshold) {
-         image->bytes[index] = SWT_CLR_BLACK;
-       } else {
-         image->bytes[index] = SWT_CLR_WHITE;
-       }
-     }
-   }
-}
-
-SWTDEF SWTComponents *swt__allocate_components(int size) {
-  SWTComponents *components = (SWTComponents *)malloc(sizeof(SWTComponents));
+// Even and odd bytes are split into 16 bit lanes with a mask and a shift, the
+// four taps summed there and packed back down
+SWT__TARGET_SSE2
+static __m128i swt__box8_sse2(const uint8_t *top, const uint8_t *bottom) {
+  const __m128i low = _mm_set1_epi16(0x00ff);
+  __m128i t = _mm_loadu_si128((const __m128i *)top);
+  __m128i b = _mm_loadu_si128((const __m128i *)bottom);
+  __m128i sum = _mm_add_epi16(
+      _mm_add_epi16(_mm_and_si128(t, low), _mm_srli_epi16(t, 8)),
+      _mm_add_epi16(_mm_and_si128(b, low), _mm_srli_epi16(b, 8)));
+  return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+}
 
-  if (components != NULL) {
-    components->itemCount = 0;
-    components->items = (SWTComponent *)malloc(size * sizeof(SWTComponent));
+SWT__TARGET_SSE2
+static void swt__downsample_row_sse2(const uint8_t *top, const uint8_t *bottom,
+                                     uint8_t *out, int count) {
+  int x = 0;
 
-    SWT_IF_NO_MEMORY_EXIT(components->items);
+  for (; x + 16 <= count; x += 16) {
+    __m128i packed =
+        _mm_packus_epi16(swt__box8_sse2(top + 2 * x, bottom + 2 * x),
+                         swt__box8_sse2(top + 2 * x + 16, bottom + 2 * x + 16));
+    _mm_storeu_si128((__m128i *)(out + x), packed);
   }
 
-  return components;
+  swt__downsample_row_scalar(top + 2 * x, bottom + 2 * x, out + x, count - x);
 }
 
-SWTDEF void swt__free_components(SWTComponents *components) {
-  if (components) {
-    components->items = NULL;
-    components->itemCount = 0;
-    free(components);
+// XOR, then one movemask bit per byte that isn't zero, then popcount
+SWT__TARGET_SSE2
+static int swt__count_changes_sse2(const uint8_t *a, const uint8_t *b,
+                                   int count) {
+  const __m128i zero = _mm_setzero_si128();
+  int changes = 0, i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(a + i)),
+                              _mm_loadu_si128((const __m128i *)(b + i)));
+    unsigned same = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero));
+    changes += 16 - __builtin_popcount(same);
   }
+
+  return changes + swt__count_changes_scalar(a + i, b + i, count - i);
 }
 
-static SWTResults *swt__allocate_results(int count) {
-  SWTResults *results = (SWTResults *)malloc(sizeof(SWTResults));
+// Four rows per iteration. SSE2 only has a signed greater than for integers,
+// the range tests are done as "out of range" and masked off at the end.
+SWT__TARGET_SSE2
+static int swt__filter_results_sse2(const SWTResults *results, int start,
+                                    const SWTFilterBounds *bounds,
+                                    int *indices) {
+  const __m128 maxConfidence = _mm_set1_ps(bounds->maxConfidence);
+  const __m128 maxVariation = _mm_set1_ps(bounds->maxVariation);
+  const __m128 maxAspect = _mm_set1_ps(bounds->maxAspect);
+  const __m128i minArea = _mm_set1_epi32(bounds->minArea);
+  const __m128i maxArea = _mm_set1_epi32(bounds->maxArea);
+  const __m128i minHeight = _mm_set1_epi32(bounds->minHeight);
+  const __m128i maxHeight = _mm_set1_epi32(bounds->maxHeight);
+  int count = 0, i = start;
+
+  for (; i + 4 <= results->itemCount; i += 4) {
+    __m128i area = _mm_loadu_si128((const __m128i *)(results->areas + i));
+    __m128i height = _mm_loadu_si128((const __m128i *)(results->heights + i));
+    __m128i width = _mm_loadu_si128((const __m128i *)(results->widths + i));
+
+    __m128 keep = _mm_and_ps(
+        _mm_cmple_ps(_mm_loadu_ps(results->confidences + i), maxConfidence),
+        _mm_cmple_ps(_mm_loadu_ps(results->variations + i), maxVariation));
+    keep = _mm_and_ps(keep, _mm_cmple_ps(_mm_cvtepi32_ps(width),
+                                         _mm_mul_ps(maxAspect, _mm_cvtepi32_ps(height))));
+    __m128i outside = _mm_or_si128(
+        _mm_or_si128(_mm_cmpgt_epi32(minArea, area), _mm_cmpgt_epi32(area, maxArea)),
+        _mm_or_si128(_mm_cmpgt_epi32(minHeight, height), _mm_cmpgt_epi32(height, maxHeight)));
+    keep = _mm_andnot_ps(_mm_castsi128_ps(outside), keep);
+
+    for (unsigned mask = (unsigned)_mm_movemask_ps(keep); mask; mask &= mask - 1) {
+      indices[count++] = i + __builtin_ctz(mask);
+    }
+  }
 
-  if (results != NULL) {
-    results->items = (SWTResult *)malloc(sizeof(SWTResult) * count);
+  return count + swt__filter_results_scalar(results, i, bounds, indices + count);
+}
 
-    if (results->items != NULL) {
-      results->itemCount = 0;
+// SSE2 has no byte shuffle to de-interleave RGB with, the AVX2 variant below
+// uses the SSSE3 one
+static const SWTKernels swt__kernels_sse2 = {
+    "sse2",
+    swt__grayscale_scalar,
+    swt__threshold_sse2,
+    swt__histogram_scalar,
+    swt__sobel_row_sse2,
+    swt__find_foreground_sse2,
+    swt__downsample_row_sse2,
+    swt__count_changes_sse2,
+    swt__filter_results_sse2,
+};
+
+// 16 pixels per iteration: the three 16 byte loads are shuffled into planar
+// r, g and b, then weighted and divided in 32 bit lanes exactly like the
+// scalar code
+SWT__TARGET_AVX2
+static void swt__grayscale_avx2(const uint8_t *rgb, uint8_t *gray, int count) {
+  const __m128i r0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m128i r1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+  const __m128i r2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+  const __m128i g0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m128i g1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+  const __m128i g2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+  const __m128i b0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m128i b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+  const __m128i b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+  const __m256i weightsRG = _mm256_set1_epi32((SWT__GRAY_G << 16) | SWT__GRAY_R);
+  const __m256i weightsB = _mm256_set1_epi32(SWT__GRAY_B);
+  const __m256i divide = _mm256_set1_epi32(SWT__GRAY_DIV_MUL);
+  int i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    __m128i v0 = _mm_loadu_si128((const __m128i *)(rgb + i * 3));
+    __m128i v1 = _mm_loadu_si128((const __m128i *)(rgb + i * 3 + 16));
+    __m128i v2 = _mm_loadu_si128((const __m128i *)(rgb + i * 3 + 32));
+
+    __m128i r = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, r0), _mm_shuffle_epi8(v1, r1)),
+                             _mm_shuffle_epi8(v2, r2));
+    __m128i g = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, g0), _mm_shuffle_epi8(v1, g1)),
+                             _mm_shuffle_epi8(v2, g2));
+    __m128i b = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, b0), _mm_shuffle_epi8(v1, b1)),
+                             _mm_shuffle_epi8(v2, b2));
+
+    // r/g byte pairs as 16 bit lanes, then madd folds r*wr + g*wg into 32 bits
+    __m256i r16 = _mm256_cvtepu8_epi16(r);
+    __m256i g16 = _mm256_cvtepu8_epi16(g);
+    __m256i b16 = _mm256_cvtepu8_epi16(b);
+    __m256i rgLo = _mm256_unpacklo_epi16(r16, g16);
+    __m256i rgHi = _mm256_unpackhi_epi16(r16, g16);
+    __m256i bLo = _mm256_unpacklo_epi16(b16, _mm256_setzero_si256());
+    __m256i bHi = _mm256_unpackhi_epi16(b16, _mm256_setzero_si256());
+
+    __m256i lo = _mm256_add_epi32(_mm256_madd_epi16(rgLo, weightsRG), _mm256_madd_epi16(bLo, weightsB));
+    __m256i hi = _mm256_add_epi32(_mm256_madd_epi16(rgHi, weightsRG), _mm256_madd_epi16(bHi, weightsB));
+    lo = _mm256_srli_epi32(_mm256_mullo_epi32(lo, divide), SWT__GRAY_DIV_SHIFT);
+    hi = _mm256_srli_epi32(_mm256_mullo_epi32(hi, divide), SWT__GRAY_DIV_SHIFT);
+
+    // the unpacks and packs work per 128 bit lane, so they cancel out
+    __m256i packed = _mm256_packus_epi32(lo, hi);
+    __m128i out = _mm_packus_epi16(_mm256_castsi256_si128(packed),
+                                   _mm256_extracti128_si256(packed, 1));
+    _mm_storeu_si128((__m128i *)(gray + i), out);
+  }
 
-      for (int i = 0; i < count; i++) {
-        results->items[i].confidence = 0.0f;
-        results->items[i].component = NULL;
-      }
-    } else {
-      // Handle memory allocation error for items array
-      free(results);
-      return NULL;
+  swt__grayscale_scalar(rgb + i * 3, gray + i, count - i);
+}
+
+SWT__TARGET_AVX2
+static void swt__threshold_avx2(uint8_t *bytes, int count, int threshold) {
+  int i = 0;
+
+  if (threshold < 255) {
+    const __m256i limit = _mm256_set1_epi8((char)(threshold + 1));
+    const __m256i black = _mm256_set1_epi8((char)SWT_CLR_BLACK);
+    const __m256i white = _mm256_set1_epi8((char)SWT_CLR_WHITE);
+
+    for (; i + 32 <= count; i += 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(bytes + i));
+      __m256i above = _mm256_cmpeq_epi8(_mm256_max_epu8(v, limit), v);
+      _mm256_storeu_si256((__m256i *)(bytes + i), _mm256_blendv_epi8(white, black, above));
     }
   }
 
-  return results;
+  swt__threshold_sse2(bytes + i, count - i, threshold);
 }
 
-static void swt__free_results(SWTResults *results) {
-  if (results != NULL) {
-    free(results->items);
-    results->items = NULL;
-    results->itemCount = 0;
-    free(results);
+SWT__TARGET_AVX2
+static void swt__sobel_row_avx2(const uint8_t *above, const uint8_t *row,
+                                const uint8_t *below, int count,
+                                int16_t *gradientX, int16_t *gradientY) {
+  int x = 0;
+
+#define SWT__LOAD16(p) _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(p)))
+  for (; x + 16 <= count; x += 16) {
+    __m256i al = SWT__LOAD16(above + x - 1), ac = SWT__LOAD16(above + x),
+            ar = SWT__LOAD16(above + x + 1);
+    __m256i rl = SWT__LOAD16(row + x - 1), rr = SWT__LOAD16(row + x + 1);
+    __m256i bl = SWT__LOAD16(below + x - 1), bc = SWT__LOAD16(below + x),
+            br = SWT__LOAD16(below + x + 1);
+
+    __m256i dr = _mm256_sub_epi16(rr, rl);
+    __m256i gx = _mm256_add_epi16(_mm256_add_epi16(_mm256_sub_epi16(ar, al), _mm256_sub_epi16(br, bl)),
+                                  _mm256_add_epi16(dr, dr));
+    __m256i top = _mm256_add_epi16(_mm256_add_epi16(al, ar), _mm256_add_epi16(ac, ac));
+    __m256i bottom = _mm256_add_epi16(_mm256_add_epi16(bl, br), _mm256_add_epi16(bc, bc));
+
+    _mm256_storeu_si256((__m256i *)(gradientX + x), gx);
+    _mm256_storeu_si256((__m256i *)(gradientY + x), _mm256_sub_epi16(bottom, top));
   }
+#undef SWT__LOAD16
+
+  swt__sobel_row_sse2(above + x, row + x, below + x, count - x,
+                      gradientX + x, gradientY + x);
 }
 
-SWTDEF SWTData* swt_allocate(int size) {
-    SWTData* data = (SWTData*)malloc(sizeof(SWTData));
-    SWT_IF_NO_MEMORY_EXIT(data);
+SWT__TARGET_AVX2
+static int swt__find_foreground_avx2(const uint8_t *row, int start, int end) {
+  const __m256i black = _mm256_set1_epi8((char)SWT_CLR_BLACK);
 
-    data->components = swt__allocate_components(size);
-    data->results = swt__allocate_results(size);
+  for (; start + 32 <= end; start += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(row + start));
+    unsigned background = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, black));
+    if (background != 0xFFFFFFFFu) {
+      return start + __builtin_ctz(~background);
+    }
+  }
 
-    return data;
+  return swt__find_foreground_sse2(row, start, end);
 }
 
-SWTDEF void swt_free(SWTData *data) {
-    swt__free_components(data->components);
-    swt__free_results(data->results);
+SWT__TARGET_AVX2
+static __m256i swt__box16_avx2(const uint8_t *top, const uint8_t *bottom) {
+  const __m256i low = _mm256_set1_epi16(0x00ff);
+  __m256i t = _mm256_loadu_si256((const __m256i *)top);
+  __m256i b = _mm256_loadu_si256((const __m256i *)bottom);
+  __m256i sum = _mm256_add_epi16(
+      _mm256_add_epi16(_mm256_and_si256(t, low), _mm256_srli_epi16(t, 8)),
+      _mm256_add_epi16(_mm256_and_si256(b, low), _mm256_srli_epi16(b, 8)));
+  return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(2)), 2);
 }
 
-SWTDEF SWTSobelNode swt_compute_sobel_for_point(SWTImage *image,
-                                                SWTPoint point) {
-  const int sobelX[][3] = {{-1, -2, -1}, {0, 0, 0}, {1, 2, 1}};
-  const int sobelY[][3] = {{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}};
+// packus works per 128 bit lane, the permute puts the halves back in order
+SWT__TARGET_AVX2
+static void swt__downsample_row_avx2(const uint8_t *top, const uint8_t *bottom,
+                                     uint8_t *out, int count) {
+  int x = 0;
+
+  for (; x + 32 <= count; x += 32) {
+    __m256i packed =
+        _mm256_packus_epi16(swt__box16_avx2(top + 2 * x, bottom + 2 * x),
+                            swt__box16_avx2(top + 2 * x + 32, bottom + 2 * x + 32));
+    _mm256_storeu_si256((__m256i *)(out + x),
+                        _mm256_permute4x64_epi64(packed, 0xd8));
+  }
 
-  SWTSobelNode node = {0};
+  swt__downsample_row_sse2(top + 2 * x, bottom + 2 * x, out + x, count - x);
+}
 
-  for (int y = 0; y < 3; y++) {
-    for (int x = 0; x < 3; x++) {
-      int xx = point.x + x;
-      int yy = point.y + y;
+SWT__TARGET_AVX2
+static int swt__count_changes_avx2(const uint8_t *a, const uint8_t *b,
+                                   int count) {
+  const __m256i zero = _mm256_setzero_si256();
+  int changes = 0, i = 0;
+
+  for (; i + 32 <= count; i += 32) {
+    __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                 _mm256_loadu_si256((const __m256i *)(b + i)));
+    unsigned same = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, zero));
+    changes += 32 - __builtin_popcount(same);
+  }
 
-      if (xx >= 0 && xx < image->width && yy >= 0 && yy < image->height) {
-        int currentIndex = yy * image->width + xx;
+  return changes + swt__count_changes_sse2(a + i, b + i, count - i);
+}
 
-        node.gradientX += image->bytes[currentIndex] * sobelX[y][x];
-        node.gradientY += image->bytes[currentIndex] * sobelY[y][x];
-      }
+SWT__TARGET_AVX2
+static int swt__filter_results_avx2(const SWTResults *results, int start,
+                                    const SWTFilterBounds *bounds,
+                                    int *indices) {
+  const __m256 maxConfidence = _mm256_set1_ps(bounds->maxConfidence);
+  const __m256 maxVariation = _mm256_set1_ps(bounds->maxVariation);
+  const __m256 maxAspect = _mm256_set1_ps(bounds->maxAspect);
+  const __m256i minArea = _mm256_set1_epi32(bounds->minArea);
+  const __m256i maxArea = _mm256_set1_epi32(bounds->maxArea);
+  const __m256i minHeight = _mm256_set1_epi32(bounds->minHeight);
+  const __m256i maxHeight = _mm256_set1_epi32(bounds->maxHeight);
+  int count = 0, i = start;
+
+  for (; i + 8 <= results->itemCount; i += 8) {
+    __m256i area = _mm256_loadu_si256((const __m256i *)(results->areas + i));
+    __m256i height = _mm256_loadu_si256((const __m256i *)(results->heights + i));
+    __m256i width = _mm256_loadu_si256((const __m256i *)(results->widths + i));
+
+    __m256 keep = _mm256_and_ps(
+        _mm256_cmp_ps(_mm256_loadu_ps(results->confidences + i), maxConfidence, _CMP_LE_OQ),
+        _mm256_cmp_ps(_mm256_loadu_ps(results->variations + i), maxVariation, _CMP_LE_OQ));
+    keep = _mm256_and_ps(keep, _mm256_cmp_ps(_mm256_cvtepi32_ps(width),
+                                             _mm256_mul_ps(maxAspect, _mm256_cvtepi32_ps(height)),
+                                             _CMP_LE_OQ));
+    __m256i outside = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpgt_epi32(minArea, area), _mm256_cmpgt_epi32(area, maxArea)),
+        _mm256_or_si256(_mm256_cmpgt_epi32(minHeight, height),
+                        _mm256_cmpgt_epi32(height, maxHeight)));
+    keep = _mm256_andnot_ps(_mm256_castsi256_ps(outside), keep);
+
+    for (unsigned mask = (unsigned)_mm256_movemask_ps(keep); mask; mask &= mask - 1) {
+      indices[count++] = i + __builtin_ctz(mask);
     }
   }
 
-  node.magnitude =
-      sqrt(node.gradientX * node.gradientX + node.gradientY * node.gradientY);
-  node.direction = atan2(node.gradientY, node.gradientX);
+  return count + swt__filter_results_sse2(results, i, bounds, indices + count);
+}
 
-  return node;
+static const SWTKernels swt__kernels_avx2 = {
+    "avx2",
+    swt__grayscale_avx2,
+    swt__threshold_avx2,
+    swt__histogram_scalar,
+    swt__sobel_row_avx2,
+    swt__find_foreground_avx2,
+    swt__downsample_row_avx2,
+    swt__count_changes_avx2,
+    swt__filter_results_avx2,
+};
+
+SWT__TARGET_AVX512
+static void swt__threshold_avx512(uint8_t *bytes, int count, int threshold) {
+  const __m512i limit = _mm512_set1_epi8((char)threshold);
+  const __m512i black = _mm512_set1_epi8((char)SWT_CLR_BLACK);
+  const __m512i white = _mm512_set1_epi8((char)SWT_CLR_WHITE);
+  int i = 0;
+
+  for (; i + 64 <= count; i += 64) {
+    __m512i v = _mm512_loadu_si512((const void *)(bytes + i));
+    __mmask64 above = _mm512_cmpgt_epu8_mask(v, limit);
+    _mm512_storeu_si512((void *)(bytes + i), _mm512_mask_blend_epi8(above, white, black));
+  }
+
+  // the tail is done with a masked load/store instead of a scalar loop
+  if (i < count) {
+    __mmask64 tail = _bzhi_u64(~0ULL, (unsigned)(count - i));
+    __m512i v = _mm512_maskz_loadu_epi8(tail, bytes + i);
+    __mmask64 above = _mm512_cmpgt_epu8_mask(v, limit);
+    _mm512_mask_storeu_epi8(bytes + i, tail, _mm512_mask_blend_epi8(above, white, black));
+  }
 }
 
+SWT__TARGET_AVX512
+static void swt__sobel_row_avx512(const uint8_t *above, const uint8_t *row,
+                                  const uint8_t *below, int count,
+                                  int16_t *gradientX, int16_t *gradientY) {
+  int x = 0;
+
+#define SWT__LOAD32(p) _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(p)))
+  for (; x + 32 <= count; x += 32) {
+    __m512i al = SWT__LOAD32(above + x - 1), ac = SWT__LOAD32(above + x),
+            ar = SWT__LOAD32(above + x + 1);
+    __m512i rl = SWT__LOAD32(row + x - 1), rr = SWT__LOAD32(row + x + 1);
+    __m512i bl = SWT__LOAD32(below + x - 1), bc = SWT__LOAD32(below + x),
+            br = SWT__LOAD32(below + x + 1);
+
+    __m512i dr = _mm512_sub_epi16(rr, rl);
+    __m512i gx = _mm512_add_epi16(_mm512_add_epi16(_mm512_sub_epi16(ar, al), _mm512_sub_epi16(br, bl)),
+                                  _mm512_add_epi16(dr, dr));
+    __m512i top = _mm512_add_epi16(_mm512_add_epi16(al, ar), _mm512_add_epi16(ac, ac));
+    __m512i bottom = _mm512_add_epi16(_mm512_add_epi16(bl, br), _mm512_add_epi16(bc, bc));
+
+    _mm512_storeu_si512((void *)(gradientX + x), gx);
+    _mm512_storeu_si512((void *)(gradientY + x), _mm512_sub_epi16(bottom, top));
+  }
+#undef SWT__LOAD32
 
-SWTDEF uint8_t swt_compute_otsu_threshold(SWTImage *image) {
-    if (image == NULL) {
-        return 0;
-    }
+  swt__sobel_row_avx2(above + x, row + x, below + x, count - x,
+                      gradientX + x, gradientY + x);
+}
 
-    int histogram[256] = {0};
-    int totalPixels = image->width * image->height;
+SWT__TARGET_AVX512
+static int swt__find_foreground_avx512(const uint8_t *row, int start,
+                                       int end) {
+  const __m512i black = _mm512_set1_epi8((char)SWT_CLR_BLACK);
 
-    // Calculate histogram
-    for (int i = 0; i < totalPixels; i++) {
-        int pixelValue = image->bytes[i];
-        histogram[pixelValue]++;
+  for (; start + 64 <= end; start += 64) {
+    __m512i v = _mm512_loadu_si512((const void *)(row + start));
+    __mmask64 foreground = _mm512_cmpneq_epi8_mask(v, black);
+    if (foreground) {
+      return start + (int)__builtin_ctzll(foreground);
     }
+  }
 
-    float sum = 0;
-    for (int i = 0; i < 256; i++) {
-        sum += i * histogram[i];
-    }
+  return swt__find_foreground_avx2(row, start, end);
+}
 
-    int sumB = 0;
-    int wB = 0;
-    int wF = 0;
+SWT__TARGET_AVX512
+static __m512i swt__box32_avx512(const uint8_t *top, const uint8_t *bottom) {
+  const __m512i low = _mm512_set1_epi16(0x00ff);
+  __m512i t = _mm512_loadu_si512((const void *)top);
+  __m512i b = _mm512_loadu_si512((const void *)bottom);
+  __m512i sum = _mm512_add_epi16(
+      _mm512_add_epi16(_mm512_and_si512(t, low), _mm512_srli_epi16(t, 8)),
+      _mm512_add_epi16(_mm512_and_si512(b, low), _mm512_srli_epi16(b, 8)));
+  return _mm512_srli_epi16(_mm512_add_epi16(sum, _mm512_set1_epi16(2)), 2);
+}
 
-    float maxVariance = 0;
-    uint8_t threshold = 0;
+SWT__TARGET_AVX512
+static void swt__downsample_row_avx512(const uint8_t *top,
+                                       const uint8_t *bottom, uint8_t *out,
+                                       int count) {
+  const __m512i order = _mm512_set_epi64(7, 5, 3, 1, 6, 4, 2, 0);
+  int x = 0;
+
+  for (; x + 64 <= count; x += 64) {
+    __m512i packed = _mm512_packus_epi16(
+        swt__box32_avx512(top + 2 * x, bottom + 2 * x),
+        swt__box32_avx512(top + 2 * x + 64, bottom + 2 * x + 64));
+    _mm512_storeu_si512((void *)(out + x),
+                        _mm512_permutexvar_epi64(order, packed));
+  }
 
-    for (int t = 0; t < 256; t++) {
-        wB += histogram[t];
-        if (wB == 0) continue;
+  swt__downsample_row_avx2(top + 2 * x, bottom + 2 * x, out + x, count - x);
+}
 
-        wF = totalPixels - wB;
-        if (wF == 0) break;
+SWT__TARGET_AVX512
+static int swt__count_changes_avx512(const uint8_t *a, const uint8_t *b,
+                                     int count) {
+  int changes = 0, i = 0;
 
-        sumB += t * histogram[t];
-        float meanB = (float)sumB / wB;
-        float meanF = (float)(sum - sumB) / wF;
+  for (; i + 64 <= count; i += 64) {
+    __m512i x = _mm512_xor_si512(_mm512_loadu_si512((const void *)(a + i)),
+                                 _mm512_loadu_si512((const void *)(b + i)));
+    changes += (int)__builtin_popcountll(_mm512_test_epi8_mask(x, x));
+  }
 
-        float varianceBetween = wB * wF * (meanB - meanF) * (meanB - meanF);
+  return changes + swt__count_changes_avx2(a + i, b + i, count - i);
+}
 
-        if (varianceBetween > maxVariance) {
-            maxVariance = varianceBetween;
-            threshold = t;
-        }
-    }
+// The compare masks go straight into a compress store of the row numbers,
+// which packs the kept ones together without a loop over the bits
+SWT__TARGET_AVX512
+static int swt__filter_results_avx512(const SWTResults *results, int start,
+                                      const SWTFilterBounds *bounds,
+                                      int *indices) {
+  const __m512 maxConfidence = _mm512_set1_ps(bounds->maxConfidence);
+  const __m512 maxVariation = _mm512_set1_ps(bounds->maxVariation);
+  const __m512 maxAspect = _mm512_set1_ps(bounds->maxAspect);
+  const __m512i minArea = _mm512_set1_epi32(bounds->minArea);
+  const __m512i maxArea = _mm512_set1_epi32(bounds->maxArea);
+  const __m512i minHeight = _mm512_set1_epi32(bounds->minHeight);
+  const __m512i maxHeight = _mm512_set1_epi32(bounds->maxHeight);
+  const __m512i lanes = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  int count = 0, i = start;
+
+  for (; i + 16 <= results->itemCount; i += 16) {
+    __m512i area = _mm512_loadu_si512((const void *)(results->areas + i));
+    __m512i height = _mm512_loadu_si512((const void *)(results->heights + i));
+    __m512i width = _mm512_loadu_si512((const void *)(results->widths + i));
+
+    __mmask16 keep =
+        _mm512_cmp_ps_mask(_mm512_loadu_ps(results->confidences + i), maxConfidence, _CMP_LE_OQ);
+    keep = _mm512_mask_cmp_ps_mask(keep, _mm512_loadu_ps(results->variations + i),
+                                   maxVariation, _CMP_LE_OQ);
+    keep = _mm512_mask_cmp_ps_mask(keep, _mm512_cvtepi32_ps(width),
+                                   _mm512_mul_ps(maxAspect, _mm512_cvtepi32_ps(height)),
+                                   _CMP_LE_OQ);
+    keep = _mm512_mask_cmpge_epi32_mask(keep, area, minArea);
+    keep = _mm512_mask_cmple_epi32_mask(keep, area, maxArea);
+    keep = _mm512_mask_cmpge_epi32_mask(keep, height, minHeight);
+    keep = _mm512_mask_cmple_epi32_mask(keep, height, maxHeight);
+
+    _mm512_mask_compressstoreu_epi32(indices + count, keep,
+                                     _mm512_add_epi32(_mm512_set1_epi32(i), lanes));
+    count += __builtin_popcount(keep);
+  }
 
-    return threshold;
+  return count + swt__filter_results_avx2(results, i, bounds, indices + count);
 }
 
+// RGB de-interleaving doesn't widen well past 128 bits, so grayscale keeps
+// the AVX2 variant
+static const SWTKernels swt__kernels_avx512 = {
+    "avx512",
+    swt__grayscale_avx2,
+    swt__threshold_avx512,
+    swt__histogram_scalar,
+    swt__sobel_row_avx512,
+    swt__find_foreground_avx512,
+    swt__downsample_row_avx512,
+    swt__count_changes_avx512,
+    swt__filter_results_avx512,
+};
+
+#endif // SWT__X86
+
+static const SWTKernels *swt__kernels = &swt__kernels_scalar;
+
+// Fills `supported` with the kernels the CPU can run, best last, and returns
+// how many there are
+static int swt__supported_kernels(const SWTKernels *supported[4]) {
+  int count = 0;
+
+  supported[count++] = &swt__kernels_scalar;
+#ifdef SWT__X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    supported[count++] = &swt__kernels_sse2;
+    if (__builtin_cpu_supports("avx2")) {
+      supported[count++] = &swt__kernels_avx2;
+      if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+          __builtin_cpu_supports("bmi2")) {
+        supported[count++] = &swt__kernels_avx512;
+      }
+    }
+  }
+#endif
 
-static int swt__qsort_compare(const void *a, const void *b) {
-  return (*(int *)a - *(int *)b);
+  return count;
 }
 
-static float swt__median(int *nums, int len) {
-  qsort(nums, len, sizeof(int), swt__qsort_compare);
+static const SWTKernels *swt__select_kernels(void) {
+  const SWTKernels *supported[4];
+  int count = swt__supported_kernels(supported);
 
-  const float half = len / 2.0;
-  if (len % 2 == 0)
-    return (nums[(int)half - 1] + nums[(int)half]) / 2.0;
+  const char *forced = getenv("SWT_FORCE_ISA");
+  if (forced != NULL) {
+    for (int i = count - 1; i >= 0; i--) {
+      if (strcmp(forced, supported[i]->name) == 0) {
+        return supported[i];
+      }
+    }
+  }
 
-  return nums[(int)half];
+  return supported[count - 1];
 }
 
-SWTDEF int swt_compute_stroke_width_for_component(SWTImage *image, SWTComponent *currentComponent) {
-    SWT_ASSERT(image->channels == 1 && "swt_compute_stroke_width_for_component expects a BINARY image");
-    int *strokes = (int *)malloc(sizeof(int) * currentComponent->pointCount);
-    SWT_IF_NO_MEMORY_EXIT(strokes);
+// Resolution of the tan -> angle table, ie. how finely the ratio of the
+// smaller to the larger gradient component is sampled within an octant
+#define SWT__ATAN_RESOLUTION 1024
 
-    int strokeCount = 0;
-    int maxDistance = (int)(image->width * image->height) / 4;
+// A ray direction as a 16.16 fixed point step, advancing the ray by one pixel
+// length per iteration (a DDA without any per step float math)
+typedef struct {
+  int32_t stepX;
+  int32_t stepY;
+} SWTDirection;
+
+static int swt__tables_ready = 0;
+static uint16_t swt__octant_angles[SWT__ATAN_RESOLUTION + 1];
+static SWTDirection swt__directions[SWT_DIRECTIONS];
+// each byte of a 1 bit bitmap expanded into 8 mask bytes
+static uint8_t swt__bit_expansion[256][8];
+
+SWTDEF void swt_init_tables(void) {
+  if (swt__tables_ready) {
+    return;
+  }
 
-    for (int j = 0; j < currentComponent->pointCount; j++) {
-        SWTSobelNode sobelNode = swt_compute_sobel_for_point(image, currentComponent->points[j]);
+  const double pi = 3.14159265358979323846;
+  const int octant = SWT_DIRECTIONS / 8;
 
-        int distancePositive = 0;
+  for (int i = 0; i <= SWT__ATAN_RESOLUTION; i++) {
+    double angle = atan((double)i / SWT__ATAN_RESOLUTION);
+    swt__octant_angles[i] = (uint16_t)floor(angle / (pi / 4) * octant + 0.5);
+  }
 
-        int xx = currentComponent->points[j].x;
-        int yy = currentComponent->points[j].y;
+  for (int d = 0; d < SWT_DIRECTIONS; d++) {
+    double angle = 2 * pi * d / SWT_DIRECTIONS;
+    swt__directions[d].stepX = (int32_t)floor(cos(angle) * 65536 + 0.5);
+    swt__directions[d].stepY = (int32_t)floor(sin(angle) * 65536 + 0.5);
+  }
 
-        float step_x = cos(sobelNode.direction);
-        float step_y = sin(sobelNode.direction);
+  for (int v = 0; v < 256; v++) {
+    for (int b = 0; b < 8; b++) {
+      swt__bit_expansion[v][b] = (v & (0x80 >> b)) ? SWT_CLR_WHITE : SWT_CLR_BLACK;
+    }
+  }
 
-        for (int i = 0; i < maxDistance; i++) {
-            int x = xx + (int)(i * step_x);
-            int y = yy + (int)(i * step_y);
+  swt__kernels = swt__select_kernels();
+  swt__tables_ready = 1;
+}
 
-            if (x < 0 || x >= image->width || y < 0 || y >= image->height) {
-                break;
-            }
-            if (image->bytes[y * image->width + x] == SWT_CLR_BLACK) {
-                break;
-            }
+SWTDEF const char *swt_get_isa(void) {
+  swt_init_tables();
+  return swt__kernels->name;
+}
 
-            distancePositive++;
-        }
+// Equivalent of atan2(gy, gx) quantized to SWT_DIRECTIONS steps, folding the
+// gradient into the first octant so a single small table covers every angle
+static inline int swt__quantize_direction(int gx, int gy) {
+  int ax = gx < 0 ? -gx : gx;
+  int ay = gy < 0 ? -gy : gy;
 
-        strokes[strokeCount] = distancePositive;
-        strokeCount++;
-    }
+  if (ax == 0 && ay == 0) {
+    return 0;
+  }
 
-    int median = swt__median(strokes, strokeCount);
-    free(strokes);
+  int angle;
+  if (ax >= ay) {
+    angle = swt__octant_angles[(ay * SWT__ATAN_RESOLUTION) / ax];
+  } else {
+    angle = SWT_DIRECTIONS / 4 -
+            swt__octant_angles[(ax * SWT__ATAN_RESOLUTION) / ay];
+  }
 
-    return median;
+  if (gx < 0) angle = SWT_DIRECTIONS / 2 - angle;
+  if (gy < 0) angle = SWT_DIRECTIONS - angle;
+
+  return angle & (SWT_DIRECTIONS - 1);
 }
 
-SWTDEF void swt_apply_stroke_width_transform(SWTImage *image,
-                                             SWTComponents *components,
-                                             SWTResults *results) {
-  swt_apply_grayscale(image);
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 
-  /* This makes the logic for visualization needlessly complex since gray and black don't contrast well
-    SWTImage binaryImage;
-    binaryImage.width = image->width;
-    binaryImage.height = image->height;
-    binaryImage.channels = image->channels;
-    binaryImage.bytes = (uint8_t *)malloc(sizeof(uint8_t) * image->width * image->height * image->channels);
-    memcpy(binaryImage.bytes, image->bytes, sizeof(uint8_t) * image->width * image->height * image->channels);
-  */
+// monotonic clock for the stats and the time budgets
+static double swt__now_ms(void) {
+#ifdef _WIN32
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (double)counter.QuadPart * 1000.0 / (double)frequency.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+#endif
+}
 
-  // threshold is inverted such that WHITE is the foreground
-  swt_apply_threshold(image, SWT_THRESHOLD);
+SWTDEF double swt_now_ms(void) { return swt__now_ms(); }
 
-  swt_connected_component_analysis(image, components);
+// Sets results->status and returns it once the deadline passed or the run was
+// cancelled, so callers can bail out with whatever they have so far
+static int swt__should_stop(SWTResults *results) {
+  if (results == NULL) {
+    return 0;
+  }
+  if (results->status == SWT_STATUS_OK) {
+    if (results->cancel != NULL && *results->cancel) {
+      results->status = SWT_STATUS_CANCELLED;
+    } else if (results->deadlineMs > 0 && swt__now_ms() >= results->deadlineMs) {
+      results->status = SWT_STATUS_DEADLINE;
+    }
+  }
+  return results->status;
+}
 
-  for (int i = 0; i < components->itemCount; i++) {
-    results->items[i].component = &components->items[i];
-    results->items[i].confidence =
-        swt_compute_stroke_width_for_component(image, &components->items[i]);
-    //printf("confidence for component#%d is %f\n", i, results->items[i].confidence);
-    results->itemCount++;
+// An allocation failed, the run stops like it does for a deadline
+static void swt__out_of_memory(SWTResults *results) {
+  if (results != NULL && results->status == SWT_STATUS_OK) {
+    results->status = SWT_STATUS_NO_MEMORY;
   }
+}
 
-  // free(binaryImage.bytes);
+// Takes `bytes` out of the run's memory budget, 0 if they don't fit in what
+// is left of it. Without a budget (or results) everything fits.
+static int swt__budget_take(SWTResults *results, size_t bytes) {
+  if (results == NULL || results->memoryBudget == 0) {
+    return 1;
+  }
+  if (bytes > results->memoryBudget - results->memoryUsed) {
+    return 0;
+  }
+  results->memoryUsed += bytes;
+  return 1;
 }
 
+static void swt__budget_give(SWTResults *results, size_t bytes) {
+  if (results != NULL && results->memoryBudget != 0) {
+    results->memoryUsed -= bytes;
+  }
+}
 
-#pragma GCC diagnostic ignored "-Wunused-function"
+static void swt__degrade(SWTResults *results, int what) {
+  if (results != NULL) {
+    results->degraded |= what;
+  }
+}
+
+#ifndef SWT_NO_STATS
+
+static void swt__stats_alloc(SWTStats *stats, long long bytes, int scratch) {
+  stats->allocations++;
+  stats->allocatedBytes += bytes;
+  if (scratch) {
+    stats->scratchBytes += bytes;
+    if (stats->scratchBytes > stats->peakScratchBytes) {
+      stats->peakScratchBytes = stats->scratchBytes;
+    }
+  }
+}
+
+#define SWT__STATS_ADD(stats, field, amount)                                   \
+  do {                                                                         \
+    if (stats) (stats)->field += (amount);                                     \
+  } while (0)
+// scratch buffers are freed again before the stage returns, output buffers
+// (eg. component points) are not
+#define SWT__STATS_ALLOC(stats, bytes, scratch)                                \
+  do {                                                                         \
+    if (stats) swt__stats_alloc((stats), (long long)(bytes), (scratch));       \
+  } while (0)
+#define SWT__STATS_FREE(stats, bytes)                                          \
+  do {                                                                         \
+    if (stats) (stats)->scratchBytes -= (long long)(bytes);                    \
+  } while (0)
+#define SWT__STATS_CLOCK(clock, stats)                                         \
+  double clock = (stats) ? swt__now_ms() : 0
+// adds the time since `clock` to `field` and restarts the clock
+#define SWT__STATS_LAP(stats, field, clock)                                    \
+  do {                                                                         \
+    if (stats) {                                                               \
+      double now = swt__now_ms();                                              \
+      (stats)->field += now - (clock);                                         \
+      (clock) = now;                                                           \
+    }                                                                          \
+  } while (0)
+
+#else
+
+#define SWT__STATS_ADD(stats, field, amount) ((void)0)
+#define SWT__STATS_ALLOC(stats, bytes, scratch) ((void)0)
+#define SWT__STATS_FREE(stats, bytes) ((void)0)
+#define SWT__STATS_CLOCK(clock, stats) ((void)0)
+#define SWT__STATS_LAP(stats, field, clock) ((void)0)
+
+#endif // SWT_NO_STATS
+
+// `results` is only used for its stats and to stop early, it may be NULL
+// count * size, or SIZE_MAX when that doesn't fit so the allocation fails
+// instead of coming back too small
+static size_t swt__array_size(size_t count, size_t size) {
+  return size != 0 && count > SIZE_MAX / size ? SIZE_MAX : count * size;
+}
+
+// Everything is allocated through these, `allocator` may be NULL
+static void *swt__malloc(const SWTAllocator *allocator, size_t size) {
+  return allocator ? allocator->malloc(size, allocator->user) : SWT_MALLOC(size);
+}
+
+static void *swt__realloc(const SWTAllocator *allocator, void *ptr, size_t size) {
+  return allocator ? allocator->realloc(ptr, size, allocator->user)
+                   : SWT_REALLOC(ptr, size);
+}
+
+static void swt__free(const SWTAllocator *allocator, void *ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  if (allocator) {
+    allocator->free(ptr, allocator->user);
+  } else {
+    SWT_FREE(ptr);
+  }
+}
+
+static void *swt__calloc(const SWTAllocator *allocator, size_t count, size_t size) {
+#ifdef SWT__CALLOC
+  if (allocator == NULL) {
+    return SWT__CALLOC(count, size);
+  }
+#endif
+  size_t bytes = swt__array_size(count, size);
+  void *ptr = swt__malloc(allocator, bytes);
+  if (ptr != NULL) {
+    memset(ptr, 0, bytes);
+  }
+  return ptr;
+}
+
+// Room set aside up front for the components of an image of `size` pixels.
+// Every component has at least two pixels; past the cap the arrays grow when
+// they fill up, so huge mostly empty images don't reserve gigabytes.
+#define SWT__INITIAL_CAPACITY (1 << 20)
+
+static int swt__initial_capacity(size_t size) {
+  return size / 2 + 1 < SWT__INITIAL_CAPACITY ? (int)(size / 2 + 1) : SWT__INITIAL_CAPACITY;
+}
+
+// Makes room for at least `count` components, 0 if that can't be had. The
+// array moves when it grows, so the results pointing into it (`results` may
+// be NULL) are moved along; the growth counts against their memory budget.
+static int swt__reserve_components(SWTComponents *components,
+                                   SWTResults *results, int count) {
+  if (count <= components->capacity) {
+    return 1;
+  }
+
+  int capacity = components->capacity;
+  while (capacity < count) {
+    capacity = capacity > INT_MAX / 2 ? INT_MAX : capacity * 2;
+  }
+
+  size_t growth = (size_t)(capacity - components->capacity) * sizeof(SWTComponent);
+  if (!swt__budget_take(results, growth)) {
+    return 0;
+  }
+  SWTComponent *items =
+      (SWTComponent *)swt__malloc(components->allocator, swt__array_size(capacity, sizeof(SWTComponent)));
+  if (items == NULL) {
+    swt__budget_give(results, growth);
+    return 0;
+  }
+  memcpy(items, components->items, components->itemCount * sizeof(SWTComponent));
+
+  for (int i = 0; results != NULL && i < results->itemCount; i++) {
+    SWTComponent *component = results->components[i];
+    if (component >= components->items &&
+        component < components->items + components->itemCount) {
+      results->components[i] = items + (component - components->items);
+    }
+  }
+
+  swt__free(components->allocator, components->items);
+  components->items = items;
+  components->capacity = capacity;
+  return 1;
+}
+
+// Appends a component, see swt__reserve_components. Returns NULL if there
+// was no room, the points are then still the caller's.
+static SWTComponent *swt__add_component(SWTComponents *components,
+                                        SWTResults *results,
+                                        SWTComponent component) {
+  if (!swt__reserve_components(components, results, components->itemCount + 1)) {
+    return NULL;
+  }
+  components->items[components->itemCount] = component;
+  return &components->items[components->itemCount++];
+}
+
+// Flood fill queues start out with room for this many points
+#define SWT__QUEUE_START 1024
+
+static inline int swt__bit_test(const uint64_t *bits, size_t index) {
+  return (int)((bits[index >> 6] >> (index & 63)) & 1);
+}
+
+static inline void swt__bit_set(uint64_t *bits, size_t index) {
+  bits[index >> 6] |= (uint64_t)1 << (index & 63);
+}
+
+// Doubles a flood fill queue, or returns NULL and leaves it as it is. A
+// component can't have more than INT_MAX points, one that would is treated
+// like running out of memory.
+static SWTPoint *swt__grow_queue(const SWTAllocator *allocator, SWTPoint *queue,
+                                 int *capacity) {
+  if (*capacity > INT_MAX / 2) {
+    return NULL;
+  }
+  SWTPoint *grown =
+      (SWTPoint *)swt__realloc(allocator, queue, swt__array_size(*capacity * 2, sizeof(SWTPoint)));
+  if (grown != NULL) {
+    *capacity *= 2;
+  }
+  return grown;
+}
+
+// A run of foreground pixels [x0, x1) on row y
+typedef struct {
+  int y;
+  int x0;
+  int x1;
+} SWTSpan;
+
+// Scanline flood fill. Whole runs of pixels are filled at once and only one
+// seed per run touching a filled span goes on the stack, so the stack is
+// bounded by the spans of a component rather than its pixels. The buffers
+// are kept from one component to the next.
+typedef struct {
+  SWTPoint *stack;
+  int stackCapacity;
+  SWTSpan *spans; // of the component filled last, in fill order
+  int spanCount;
+  int spanCapacity;
+  size_t area;  // pixels in those spans
+  size_t bytes; // allocated for the stack and spans
+} SWTFloodFill;
+
+#define SWT__FILL_OK 0
+#define SWT__FILL_SKIPPED 1 // flooded, but its spans didn't all fit
+#define SWT__FILL_FAILED 2  // out of memory with the component half flooded
+
+// Both buffers start at SWT__QUEUE_START entries, 0 without memory
+static int swt__flood_fill_init(SWTFloodFill *fill, SWTResults *results,
+                                const SWTAllocator *allocator) {
+  memset(fill, 0, sizeof(*fill));
+  size_t bytes = SWT__QUEUE_START * (sizeof(SWTPoint) + sizeof(SWTSpan));
+  if (!swt__budget_take(results, bytes)) {
+    return 0;
+  }
+  fill->stack = (SWTPoint *)swt__malloc(allocator, SWT__QUEUE_START * sizeof(SWTPoint));
+  fill->spans = (SWTSpan *)swt__malloc(allocator, SWT__QUEUE_START * sizeof(SWTSpan));
+  if (fill->stack == NULL || fill->spans == NULL) {
+    swt__free(allocator, fill->stack);
+    swt__free(allocator, fill->spans);
+    swt__budget_give(results, bytes);
+    return 0;
+  }
+  fill->stackCapacity = fill->spanCapacity = SWT__QUEUE_START;
+  fill->bytes = bytes;
+  SWT__STATS_ALLOC(results ? results->stats : NULL, bytes, 1);
+  return 1;
+}
+
+static void swt__flood_fill_free(SWTFloodFill *fill, SWTResults *results,
+                                 const SWTAllocator *allocator) {
+  swt__free(allocator, fill->stack);
+  swt__free(allocator, fill->spans);
+  swt__budget_give(results, fill->bytes);
+  SWT__STATS_FREE(results ? results->stats : NULL, fill->bytes);
+}
+
+// Doubles the stack or the span list, 0 if the budget or the allocator
+// refuse
+static int swt__grow_fill(SWTFloodFill *fill, int spans, SWTResults *results,
+                          const SWTAllocator *allocator) {
+  int capacity = spans ? fill->spanCapacity : fill->stackCapacity;
+  size_t growth = capacity * (spans ? sizeof(SWTSpan) : sizeof(SWTPoint));
+  if (capacity > INT_MAX / 2 || !swt__budget_take(results, growth)) {
+    return 0;
+  }
+
+  void *grown;
+  if (spans) {
+    grown = swt__realloc(allocator, fill->spans, swt__array_size(capacity * 2, sizeof(SWTSpan)));
+    if (grown != NULL) {
+      fill->spans = (SWTSpan *)grown;
+      fill->spanCapacity *= 2;
+    }
+  } else {
+    grown = swt__grow_queue(allocator, fill->stack, &fill->stackCapacity);
+    if (grown != NULL) {
+      fill->stack = (SWTPoint *)grown;
+    }
+  }
+
+  if (grown == NULL) {
+    swt__budget_give(results, growth);
+    return 0;
+  }
+  fill->bytes += growth;
+  SWT__STATS_ALLOC(results ? results->stats : NULL, growth, 1);
+  return 1;
+}
+
+// Pushes a seed for each run of unfilled foreground on row y within [x0, x1),
+// 0 if the stack can't grow
+static inline int swt__push_runs(SWTFloodFill *fill, int *top, const SWTImage *image,
+                                 const uint64_t *visited, int y, int x0, int x1,
+                                 SWTResults *results, const SWTAllocator *allocator) {
+  size_t base = (size_t)y * image->width;
+  const uint8_t *row = image->bytes + base;
+  int inRun = 0;
+  for (int i = x0; i < x1; i++) {
+    int open = row[i] != SWT_CLR_BLACK && !swt__bit_test(visited, base + i);
+    if (open && !inRun) {
+      if (*top == fill->stackCapacity && !swt__grow_fill(fill, 0, results, allocator)) {
+        return 0;
+      }
+      fill->stack[*top].x = i;
+      fill->stack[*top].y = y;
+      (*top)++;
+    }
+    inRun = open;
+  }
+  return 1;
+}
+
+// Floods the component of foreground pixels at (x, y), which must be its
+// first pixel in scan order, marking it in `visited`. Its first span starts
+// at that pixel. `reach` is 0 for 4-connectivity and 1 for 8, where the rows
+// above and below are also scanned one pixel past each end of a span.
+static inline int swt__flood_fill_reach(SWTFloodFill *fill, const SWTImage *image,
+                                        uint64_t *visited, int x, int y,
+                                        SWTResults *results,
+                                        const SWTAllocator *allocator, const int reach) {
+  int width = image->width, height = image->height;
+  const uint8_t *data = image->bytes;
+  int status = SWT__FILL_OK, top = 0;
+
+  fill->spanCount = 0;
+  fill->area = 0;
+  fill->stack[top].x = x;
+  fill->stack[top].y = y;
+  top++;
+
+  while (top > 0) {
+    SWTPoint seed = fill->stack[--top];
+    size_t base = (size_t)seed.y * width;
+    const uint8_t *row = data + base;
+    // seeds can be filled over by another span before they come up
+    if (swt__bit_test(visited, base + seed.x)) continue;
+
+    int x0 = seed.x, x1 = seed.x + 1;
+    while (x0 > 0 && row[x0 - 1] != SWT_CLR_BLACK && !swt__bit_test(visited, base + x0 - 1)) x0--;
+    while (x1 < width && row[x1] != SWT_CLR_BLACK && !swt__bit_test(visited, base + x1)) x1++;
+    for (int i = x0; i < x1; i++) {
+      swt__bit_set(visited, base + i);
+    }
+    fill->area += x1 - x0;
+
+    if (status == SWT__FILL_OK) {
+      if (fill->spanCount == fill->spanCapacity &&
+          !swt__grow_fill(fill, 1, results, allocator)) {
+        status = SWT__FILL_SKIPPED;
+      } else {
+        fill->spans[fill->spanCount++] = (SWTSpan){seed.y, x0, x1};
+      }
+    }
+
+    // one seed for each run of unfilled foreground above and below the span
+    int from = x0 - reach > 0 ? x0 - reach : 0;
+    int to = x1 + reach < width ? x1 + reach : width;
+    if ((seed.y > 0 &&
+         !swt__push_runs(fill, &top, image, visited, seed.y - 1, from, to, results, allocator)) ||
+        (seed.y + 1 < height &&
+         !swt__push_runs(fill, &top, image, visited, seed.y + 1, from, to, results, allocator))) {
+      return SWT__FILL_FAILED;
+    }
+  }
+
+  return status;
+}
+
+#ifdef SWT_CONNECTIVITY
+#define SWT__CONNECTIVITY(requested) ((void)(requested), SWT_CONNECTIVITY)
+#else
+#define SWT__CONNECTIVITY(requested) ((requested) == 4 ? 4 : 8)
+#endif
+
+static int swt__flood_fill4(SWTFloodFill *fill, const SWTImage *image,
+                            uint64_t *visited, int x, int y,
+                            SWTResults *results, const SWTAllocator *allocator) {
+  return swt__flood_fill_reach(fill, image, visited, x, y, results, allocator, 0);
+}
+
+static int swt__flood_fill8(SWTFloodFill *fill, const SWTImage *image,
+                            uint64_t *visited, int x, int y,
+                            SWTResults *results, const SWTAllocator *allocator) {
+  return swt__flood_fill_reach(fill, image, visited, x, y, results, allocator, 1);
+}
+
+// Picks the fill for a connectivity. With SWT_CONNECTIVITY defined the choice
+// is a constant and the other one is never called.
+static inline int swt__flood_fill(SWTFloodFill *fill, const SWTImage *image,
+                                  uint64_t *visited, int x, int y, int connectivity,
+                                  SWTResults *results, const SWTAllocator *allocator) {
+  if (SWT__CONNECTIVITY(connectivity) == 8) {
+    return swt__flood_fill8(fill, image, visited, x, y, results, allocator);
+  }
+  return swt__flood_fill4(fill, image, visited, x, y, results, allocator);
+}
+
+static void swt__connected_component_analysis(SWTImage *image,
+                                              SWTComponents *components,
+                                              SWTResults *results) {
+  SWTStats *stats = results ? results->stats : NULL;
+  (void)stats;
+  int width = image->width, height = image->height;
+  uint8_t *data = image->bytes;
+  SWT_ASSERT(width <= SWT_MAX_DIMENSION && height <= SWT_MAX_DIMENSION &&
+             "the image is too large for SWT_COMPACT_POINTS");
+
+  // one bit per pixel, and fill buffers that grow with the most fragmented
+  // component, so the scratch stays small next to the image even at gigapixel
+  // sizes
+  size_t visitedWords = ((size_t)width * height + 63) / 64;
+  size_t visitedBytes = visitedWords * sizeof(uint64_t);
+  if (!swt__budget_take(results, visitedBytes)) {
+    swt__out_of_memory(results);
+    return;
+  }
+
+  SWTFloodFill fill;
+  uint64_t *visited = (uint64_t *)swt__calloc(components->allocator, visitedWords, sizeof(uint64_t));
+  if (visited == NULL || !swt__flood_fill_init(&fill, results, components->allocator)) {
+    swt__free(components->allocator, visited);
+    swt__budget_give(results, visitedBytes);
+    swt__out_of_memory(results);
+    return;
+  }
+  SWT__STATS_ALLOC(stats, visitedBytes, 1);
+
+  swt_init_tables();
+
+  int failed = 0;
+  for (int i = 0; i < height && !failed; i++) {
+    if ((i & 63) == 0 && swt__should_stop(results)) {
+      break;
+    }
+
+    const uint8_t *row = data + (size_t)i * width;
+    for (int j = 0; j < width; j++) {
+      // skip whole background runs at once
+      j = swt__kernels->find_foreground(row, j, width);
+      if (j == width)
+        break;
+      if (swt__bit_test(visited, (size_t)i * width + j))
+        continue;
+
+      int status = swt__flood_fill(&fill, image, visited, j, i, components->connectivity,
+                                   results, components->allocator);
+      if (status == SWT__FILL_FAILED) {
+        swt__out_of_memory(results);
+        failed = 1;
+        break;
+      }
+      // Lone pixels are dropped as noise
+      if (fill.area < 2) {
+        continue;
+      }
+      if (status == SWT__FILL_SKIPPED || fill.area > INT_MAX) {
+        swt__degrade(results, SWT_DEGRADED_SKIPPED);
+        continue;
+      }
+
+      // the points are written straight from the spans, once
+      size_t bytes = fill.area * sizeof(SWTPoint);
+      if (!swt__budget_take(results, bytes)) {
+        swt__degrade(results, SWT_DEGRADED_SKIPPED);
+        continue;
+      }
+
+      SWTComponent currentComponent;
+      currentComponent.pointCount = (int)fill.area;
+      currentComponent.points = (SWTPoint *)swt__malloc(components->allocator, bytes);
+      if (currentComponent.points == NULL ||
+          swt__add_component(components, results, currentComponent) == NULL) {
+        swt__free(components->allocator, currentComponent.points);
+        swt__budget_give(results, bytes);
+        swt__out_of_memory(results);
+        failed = 1;
+        break;
+      }
+
+      SWTPoint *point = currentComponent.points;
+      for (int s = 0; s < fill.spanCount; s++) {
+        for (int x = fill.spans[s].x0; x < fill.spans[s].x1; x++, point++) {
+          point->x = x;
+          point->y = fill.spans[s].y;
+        }
+      }
+      SWT__STATS_ALLOC(stats, bytes, 0);
+      SWT__STATS_ADD(stats, foregroundPixels, fill.area);
+    }
+  }
+
+  swt__free(components->allocator, visited);
+  swt__flood_fill_free(&fill, results, components->allocator);
+  swt__budget_give(results, visitedBytes);
+  SWT__STATS_FREE(stats, visitedBytes);
+}
+
+SWTDEF void swt_connected_component_analysis(SWTImage *image,
+                                             SWTComponents *components) {
+  swt__connected_component_analysis(image, components, NULL);
+}
+
+static inline uint32_t swt__label_at(const SWTLabels *labels, size_t index) {
+  return labels->labels32 ? labels->labels32[index] : labels->labels16[index];
+}
+
+static inline void swt__set_label(SWTLabels *labels, size_t index, uint32_t label) {
+  if (labels->labels32) {
+    labels->labels32[index] = label;
+  } else {
+    labels->labels16[index] = (uint16_t)label;
+  }
+}
+
+// Makes room for one more label, moving to 32 bit labels past 65535. Returns
+// 0 if that can't be had.
+static int swt__reserve_label(SWTLabels *labels) {
+  if (labels->labelCount == 65535 && labels->labels32 == NULL) {
+    size_t size = (size_t)labels->width * labels->height;
+    uint32_t *wide = (uint32_t *)swt__malloc(labels->allocator, swt__array_size(size, sizeof(uint32_t)));
+    if (wide == NULL) {
+      return 0;
+    }
+    for (size_t i = 0; i < size; i++) {
+      wide[i] = labels->labels16[i];
+    }
+    swt__free(labels->allocator, labels->labels16);
+    labels->labels16 = NULL;
+    labels->labels32 = wide;
+  }
+
+  if (labels->labelCount == labels->capacity) {
+    if (labels->capacity > INT_MAX / 2) {
+      return 0;
+    }
+    SWTLabelStats *stats = (SWTLabelStats *)swt__realloc(labels->allocator,
+        labels->stats, swt__array_size(labels->capacity * 2, sizeof(SWTLabelStats)));
+    if (stats == NULL) {
+      return 0;
+    }
+    labels->stats = stats;
+    labels->capacity *= 2;
+  }
+  return 1;
+}
+
+// The same flood fill as swt__connected_component_analysis, with the labels
+// written from the spans instead of points
+SWTDEF SWTLabels *swt_label_components(const SWTImage *image, int connectivity,
+                                       const SWTAllocator *allocator) {
+  int width = image->width, height = image->height;
+  const uint8_t *data = image->bytes;
+
+  SWTLabels *labels = (SWTLabels *)swt__calloc(allocator, 1, sizeof(SWTLabels));
+  if (labels == NULL) {
+    return NULL;
+  }
+  labels->width = width;
+  labels->height = height;
+  labels->capacity = SWT__QUEUE_START;
+  labels->allocator = allocator;
+  labels->labels16 = (uint16_t *)swt__calloc(allocator, (size_t)width * height, sizeof(uint16_t));
+  labels->stats = (SWTLabelStats *)swt__malloc(allocator, labels->capacity * sizeof(SWTLabelStats));
+
+  SWTFloodFill fill;
+  uint64_t *visited = (uint64_t *)swt__calloc(allocator, ((size_t)width * height + 63) / 64, sizeof(uint64_t));
+  if (labels->labels16 == NULL || labels->stats == NULL || visited == NULL ||
+      !swt__flood_fill_init(&fill, NULL, allocator)) {
+    swt__free(allocator, visited);
+    swt_free_labels(labels);
+    return NULL;
+  }
+
+  swt_init_tables();
+
+  for (int i = 0; i < height && labels->status == SWT_STATUS_OK; i++) {
+    const uint8_t *row = data + (size_t)i * width;
+    for (int j = 0; j < width; j++) {
+      j = swt__kernels->find_foreground(row, j, width);
+      if (j == width)
+        break;
+      if (swt__bit_test(visited, (size_t)i * width + j))
+        continue;
+
+      // A fill that couldn't grow its stack is only partly visited and ends
+      // the scan, one that only lost its spans is whole and left unlabeled
+      int status = swt__flood_fill(&fill, image, visited, j, i, connectivity, NULL, allocator);
+      if (status == SWT__FILL_FAILED) {
+        labels->status = SWT_STATUS_NO_MEMORY;
+        break;
+      }
+      if (status == SWT__FILL_SKIPPED) {
+        labels->degraded |= SWT_DEGRADED_SKIPPED;
+        continue;
+      }
+      // Lone pixels are dropped as noise
+      if (fill.area < 2) {
+        continue;
+      }
+      if (fill.area > INT_MAX || !swt__reserve_label(labels)) {
+        labels->status = SWT_STATUS_NO_MEMORY;
+        break;
+      }
+
+      uint32_t label = (uint32_t)labels->labelCount + 1;
+      int minX = j, maxX = j, minY = i, maxY = i;
+      for (int s = 0; s < fill.spanCount; s++) {
+        SWTSpan span = fill.spans[s];
+        size_t base = (size_t)span.y * width;
+        for (int x = span.x0; x < span.x1; x++) {
+          swt__set_label(labels, base + x, label);
+        }
+        if (span.x0 < minX) minX = span.x0;
+        if (span.x1 - 1 > maxX) maxX = span.x1 - 1;
+        if (span.y < minY) minY = span.y;
+        if (span.y > maxY) maxY = span.y;
+      }
+
+      SWTLabelStats *stats = &labels->stats[labels->labelCount++];
+      stats->area = (int)fill.area;
+      stats->box = (SWTBox){minX, minY, maxX - minX + 1, maxY - minY + 1};
+    }
+  }
+
+  swt__free(allocator, visited);
+  swt__flood_fill_free(&fill, NULL, allocator);
+  return labels;
+}
+
+SWTDEF void swt_free_labels(SWTLabels *labels) {
+  if (labels != NULL) {
+    const SWTAllocator *allocator = labels->allocator;
+    swt__free(allocator, labels->labels16);
+    swt__free(allocator, labels->labels32);
+    swt__free(allocator, labels->stats);
+    swt__free(allocator, labels);
+  }
+}
+
+SWTDEF uint32_t swt_get_label(const SWTLabels *labels, int x, int y) {
+  return swt__label_at(labels, (size_t)y * labels->width + x);
+}
+
+SWTDEF SWTLabelIterator swt_iterate_label(const SWTLabels *labels, uint32_t label) {
+  SWTLabelIterator iterator = {labels, label, 0, 0, 0};
+  if (label >= 1 && label <= (uint32_t)labels->labelCount) {
+    const SWTLabelStats *stats = &labels->stats[label - 1];
+    iterator.x = stats->box.x;
+    iterator.y = stats->box.y;
+    iterator.remaining = stats->area;
+  }
+  return iterator;
+}
+
+// Stops as soon as the last pixel is found, usually well before the end of
+// the box
+SWTDEF int swt_next_label_point(SWTLabelIterator *iterator, SWTPoint *point) {
+  if (iterator->remaining == 0) {
+    return 0;
+  }
+
+  const SWTLabels *labels = iterator->labels;
+  SWTBox box = labels->stats[iterator->label - 1].box;
+  // bounded by the box too, in case the labels changed under the iterator
+  while (iterator->y < box.y + box.height) {
+    int x = iterator->x, y = iterator->y;
+    if (++iterator->x == box.x + box.width) {
+      iterator->x = box.x;
+      iterator->y++;
+    }
+
+    if (swt__label_at(labels, (size_t)y * labels->width + x) == iterator->label) {
+      point->x = x;
+      point->y = y;
+      iterator->remaining--;
+      return 1;
+    }
+  }
+
+  iterator->remaining = 0;
+  return 0;
+}
+
+SWTDEF int swt_get_label_points(const SWTLabels *labels, uint32_t label, SWTPoint *points) {
+  SWTLabelIterator iterator = swt_iterate_label(labels, label);
+  int count = 0;
+  while (swt_next_label_point(&iterator, &points[count])) {
+    count++;
+  }
+  return count;
+}
+
+// Block based labeling for 8-connectivity, after Grana et al.'s BBDT. The
+// image is looked at in 2x2 blocks: all foreground pixels in a block are
+// 8-connected, so one label per block does. Labeling X from the blocks P, Q,
+// R above it and S left of it
+//
+//    h | i j | k        P | Q | R
+//    --+-----+--        --+---+--
+//    n | o p |          S | X |
+//    r | s t |
+//
+// only needs the pixels drawn: X joins P through h and o, Q through i or j
+// and o or p, R through k and p and S through n or r and o or s. Joins that
+// are already implied by the labels of the row above are skipped, eg. P and
+// Q are one set whenever h and i are set. Equal labels go into a union-find
+// forest whose roots are the smallest label of their set.
+typedef struct {
+  size_t area;
+  int minX;
+  int minY;
+  int maxX;
+  int maxY;
+  uint32_t component; // index + 1 of its output, once found in scan order
+} SWTBlockSet;
+
+#define SWT__BLOCK_DROPPED UINT32_MAX
+
+typedef struct {
+  uint32_t *blocks; // label per block, row by row, 0 for background
+  int blocksWide;
+  uint32_t *parents; // union-find over the labels, parents[0] unused
+  SWTBlockSet *sets; // [label], merged into the roots once resolved
+  uint32_t count;    // labels handed out
+  uint32_t capacity;
+  size_t bytes;
+} SWTBlockLabeling;
+
+static int swt__block_labeling_init(SWTBlockLabeling *labeling, const SWTImage *image,
+                                    SWTResults *results, const SWTAllocator *allocator) {
+  memset(labeling, 0, sizeof(*labeling));
+  labeling->blocksWide = (image->width + 1) / 2;
+  size_t blockCount = (size_t)labeling->blocksWide * ((image->height + 1) / 2);
+  size_t bytes = swt__array_size(blockCount, sizeof(uint32_t));
+  bytes += SWT__QUEUE_START * (sizeof(uint32_t) + sizeof(SWTBlockSet));
+  if (!swt__budget_take(results, bytes)) {
+    return 0;
+  }
+
+  labeling->blocks = (uint32_t *)swt__calloc(allocator, blockCount, sizeof(uint32_t));
+  labeling->parents = (uint32_t *)swt__malloc(allocator, SWT__QUEUE_START * sizeof(uint32_t));
+  labeling->sets = (SWTBlockSet *)swt__malloc(allocator, SWT__QUEUE_START * sizeof(SWTBlockSet));
+  if (labeling->blocks == NULL || labeling->parents == NULL || labeling->sets == NULL) {
+    swt__free(allocator, labeling->blocks);
+    swt__free(allocator, labeling->parents);
+    swt__free(allocator, labeling->sets);
+    swt__budget_give(results, bytes);
+    return 0;
+  }
+  labeling->capacity = SWT__QUEUE_START;
+  labeling->bytes = bytes;
+  SWT__STATS_ALLOC(results ? results->stats : NULL, bytes, 1);
+  return 1;
+}
+
+static void swt__block_labeling_free(SWTBlockLabeling *labeling, SWTResults *results,
+                                     const SWTAllocator *allocator) {
+  swt__free(allocator, labeling->blocks);
+  swt__free(allocator, labeling->parents);
+  swt__free(allocator, labeling->sets);
+  swt__budget_give(results, labeling->bytes);
+  SWT__STATS_FREE(results ? results->stats : NULL, labeling->bytes);
+}
+
+// A fresh label, 0 if there's no room for it
+static uint32_t swt__new_block_label(SWTBlockLabeling *labeling, SWTResults *results,
+                                     const SWTAllocator *allocator) {
+  if (labeling->count + 1 == labeling->capacity) {
+    uint32_t capacity = labeling->capacity;
+    size_t growth = capacity * (sizeof(uint32_t) + sizeof(SWTBlockSet));
+    if (capacity > UINT32_MAX / 4 || !swt__budget_take(results, growth)) {
+      return 0;
+    }
+    uint32_t *parents = (uint32_t *)swt__realloc(allocator, labeling->parents,
+        swt__array_size(capacity * 2, sizeof(uint32_t)));
+    if (parents != NULL) {
+      labeling->parents = parents;
+    }
+    SWTBlockSet *sets = parents == NULL ? NULL : (SWTBlockSet *)swt__realloc(allocator,
+        labeling->sets, swt__array_size(capacity * 2, sizeof(SWTBlockSet)));
+    if (sets == NULL) {
+      swt__budget_give(results, growth);
+      return 0;
+    }
+    labeling->sets = sets;
+    labeling->capacity *= 2;
+    labeling->bytes += growth;
+    SWT__STATS_ALLOC(results ? results->stats : NULL, growth, 1);
+  }
+
+  uint32_t label = ++labeling->count;
+  labeling->parents[label] = label;
+  SWTBlockSet *set = &labeling->sets[label];
+  set->area = 0;
+  set->minX = set->minY = INT_MAX;
+  set->maxX = set->maxY = -1;
+  set->component = 0;
+  return label;
+}
+
+static inline uint32_t swt__find_block_root(uint32_t *parents, uint32_t label) {
+  while (parents[label] != label) {
+    parents[label] = parents[parents[label]];
+    label = parents[label];
+  }
+  return label;
+}
+
+static inline uint32_t swt__join_blocks(uint32_t *parents, uint32_t a, uint32_t b) {
+  a = swt__find_block_root(parents, a);
+  b = swt__find_block_root(parents, b);
+  if (a < b) {
+    parents[b] = a;
+    return a;
+  }
+  parents[a] = b;
+  return b;
+}
+
+// First pass, labels every block. Returns 0 when out of memory or stopped,
+// see results->status for which.
+static int swt__label_blocks(const SWTImage *image, SWTBlockLabeling *labeling,
+                             SWTResults *results, const SWTAllocator *allocator) {
+  int width = image->width, height = image->height;
+  int blocksWide = labeling->blocksWide;
+
+#define SWT__FG(row, x) ((row)[x] != SWT_CLR_BLACK)
+  for (int y = 0; y < height; y += 2) {
+    if ((y & 127) == 0 && swt__should_stop(results)) {
+      return 0;
+    }
+
+    const uint8_t *row = image->bytes + (size_t)y * width;
+    const uint8_t *below = y + 1 < height ? row + width : NULL;
+    const uint8_t *above = y > 0 ? row - width : NULL;
+    uint32_t *blockRow = labeling->blocks + (size_t)(y / 2) * blocksWide;
+    const uint32_t *blockAbove = y > 0 ? blockRow - blocksWide : NULL;
+
+    for (int x = 0; x < width; x += 2) {
+      int o = SWT__FG(row, x);
+      int p = x + 1 < width && SWT__FG(row, x + 1);
+      int s = below != NULL && SWT__FG(below, x);
+      int t = below != NULL && x + 1 < width && SWT__FG(below, x + 1);
+
+      if (!(o | p | s | t)) {
+        // the blocks start out as background, skip to the next foreground
+        int next = swt__kernels->find_foreground(row, x + 2 < width ? x + 2 : width, width);
+        if (below != NULL) {
+          int nextBelow = swt__kernels->find_foreground(below, x + 2 < width ? x + 2 : width, width);
+          next = nextBelow < next ? nextBelow : next;
+        }
+        if (next == width) break;
+        x = (next & ~1) - 2;
+        continue;
+      }
+
+      uint32_t *parents = labeling->parents;
+      uint32_t label = 0;
+      int joinedP = 0, joinedQ = 0, h = 0, i = 0;
+      if (above != NULL) {
+        h = x > 0 && SWT__FG(above, x - 1);
+        i = SWT__FG(above, x);
+        int j = x + 1 < width && SWT__FG(above, x + 1);
+        int k = x + 2 < width && SWT__FG(above, x + 2);
+        joinedP = o && h;
+
+        if ((o | p) && (i | j)) {
+          joinedQ = 1;
+          label = blockAbove[x / 2];
+          // h next to i or k next to j means that block is already Q's
+          if (joinedP && !i) label = swt__join_blocks(parents, label, blockAbove[x / 2 - 1]);
+          if (p && k && !j) label = swt__join_blocks(parents, label, blockAbove[x / 2 + 1]);
+        } else {
+          // P and R are two blocks apart, nothing joins them yet
+          if (joinedP) label = blockAbove[x / 2 - 1];
+          if (p && k) {
+            label = label ? swt__join_blocks(parents, label, blockAbove[x / 2 + 1])
+                          : blockAbove[x / 2 + 1];
+          }
+        }
+      }
+
+      if ((o | s) && x > 0) {
+        int n = SWT__FG(row, x - 1);
+        int r = below != NULL && SWT__FG(below, x - 1);
+        if (n | r) {
+          // n next to h or i means S is already P's or Q's
+          if (label == 0) {
+            label = blockRow[x / 2 - 1];
+          } else if (!(n && ((joinedQ && i) || (joinedP && h)))) {
+            label = swt__join_blocks(parents, label, blockRow[x / 2 - 1]);
+          }
+        }
+      }
+
+      if (label == 0) {
+        label = swt__new_block_label(labeling, results, allocator);
+        if (label == 0) {
+          swt__out_of_memory(results);
+          return 0;
+        }
+      }
+      blockRow[x / 2] = label;
+
+      SWTBlockSet *set = &labeling->sets[label];
+      int minX = (o | s) ? x : x + 1, maxX = (p | t) ? x + 1 : x;
+      int minY = (o | p) ? y : y + 1, maxY = (s | t) ? y + 1 : y;
+      set->area += o + p + s + t;
+      if (minX < set->minX) set->minX = minX;
+      if (maxX > set->maxX) set->maxX = maxX;
+      if (minY < set->minY) set->minY = minY;
+      if (maxY > set->maxY) set->maxY = maxY;
+    }
+  }
+#undef SWT__FG
+
+  return 1;
+}
+
+// Points every label at its root and gathers the sets there. Returns how
+// many sets are kept, lone pixels aren't.
+static uint32_t swt__resolve_blocks(SWTBlockLabeling *labeling) {
+  uint32_t *parents = labeling->parents;
+  SWTBlockSet *sets = labeling->sets;
+  uint32_t kept = 0;
+
+  // a label's parent is always smaller, so it's resolved by the time
+  // the label comes up
+  for (uint32_t label = 1; label <= labeling->count; label++) {
+    uint32_t root = parents[parents[label]];
+    parents[label] = root;
+    if (root == label) {
+      continue;
+    }
+    SWTBlockSet *set = &sets[label], *into = &sets[root];
+    into->area += set->area;
+    if (set->minX < into->minX) into->minX = set->minX;
+    if (set->maxX > into->maxX) into->maxX = set->maxX;
+    if (set->minY < into->minY) into->minY = set->minY;
+    if (set->maxY > into->maxY) into->maxY = set->maxY;
+  }
+  for (uint32_t label = 1; label <= labeling->count; label++) {
+    if (parents[label] == label && sets[label].area >= 2) kept++;
+  }
+  return kept;
+}
+
+static void swt__block_component_analysis(SWTImage *image, SWTComponents *components,
+                                          SWTResults *results) {
+  SWTStats *stats = results ? results->stats : NULL;
+  (void)stats;
+  int width = image->width, height = image->height;
+  SWT_ASSERT(width <= SWT_MAX_DIMENSION && height <= SWT_MAX_DIMENSION &&
+             "the image is too large for SWT_COMPACT_POINTS");
+  if (SWT__CONNECTIVITY(components->connectivity) != 8) {
+    swt__connected_component_analysis(image, components, results);
+    return;
+  }
+
+  SWTBlockLabeling labeling;
+  if (!swt__block_labeling_init(&labeling, image, results, components->allocator)) {
+    swt__out_of_memory(results);
+    return;
+  }
+
+  swt_init_tables();
+  if (!swt__label_blocks(image, &labeling, results, components->allocator)) {
+    swt__block_labeling_free(&labeling, results, components->allocator);
+    return;
+  }
+  swt__resolve_blocks(&labeling);
+
+  // Second pass, the points go out in scan order so the components come out
+  // in the order the flood fill finds them. A run of foreground is all in
+  // one component. Once memory runs out the components already started are
+  // still finished.
+  int full = 0;
+  for (int y = 0; y < height; y++) {
+    const uint8_t *row = image->bytes + (size_t)y * width;
+    const uint32_t *blockRow = labeling.blocks + (size_t)(y / 2) * labeling.blocksWide;
+
+    for (int x = swt__kernels->find_foreground(row, 0, width), end; x < width;
+         x = swt__kernels->find_foreground(row, end, width)) {
+      for (end = x + 1; end < width && row[end] != SWT_CLR_BLACK; end++) {
+      }
+      SWTBlockSet *set = &labeling.sets[labeling.parents[blockRow[x / 2]]];
+
+      if (set->component == 0) {
+        set->component = SWT__BLOCK_DROPPED;
+        // Lone pixels are dropped as noise
+        if (set->area < 2 || full) {
+          continue;
+        }
+        size_t bytes = set->area * sizeof(SWTPoint);
+        if (set->area > INT_MAX || !swt__budget_take(results, bytes)) {
+          swt__degrade(results, SWT_DEGRADED_SKIPPED);
+          continue;
+        }
+
+        SWTComponent component;
+        component.pointCount = 0;
+        component.points = (SWTPoint *)swt__malloc(components->allocator, bytes);
+        if (component.points == NULL ||
+            swt__add_component(components, results, component) == NULL) {
+          swt__free(components->allocator, component.points);
+          swt__budget_give(results, bytes);
+          swt__out_of_memory(results);
+          full = 1;
+          continue;
+        }
+        set->component = (uint32_t)components->itemCount;
+        SWT__STATS_ALLOC(stats, bytes, 0);
+        SWT__STATS_ADD(stats, foregroundPixels, set->area);
+      }
+
+      if (set->component != SWT__BLOCK_DROPPED) {
+        SWTComponent *component = &components->items[set->component - 1];
+        SWTPoint *point = component->points + component->pointCount;
+        for (int i = x; i < end; i++, point++) {
+          point->x = i;
+          point->y = y;
+        }
+        component->pointCount += end - x;
+      }
+    }
+  }
+
+  swt__block_labeling_free(&labeling, results, components->allocator);
+}
+
+SWTDEF void swt_connected_component_analysis_blocks(SWTImage *image,
+                                                    SWTComponents *components) {
+  swt__block_component_analysis(image, components, NULL);
+}
+
+SWTDEF SWTLabels *swt_label_components_blocks(const SWTImage *image,
+                                              const SWTAllocator *allocator) {
+  int width = image->width, height = image->height;
+
+  SWTLabels *labels = (SWTLabels *)swt__calloc(allocator, 1, sizeof(SWTLabels));
+  if (labels == NULL) {
+    return NULL;
+  }
+  labels->width = width;
+  labels->height = height;
+  labels->allocator = allocator;
+
+  SWTBlockLabeling labeling;
+  if (!swt__block_labeling_init(&labeling, image, NULL, allocator)) {
+    swt__free(allocator, labels);
+    return NULL;
+  }
+
+  swt_init_tables();
+  if (!swt__label_blocks(image, &labeling, NULL, allocator)) {
+    swt__block_labeling_free(&labeling, NULL, allocator);
+    swt__free(allocator, labels);
+    return NULL;
+  }
+  uint32_t kept = swt__resolve_blocks(&labeling);
+
+  // the count is known up front, so the labels are as wide as they need to
+  // be from the start
+  size_t size = (size_t)width * height;
+  labels->capacity = kept > 0 ? (int)kept : 1;
+  labels->stats = (SWTLabelStats *)swt__malloc(allocator, labels->capacity * sizeof(SWTLabelStats));
+  if (kept > 65535) {
+    labels->labels32 = (uint32_t *)swt__calloc(allocator, size, sizeof(uint32_t));
+  } else {
+    labels->labels16 = (uint16_t *)swt__calloc(allocator, size, sizeof(uint16_t));
+  }
+  if (kept > INT_MAX || labels->stats == NULL ||
+      (labels->labels16 == NULL && labels->labels32 == NULL)) {
+    swt__block_labeling_free(&labeling, NULL, allocator);
+    swt_free_labels(labels);
+    return NULL;
+  }
+
+  for (int y = 0; y < height; y++) {
+    const uint8_t *row = image->bytes + (size_t)y * width;
+    const uint32_t *blockRow = labeling.blocks + (size_t)(y / 2) * labeling.blocksWide;
+
+    for (int x = swt__kernels->find_foreground(row, 0, width), end; x < width;
+         x = swt__kernels->find_foreground(row, end, width)) {
+      for (end = x + 1; end < width && row[end] != SWT_CLR_BLACK; end++) {
+      }
+      SWTBlockSet *set = &labeling.sets[labeling.parents[blockRow[x / 2]]];
+
+      if (set->component == 0) {
+        set->component = SWT__BLOCK_DROPPED;
+        if (set->area < 2) {
+          continue;
+        }
+        SWTLabelStats *stats = &labels->stats[labels->labelCount++];
+        stats->area = (int)set->area;
+        stats->box = (SWTBox){set->minX, set->minY, set->maxX - set->minX + 1,
+                              set->maxY - set->minY + 1};
+        set->component = (uint32_t)labels->labelCount;
+      }
+      for (int i = x; i < end && set->component != SWT__BLOCK_DROPPED; i++) {
+        swt__set_label(labels, (size_t)y * width + i, set->component);
+      }
+    }
+  }
+
+  swt__block_labeling_free(&labeling, NULL, allocator);
+  return labels;
+}
+
+// The kernels count pixels in an int, larger images are fed to them in
+// pieces of this many
+#define SWT__KERNEL_CHUNK ((size_t)1 << 30)
+
+SWTDEF void swt_apply_grayscale(SWTImage *image) {
+  // already gray, eg. frames piped in as raw single channel video
+  if (image->channels == 1) {
+    return;
+  }
+
+  SWT_ASSERT(image->channels == 3);
+
+  swt_init_tables();
+
+  // each gray pixel is written behind the rgb triplet it is read from, so the
+  // conversion can safely happen in place
+  size_t pixels = (size_t)image->width * image->height;
+  for (size_t done = 0; done < pixels; done += SWT__KERNEL_CHUNK) {
+    size_t count = pixels - done < SWT__KERNEL_CHUNK ? pixels - done : SWT__KERNEL_CHUNK;
+    swt__kernels->grayscale(image->bytes + 3 * done, image->bytes + done, (int)count);
+  }
+  image->channels = 1;
+}
+
+// TODO: this will break black on white
+SWTDEF void swt_apply_threshold(SWTImage *image, const int threshold) {
+  swt_init_tables();
+
+  if (image->channels == 1) {
+    size_t pixels = (size_t)image->width * image->height;
+    for (size_t done = 0; done < pixels; done += SWT__KERNEL_CHUNK) {
+      size_t count = pixels - done < SWT__KERNEL_CHUNK ? pixels - done : SWT__KERNEL_CHUNK;
+      swt__kernels->threshold(image->bytes + done, (int)count, threshold);
+    }
+    return;
+  }
+
+  for (int y = 0; y < image->height; y++) {
+    for (int x = 0; x < image->width; x++) {
+      size_t index = ((size_t)y * image->width + x) * image->channels;
+      if (image->bytes[index] > threshold) {
+        image->bytes[index] = SWT_CLR_BLACK;
+      } else {
+        image->bytes[index] = SWT_CLR_WHITE;
+      }
+    }
+  }
+}
+
+static SWTComponents *swt__create_components(size_t size,
+                                            const SWTAllocator *allocator) {
+  SWTComponents *components = (SWTComponents *)swt__malloc(allocator, sizeof(SWTComponents));
+
+  if (components != NULL) {
+    components->allocator = allocator;
+    components->itemCount = 0;
+    components->connectivity = 0;
+    components->capacity = swt__initial_capacity(size);
+    components->items = (SWTComponent *)swt__malloc(allocator,
+        swt__array_size(components->capacity, sizeof(SWTComponent)));
+
+    if (components->items == NULL) {
+      swt__free(allocator, components);
+      return NULL;
+    }
+  }
+
+  return components;
+}
+
+SWTDEF SWTComponents *swt__allocate_components(size_t size) {
+  return swt__create_components(size, NULL);
+}
+
+SWTDEF void swt__free_components(SWTComponents *components) {
+  if (components) {
+    const SWTAllocator *allocator = components->allocator;
+    for (int i = 0; i < components->itemCount; i++) {
+      swt__free(allocator, components->items[i].points);
+    }
+    swt__free(allocator, components->items);
+    components->items = NULL;
+    components->itemCount = 0;
+    swt__free(allocator, components);
+  }
+}
+
+// The result columns share one block, the pointer column first so each
+// column stays aligned
+#define SWT__RESULT_BYTES                                                      \
+  (sizeof(SWTComponent *) + 2 * sizeof(float) + 5 * sizeof(int))
+
+static void swt__place_result_columns(SWTResults *results, char *block,
+                                      int capacity) {
+  results->components = (SWTComponent **)block;
+  results->confidences = (float *)(block + sizeof(SWTComponent *) * (size_t)capacity);
+  results->variations = results->confidences + capacity;
+  results->areas = (int *)(results->variations + capacity);
+  results->lefts = results->areas + capacity;
+  results->tops = results->lefts + capacity;
+  results->widths = results->tops + capacity;
+  results->heights = results->widths + capacity;
+}
+
+static SWTResults *swt__allocate_results(size_t size,
+                                         const SWTAllocator *allocator) {
+  SWTResults *results = (SWTResults *)swt__malloc(allocator, sizeof(SWTResults));
+
+  if (results != NULL) {
+    results->capacity = swt__initial_capacity(size);
+    char *block = (char *)swt__calloc(allocator, results->capacity, SWT__RESULT_BYTES);
+
+    if (block != NULL) {
+      swt__place_result_columns(results, block, results->capacity);
+      results->itemCount = 0;
+      results->stats = NULL;
+      results->deadlineMs = 0;
+      results->cancel = NULL;
+      results->status = SWT_STATUS_OK;
+      results->memoryBudget = 0;
+      results->degraded = 0;
+      results->scale = 1;
+      results->memoryUsed = 0;
+      results->allocator = allocator;
+    } else {
+      // Handle memory allocation error for the columns
+      swt__free(allocator, results);
+      return NULL;
+    }
+  }
+
+  return results;
+}
+
+// Makes room for at least `count` results, 0 if that can't be had
+static int swt__reserve_results(SWTResults *results, int count) {
+  if (count <= results->capacity) {
+    return 1;
+  }
+
+  int capacity = results->capacity;
+  while (capacity < count) {
+    capacity = capacity > INT_MAX / 2 ? INT_MAX : capacity * 2;
+  }
+
+  size_t growth = (size_t)(capacity - results->capacity) * SWT__RESULT_BYTES;
+  if (!swt__budget_take(results, growth)) {
+    return 0;
+  }
+  char *block = (char *)swt__malloc(results->allocator,
+                                    swt__array_size(capacity, SWT__RESULT_BYTES));
+  if (block == NULL) {
+    swt__budget_give(results, growth);
+    return 0;
+  }
+
+  // every column moves, not just the end of the block
+  SWTResults old = *results;
+  size_t rows = (size_t)results->itemCount;
+  swt__place_result_columns(results, block, capacity);
+  memcpy(results->components, old.components, rows * sizeof(SWTComponent *));
+  memcpy(results->confidences, old.confidences, rows * sizeof(float));
+  memcpy(results->variations, old.variations, rows * sizeof(float));
+  memcpy(results->areas, old.areas, rows * sizeof(int));
+  memcpy(results->lefts, old.lefts, rows * sizeof(int));
+  memcpy(results->tops, old.tops, rows * sizeof(int));
+  memcpy(results->widths, old.widths, rows * sizeof(int));
+  memcpy(results->heights, old.heights, rows * sizeof(int));
+  swt__free(results->allocator, old.components);
+  results->capacity = capacity;
+  return 1;
+}
+
+// Fills row i from the component
+static void swt__set_result(SWTResults *results, int i, SWTComponent *component,
+                            float confidence, float variation) {
+  SWTBox box = swt_compute_component_box(component);
+  results->components[i] = component;
+  results->confidences[i] = confidence;
+  results->variations[i] = variation;
+  results->areas[i] = component->pointCount;
+  results->lefts[i] = box.x;
+  results->tops[i] = box.y;
+  results->widths[i] = box.width;
+  results->heights[i] = box.height;
+}
+
+// Appends a result, growing the columns when they're full. Returns 0 if
+// there was no room.
+static int swt__add_result(SWTResults *results, SWTComponent *component,
+                           float confidence, float variation) {
+  if (!swt__reserve_results(results, results->itemCount + 1)) {
+    return 0;
+  }
+  swt__set_result(results, results->itemCount, component, confidence, variation);
+  results->itemCount++;
+  return 1;
+}
+
+// Copies row `from` over row `to`
+static void swt__move_result(SWTResults *results, int to, int from) {
+  results->components[to] = results->components[from];
+  results->confidences[to] = results->confidences[from];
+  results->variations[to] = results->variations[from];
+  results->areas[to] = results->areas[from];
+  results->lefts[to] = results->lefts[from];
+  results->tops[to] = results->tops[from];
+  results->widths[to] = results->widths[from];
+  results->heights[to] = results->heights[from];
+}
+
+static void swt__free_results(SWTResults *results) {
+  if (results != NULL) {
+    const SWTAllocator *allocator = results->allocator;
+    swt__free(allocator, results->components);
+    results->components = NULL;
+    results->itemCount = 0;
+    swt__free(allocator, results);
+  }
+}
+
+SWTDEF SWTData* swt_allocate(size_t size) {
+    return swt_allocate_with(size, NULL);
+}
+
+SWTDEF SWTData *swt_allocate_with(size_t size, const SWTAllocator *allocator) {
+    SWTData* data = (SWTData*)swt__malloc(allocator, sizeof(SWTData));
+    if (data == NULL) {
+        return NULL;
+    }
+
+    data->components = swt__create_components(size, allocator);
+    data->results = swt__allocate_results(size, allocator);
+    data->size = size;
+
+    if (data->components == NULL || data->results == NULL) {
+        swt__free_components(data->components);
+        swt__free_results(data->results);
+        swt__free(allocator, data);
+        return NULL;
+    }
+
+    return data;
+}
+
+SWTDEF void swt_reset(SWTData *data) {
+    for (int i = 0; i < data->components->itemCount; i++) {
+        swt__free(data->components->allocator, data->components->items[i].points);
+    }
+    data->components->itemCount = 0;
+    data->results->itemCount = 0;
+    data->results->status = SWT_STATUS_OK;
+    data->results->degraded = 0;
+    data->results->scale = 1;
+}
+
+SWTDEF void swt_free(SWTData *data) {
+    if (data == NULL) {
+        return;
+    }
+    const SWTAllocator *allocator = data->components->allocator;
+    swt__free_components(data->components);
+    swt__free_results(data->results);
+    swt__free(allocator, data);
+}
+
+SWTDEF SWTSobelNode swt_compute_sobel_for_point(SWTImage *image,
+                                                SWTPoint point) {
+  // indexed as [y][x], centered on the point
+  const int sobelX[][3] = {{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}};
+  const int sobelY[][3] = {{-1, -2, -1}, {0, 0, 0}, {1, 2, 1}};
+
+  SWTSobelNode node = {0};
+
+  swt_init_tables();
+
+  for (int y = 0; y < 3; y++) {
+    for (int x = 0; x < 3; x++) {
+      int xx = point.x + x - 1;
+      int yy = point.y + y - 1;
+
+      if (xx >= 0 && xx < image->width && yy >= 0 && yy < image->height) {
+        size_t currentIndex = (size_t)yy * image->width + xx;
+
+        node.gradientX += image->bytes[currentIndex] * sobelX[y][x];
+        node.gradientY += image->bytes[currentIndex] * sobelY[y][x];
+      }
+    }
+  }
+
+  node.magnitude =
+      sqrt(node.gradientX * node.gradientX + node.gradientY * node.gradientY);
+  node.direction = swt__quantize_direction(node.gradientX, node.gradientY);
+
+  return node;
+}
+
+
+SWTDEF uint8_t swt_compute_otsu_threshold(SWTImage *image) {
+    if (image == NULL) {
+        return 0;
+    }
+
+    long long histogram[256] = {0};
+    long long totalPixels = (long long)image->width * image->height;
+
+    swt_init_tables();
+    for (size_t done = 0; done < (size_t)totalPixels; done += SWT__KERNEL_CHUNK) {
+        int counts[256] = {0};
+        size_t count = (size_t)totalPixels - done < SWT__KERNEL_CHUNK ? (size_t)totalPixels - done : SWT__KERNEL_CHUNK;
+        swt__kernels->histogram(image->bytes + done, (int)count, counts);
+        for (int i = 0; i < 256; i++) {
+            histogram[i] += counts[i];
+        }
+    }
+
+    double sum = 0;
+    for (int i = 0; i < 256; i++) {
+        sum += i * (double)histogram[i];
+    }
+
+    double sumB = 0;
+    long long wB = 0;
+    long long wF = 0;
+
+    double maxVariance = 0;
+    uint8_t threshold = 0;
+
+    for (int t = 0; t < 256; t++) {
+        wB += histogram[t];
+        if (wB == 0) continue;
+
+        wF = totalPixels - wB;
+        if (wF == 0) break;
+
+        sumB += t * (double)histogram[t];
+        double meanB = sumB / wB;
+        double meanF = (sum - sumB) / wF;
+
+        double varianceBetween = (double)wB * wF * (meanB - meanF) * (meanB - meanF);
+
+        if (varianceBetween > maxVariance) {
+            maxVariance = varianceBetween;
+            threshold = t;
+        }
+    }
+
+    return threshold;
+}
+
+
+static int swt__qsort_compare(const void *a, const void *b) {
+  return (*(int *)a - *(int *)b);
+}
+
+static float swt__median(int *nums, int len) {
+  qsort(nums, len, sizeof(int), swt__qsort_compare);
+
+  const float half = len / 2.0;
+  if (len % 2 == 0)
+    return (nums[(int)half - 1] + nums[(int)half]) / 2.0;
+
+  return nums[(int)half];
+}
+
+// A dense bitset covering the bounding box of a single component, one bit per
+// pixel and rows padded to whole 64-bit words. For typical glyphs the whole
+// mask is a few hundred bytes, so rays cast over it stay in L1 instead of
+// striding through the full resolution image.
+typedef struct {
+  uint64_t *bits;
+  int x;
+  int y;
+  int width;
+  int height;
+  int words; // words per row
+} SWTComponentMask;
+
+SWTDEF SWTBox swt_compute_component_box(SWTComponent *component) {
+  SWTBox box = {0, 0, 0, 0};
+  if (component->pointCount == 0) {
+    return box;
+  }
+
+  int minX = component->points[0].x, maxX = minX;
+  int minY = component->points[0].y, maxY = minY;
+
+  for (int i = 1; i < component->pointCount; i++) {
+    SWTPoint point = component->points[i];
+    if (point.x < minX) minX = point.x;
+    if (point.x > maxX) maxX = point.x;
+    if (point.y < minY) minY = point.y;
+    if (point.y > maxY) maxY = point.y;
+  }
+
+  box.x = minX;
+  box.y = minY;
+  box.width = maxX - minX + 1;
+  box.height = maxY - minY + 1;
+  return box;
+}
+
+// Reads the points of a component one at a time, from its array or from a
+// packed stream. It's copied to read them again.
+typedef struct {
+  const SWTPoint *points; // NULL for a packed stream or a label
+  const uint8_t *bytes;
+  const uint8_t *end;
+  int x;
+  int y;
+  SWTLabelIterator label; // used when label.labels is set
+} SWTPointCursor;
+
+static SWTPointCursor swt__point_cursor(const SWTPoint *points,
+                                       const uint8_t *bytes, size_t size) {
+  SWTPointCursor cursor;
+  memset(&cursor, 0, sizeof(cursor));
+  cursor.points = points;
+  cursor.bytes = bytes;
+  cursor.end = bytes != NULL ? bytes + size : NULL;
+  return cursor;
+}
+
+static uint32_t swt__zigzag(int value) {
+  return ((uint32_t)value << 1) ^ (0u - (uint32_t)(value < 0));
+}
+
+static size_t swt__varint_size(uint32_t value) {
+  size_t size = 1;
+  for (; value >= 0x80; value >>= 7) size++;
+  return size;
+}
+
+static uint8_t *swt__write_varint(uint8_t *bytes, uint32_t value) {
+  for (; value >= 0x80; value >>= 7) {
+    *bytes++ = (uint8_t)(value | 0x80);
+  }
+  *bytes++ = (uint8_t)value;
+  return bytes;
+}
+
+// Returns 0 when the stream ends before the varint does. A 32 bit varint
+// takes at most 5 bytes, a malformed one is cut off there.
+static inline int swt__read_delta(const uint8_t **bytes, const uint8_t *end,
+                                  int *delta) {
+  uint32_t value = 0;
+  for (int shift = 0;; shift += 7) {
+    if (*bytes == end) {
+      return 0;
+    }
+    uint8_t byte = *(*bytes)++;
+    value |= (uint32_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80) || shift == 28) break;
+  }
+  *delta = (int)(value >> 1) ^ -(int)(value & 1);
+  return 1;
+}
+
+// Returns 0 once the points run out, a label's iterator can do so before the
+// count it was started with
+static inline int swt__next_point(SWTPointCursor *cursor, SWTPoint *point) {
+  if (cursor->points != NULL) {
+    *point = *cursor->points++;
+    return 1;
+  }
+  if (cursor->label.labels != NULL) {
+    return swt_next_label_point(&cursor->label, point);
+  }
+  int dx, dy;
+  if (!swt__read_delta(&cursor->bytes, cursor->end, &dx) ||
+      !swt__read_delta(&cursor->bytes, cursor->end, &dy)) {
+    return 0;
+  }
+  // wrapping, a corrupt stream may walk off anywhere
+  cursor->x = (int)((uint32_t)cursor->x + (uint32_t)dx);
+  cursor->y = (int)((uint32_t)cursor->y + (uint32_t)dy);
+  point->x = cursor->x;
+  point->y = cursor->y;
+  return 1;
+}
+
+// Only the component's own points are set, which also keeps a ray from
+// walking into a neighbouring component that happens to touch it diagonally.
+// The box and the points may come from different places, so points outside
+// the box are left out.
+static void swt__build_component_mask(const SWTAllocator *allocator,
+                                      SWTPointCursor points, int pointCount,
+                                      SWTBox box, SWTComponentMask *mask) {
+  int minX = box.x, minY = box.y;
+
+  mask->x = box.x;
+  mask->y = box.y;
+  mask->width = box.width;
+  mask->height = box.height;
+  mask->words = (mask->width + 63) / 64;
+  mask->bits = (uint64_t *)swt__calloc(allocator, (size_t)mask->words * mask->height, sizeof(uint64_t));
+  if (mask->bits == NULL) {
+    return;
+  }
+
+  SWTPoint point;
+  for (int i = 0; i < pointCount && swt__next_point(&points, &point); i++) {
+    int x = point.x - minX;
+    int y = point.y - minY;
+    if (x < 0 || x >= mask->width || y < 0 || y >= mask->height) {
+      continue;
+    }
+    mask->bits[(size_t)y * mask->words + (x >> 6)] |= (uint64_t)1 << (x & 63);
+  }
+}
+
+static inline int swt__component_mask_test(const SWTComponentMask *mask, int x,
+                                           int y) {
+  if (x < 0 || x >= mask->width || y < 0 || y >= mask->height) {
+    return 0;
+  }
+  return (int)((mask->bits[(size_t)y * mask->words + (x >> 6)] >> (x & 63)) & 1);
+}
+
+// Sobel gradients for every pixel inside the mask's bounding box, a row at a
+// time through the SIMD kernels. Pixels on the image border are left at zero
+// here, callers fall back to swt_compute_sobel_for_point for those.
+static void swt__compute_mask_gradients(SWTImage *image,
+                                        const SWTComponentMask *mask,
+                                        int16_t *gradientX,
+                                        int16_t *gradientY) {
+  int x0 = mask->x < 1 ? 1 : mask->x;
+  int x1 = mask->x + mask->width - 1;
+  if (x1 > image->width - 2) x1 = image->width - 2;
+  if (x1 < x0) return;
+
+  for (int y = mask->y; y < mask->y + mask->height; y++) {
+    if (y < 1 || y > image->height - 2) continue;
+
+    const uint8_t *row = image->bytes + (size_t)y * image->width;
+    size_t offset = (size_t)(y - mask->y) * mask->width + (x0 - mask->x);
+    swt__kernels->sobel_row(row - image->width + x0, row + x0,
+                            row + image->width + x0, x1 - x0 + 1,
+                            gradientX + offset, gradientY + offset);
+  }
+}
+
+// `results` is only used for its stats, memory budget and to stop early, it
+// may be NULL. A component cut short gets the median of the rays cast so far,
+// one whose scratch memory doesn't fit the budget or can't be allocated gets
+// -1 (flagged as skipped or out of memory). `variation` (may be NULL) is set
+// to the standard deviation of the widths over their mean.
+static int swt__measure_strokes(SWTImage *image, SWTPointCursor points,
+                                int pointCount, SWTBox box,
+                                SWTResults *results, float *variation) {
+    SWTStats *stats = results ? results->stats : NULL;
+    const SWTAllocator *allocator = results ? results->allocator : NULL;
+    (void)stats;
+    SWT_ASSERT(image->channels == 1 && "swt_compute_stroke_width_for_component expects a BINARY image");
+    if (variation != NULL) {
+        *variation = 0;
+    }
+    if (pointCount == 0) {
+        return 0;
+    }
+
+    // sized from the box so nothing is allocated for a component that
+    // doesn't fit the budget
+    size_t maskPixels = (size_t)box.width * box.height;
+    size_t maskBytes = sizeof(uint64_t) * ((box.width + 63) / 64) * (size_t)box.height;
+    size_t scratchBytes = sizeof(int) * (size_t)pointCount + maskBytes +
+                          2 * sizeof(int16_t) * maskPixels;
+    if (!swt__budget_take(results, scratchBytes)) {
+        swt__degrade(results, SWT_DEGRADED_SKIPPED);
+        return -1;
+    }
+
+    SWTComponentMask mask;
+    swt__build_component_mask(allocator, points, pointCount, box, &mask);
+    int *strokes = (int *)swt__malloc(allocator, sizeof(int) * (size_t)pointCount);
+    int16_t *gradients = (int16_t *)swt__calloc(allocator, swt__array_size(2, maskPixels), sizeof(int16_t));
+    if (strokes == NULL || mask.bits == NULL || gradients == NULL) {
+        swt__free(allocator, gradients);
+        swt__free(allocator, mask.bits);
+        swt__free(allocator, strokes);
+        swt__budget_give(results, scratchBytes);
+        swt__out_of_memory(results);
+        return -1;
+    }
+    int16_t *gradientX = gradients, *gradientY = gradients + maskPixels;
+
+    SWT__STATS_ALLOC(stats, sizeof(int) * pointCount, 1);
+    SWT__STATS_ALLOC(stats, maskBytes, 1);
+    SWT__STATS_ALLOC(stats, 2 * sizeof(int16_t) * maskPixels, 1);
+
+    swt_init_tables();
+    swt__compute_mask_gradients(image, &mask, gradientX, gradientY);
+
+    int strokeCount = 0;
+    // A ray can never be longer than the diagonal of the bounding box, so it
+    // always leaves the mask before this bound
+    int maxDistance = mask.width + mask.height;
+
+    for (int j = 0; j < pointCount; j++) {
+        if ((j & 255) == 255 && swt__should_stop(results)) {
+            break;
+        }
+
+        SWTPoint point;
+        if (!swt__next_point(&points, &point)) {
+            break;
+        }
+        int distancePositive = 0;
+
+        int xx = point.x - mask.x;
+        int yy = point.y - mask.y;
+        // the ones the mask left out
+        if (!swt__component_mask_test(&mask, xx, yy)) {
+            continue;
+        }
+
+        int directionIndex;
+        if (point.x < 1 || point.x > image->width - 2 || point.y < 1 ||
+            point.y > image->height - 2) {
+            directionIndex = swt_compute_sobel_for_point(image, point).direction;
+        } else {
+            size_t index = (size_t)yy * mask.width + xx;
+            directionIndex = swt__quantize_direction(gradientX[index], gradientY[index]);
+        }
+
+        SWTDirection direction = swt__directions[directionIndex];
+
+        // 16.16 fixed point, offset by half a pixel so the shift rounds
+        int64_t fx = ((int64_t)xx << 16) + (1 << 15);
+        int64_t fy = ((int64_t)yy << 16) + (1 << 15);
+
+        for (int i = 0; i < maxDistance; i++) {
+            int x = (int)(fx >> 16);
+            int y = (int)(fy >> 16);
+
+            if (!swt__component_mask_test(&mask, x, y)) {
+                break;
+            }
+
+            distancePositive++;
+            fx += direction.stepX;
+            fy += direction.stepY;
+        }
+
+        SWT__STATS_ADD(stats, raysCast, 1);
+        SWT__STATS_ADD(stats, raySteps, distancePositive);
+
+        strokes[strokeCount] = distancePositive;
+        strokeCount++;
+    }
+
+    if (variation != NULL && strokeCount > 0) {
+        double sum = 0, squares = 0;
+        for (int j = 0; j < strokeCount; j++) {
+            sum += strokes[j];
+            squares += (double)strokes[j] * strokes[j];
+        }
+        double mean = sum / strokeCount;
+        double variance = squares / strokeCount - mean * mean;
+        *variation = mean > 0 && variance > 0 ? (float)(sqrt(variance) / mean) : 0;
+    }
+
+    int median = strokeCount > 0 ? swt__median(strokes, strokeCount) : 0;
+    swt__free(allocator, gradients);
+    swt__free(allocator, mask.bits);
+    swt__free(allocator, strokes);
+    swt__budget_give(results, scratchBytes);
+    SWT__STATS_FREE(stats, scratchBytes);
+
+    return median;
+}
+
+static int swt__compute_stroke_width(SWTImage *image,
+                                     SWTComponent *currentComponent,
+                                     SWTResults *results, float *variation) {
+    SWTPointCursor points = swt__point_cursor(currentComponent->points, NULL, 0);
+    return swt__measure_strokes(image, points, currentComponent->pointCount,
+                                swt_compute_component_box(currentComponent),
+                                results, variation);
+}
+
+SWTDEF int swt_compute_stroke_width_for_component(SWTImage *image, SWTComponent *currentComponent) {
+    return swt__compute_stroke_width(image, currentComponent, NULL, NULL);
+}
+
+SWTDEF int swt_pack_component(const SWTComponent *component,
+                              SWTPackedComponent *packed,
+                              const SWTAllocator *allocator) {
+  memset(packed, 0, sizeof(*packed));
+
+  // sized exactly in a first pass, the box is found along the way
+  size_t size = 0;
+  int lastX = 0, lastY = 0;
+  int minX = INT_MAX, minY = INT_MAX, maxX = -1, maxY = -1;
+  for (int i = 0; i < component->pointCount; i++) {
+    int x = component->points[i].x, y = component->points[i].y;
+    size += swt__varint_size(swt__zigzag(x - lastX)) + swt__varint_size(swt__zigzag(y - lastY));
+    lastX = x;
+    lastY = y;
+    if (x < minX) minX = x;
+    if (x > maxX) maxX = x;
+    if (y < minY) minY = y;
+    if (y > maxY) maxY = y;
+  }
+
+  packed->bytes = (uint8_t *)swt__malloc(allocator, size + 1);
+  if (packed->bytes == NULL) {
+    return 0;
+  }
+
+  uint8_t *out = packed->bytes;
+  lastX = lastY = 0;
+  for (int i = 0; i < component->pointCount; i++) {
+    int x = component->points[i].x, y = component->points[i].y;
+    out = swt__write_varint(out, swt__zigzag(x - lastX));
+    out = swt__write_varint(out, swt__zigzag(y - lastY));
+    lastX = x;
+    lastY = y;
+  }
+
+  packed->size = size;
+  packed->pointCount = component->pointCount;
+  if (component->pointCount > 0) {
+    packed->box = (SWTBox){minX, minY, maxX - minX + 1, maxY - minY + 1};
+  }
+  return 1;
+}
+
+SWTDEF int swt_unpack_component(const SWTPackedComponent *packed, SWTPoint *points) {
+  SWTPointCursor cursor = swt__point_cursor(NULL, packed->bytes, packed->size);
+  int i = 0;
+  while (i < packed->pointCount && swt__next_point(&cursor, &points[i])) {
+    i++;
+  }
+  return i;
+}
+
+SWTDEF void swt_free_packed_component(SWTPackedComponent *packed,
+                                      const SWTAllocator *allocator) {
+  swt__free(allocator, packed->bytes);
+  packed->bytes = NULL;
+  packed->size = 0;
+  packed->pointCount = 0;
+}
+
+SWTDEF int swt_compute_stroke_width_for_packed(SWTImage *image,
+                                               const SWTPackedComponent *packed) {
+  // the box is clipped to the image, points outside it never reach the mask
+  SWTBox box = packed->box;
+  int64_t x1 = (int64_t)box.x + box.width, y1 = (int64_t)box.y + box.height;
+  box.x = box.x < 0 ? 0 : box.x;
+  box.y = box.y < 0 ? 0 : box.y;
+  if (x1 <= box.x || y1 <= box.y) {
+    return 0;
+  }
+  box.width = (int)((x1 > image->width ? image->width : x1) - box.x);
+  box.height = (int)((y1 > image->height ? image->height : y1) - box.y);
+  if (box.width <= 0 || box.height <= 0) {
+    return 0;
+  }
+
+  SWTPointCursor points = swt__point_cursor(NULL, packed->bytes, packed->size);
+  return swt__measure_strokes(image, points, packed->pointCount, box, NULL, NULL);
+}
+
+SWTDEF int swt_compute_stroke_width_for_label(SWTImage *image,
+                                              const SWTLabels *labels,
+                                              uint32_t label) {
+  SWTPointCursor points = swt__point_cursor(NULL, NULL, 0);
+  points.label = swt_iterate_label(labels, label);
+  if (points.label.remaining == 0) {
+    return 0;
+  }
+  return swt__measure_strokes(image, points, points.label.remaining,
+                              labels->stats[label - 1].box, NULL, NULL);
+}
+
+SWTDEF void swt_unpack_mask(const uint8_t *bits, int stride, SWTImage *image) {
+  swt_init_tables();
+
+  for (int y = 0; y < image->height; y++) {
+    const uint8_t *row = bits + (size_t)y * stride;
+    uint8_t *out = image->bytes + (size_t)y * image->width;
+    int x = 0;
+
+    for (; x + 8 <= image->width; x += 8) {
+      memcpy(out + x, swt__bit_expansion[row[x >> 3]], 8);
+    }
+    if (x < image->width) {
+      memcpy(out + x, swt__bit_expansion[row[x >> 3]], image->width - x);
+    }
+  }
+
+  image->channels = 1;
+}
+
+// Rough shape test for single glyphs: a few pixels tall, not much wider than
+// tall, and neither a thin line nor a solid blob
+static int swt__has_glyph_shape(SWTComponent *component, SWTBox box) {
+  int area = box.width * box.height;
+  return box.height >= 8 && box.width * 10 >= box.height &&
+         box.width <= box.height * 2 && component->pointCount * 10 >= area &&
+         component->pointCount * 10 <= area * 9;
+}
+
+typedef struct {
+  int index;
+  int glyph;
+  int area;
+} SWTPriority;
+
+static int swt__compare_priorities(const void *a, const void *b) {
+  const SWTPriority *pa = (const SWTPriority *)a, *pb = (const SWTPriority *)b;
+  if (pa->glyph != pb->glyph) return pb->glyph - pa->glyph;
+  if (pa->area != pb->area) return pa->area - pb->area;
+  return pa->index - pb->index;
+}
+
+// Component indices, glyph shaped ones first and smaller ones before larger
+// ones. The cost of a component grows with its area, so this gets the most
+// glyphs done in a given time and leaves huge noisy blobs for last.
+// NULL when there is no memory for it, the components then go in order.
+static int *swt__priority_order(SWTComponents *components) {
+  int count = components->itemCount;
+  SWTPriority *priorities = (SWTPriority *)swt__malloc(components->allocator, (count + 1) * sizeof(SWTPriority));
+  int *order = (int *)swt__malloc(components->allocator, (count + 1) * sizeof(int));
+  if (priorities == NULL || order == NULL) {
+    swt__free(components->allocator, priorities);
+    swt__free(components->allocator, order);
+    return NULL;
+  }
+
+  for (int i = 0; i < count; i++) {
+    SWTComponent *component = &components->items[i];
+    SWTBox box = swt_compute_component_box(component);
+    priorities[i].index = i;
+    priorities[i].glyph = swt__has_glyph_shape(component, box);
+    priorities[i].area = component->pointCount;
+  }
+
+  qsort(priorities, count, sizeof(SWTPriority), swt__compare_priorities);
+  for (int i = 0; i < count; i++) {
+    order[i] = priorities[i].index;
+  }
+
+  swt__free(components->allocator, priorities);
+  return order;
+}
+
+// Rough cost of analysing a mask: the visited bits and starting queue, plus
+// the points of every foreground pixel
+static size_t swt__analysis_bytes(SWTImage *mask) {
+  size_t size = (size_t)mask->width * mask->height, foreground = 0;
+  for (size_t i = 0; i < size; i++) {
+    foreground += mask->bytes[i] != SWT_CLR_BLACK;
+  }
+  return (size + 63) / 64 * sizeof(uint64_t) + SWT__QUEUE_START * sizeof(SWTPoint) +
+         foreground * sizeof(SWTPoint);
+}
+
+// Why a mask has to be halved, as an SWT_DEGRADED_* bit, or 0 once it is
+// within SWT_MAX_DIMENSION and analysing it takes at most three quarters of
+// the budget (the rest is left for the stroke widths)
+static int swt__over_budget(SWTImage *mask, const SWTResults *results) {
+  if (mask->width > SWT_MAX_DIMENSION || mask->height > SWT_MAX_DIMENSION) {
+    return SWT_DEGRADED_TOO_LARGE;
+  }
+  if (results->memoryBudget > 0 &&
+      swt__analysis_bytes(mask) > results->memoryBudget / 4 * 3) {
+    return SWT_DEGRADED_DOWNSCALED;
+  }
+  return 0;
+}
+
+// Halves the mask in place until it fits
+static void swt__fit_budget(SWTImage *mask, SWTResults *results) {
+  int reason;
+  while ((reason = swt__over_budget(mask, results)) != 0 && mask->width >= 2 &&
+         mask->height >= 2) {
+    swt_downsample_2x(mask, mask);
+    results->scale *= 2;
+    results->degraded |= reason;
+
+    // a blurred edge goes to whichever side it's mostly on
+    size_t size = (size_t)mask->width * mask->height;
+    for (size_t i = 0; i < size; i++) {
+      mask->bytes[i] = mask->bytes[i] >= 128 ? SWT_CLR_WHITE : SWT_CLR_BLACK;
+    }
+  }
+}
+
+static void swt__apply_stroke_width_transform(SWTImage *image,
+                                              SWTComponents *components,
+                                              SWTResults *results,
+                                              int binarize) {
+  SWTStats *stats = results->stats;
+  results->status = SWT_STATUS_OK;
+  results->degraded = 0;
+  results->scale = 1;
+  results->memoryUsed = 0;
+  if (stats) {
+    memset(stats, 0, sizeof(SWTStats));
+    stats->pixels = (long long)image->width * image->height;
+  }
+  SWT__STATS_CLOCK(start, stats);
+  SWT__STATS_CLOCK(clock, stats);
+
+  if (binarize) {
+    swt_apply_grayscale(image);
+  }
+  SWT__STATS_LAP(stats, grayscaleMs, clock);
+
+  /* This makes the logic for visualization needlessly complex since gray and black don't contrast well
+    SWTImage binaryImage;
+    binaryImage.width = image->width;
+    binaryImage.height = image->height;
+    binaryImage.channels = image->channels;
+    binaryImage.bytes = (uint8_t *)malloc(sizeof(uint8_t) * image->width * image->height * image->channels);
+    memcpy(binaryImage.bytes, image->bytes, sizeof(uint8_t) * image->width * image->height * image->channels);
+  */
+
+  // threshold is inverted such that WHITE is the foreground
+  if (binarize) {
+    swt_apply_threshold(image, SWT_THRESHOLD);
+  }
+  swt__fit_budget(image, results);
+  SWT__STATS_LAP(stats, thresholdMs, clock);
+
+  if (!swt__should_stop(results)) {
+    swt__connected_component_analysis(image, components, results);
+  }
+  SWT__STATS_LAP(stats, ccaMs, clock);
+  SWT__STATS_ADD(stats, components, components->itemCount);
+
+  // with a deadline or a cancel token the most promising components go first
+  // so a cut short run still has the useful ones
+  int *order = NULL;
+  if (results->deadlineMs > 0 || results->cancel != NULL) {
+    order = swt__priority_order(components);
+  }
+
+  for (int n = 0; n < components->itemCount; n++) {
+    if ((n & 15) == 0 && swt__should_stop(results)) {
+      break;
+    }
+
+    int i = order ? order[n] : n;
+    float variation;
+    float confidence =
+        swt__compute_stroke_width(image, &components->items[i], results, &variation);
+    //printf("confidence for component#%d is %f\n", i, confidence);
+    if (confidence < 0) {
+      continue;
+    }
+    if (!swt__add_result(results, &components->items[i], confidence * results->scale,
+                         variation)) {
+      swt__out_of_memory(results);
+      break;
+    }
+  }
+  swt__free(components->allocator, order);
+  SWT__STATS_LAP(stats, strokeWidthMs, clock);
+  SWT__STATS_LAP(stats, totalMs, start);
+
+  // free(binaryImage.bytes);
+}
+
+SWTDEF void swt_apply_stroke_width_transform(SWTImage *image,
+                                             SWTComponents *components,
+                                             SWTResults *results) {
+  swt__apply_stroke_width_transform(image, components, results, 1);
+}
+
+SWTDEF void swt_apply_stroke_width_transform_to_mask(SWTImage *mask,
+                                                     SWTComponents *components,
+                                                     SWTResults *results) {
+  SWT_ASSERT(mask->channels == 1);
+  swt__apply_stroke_width_transform(mask, components, results, 0);
+}
+
+SWTDEF void swt_downsample_2x(const SWTImage *src, SWTImage *dst) {
+  int width = src->width / 2, height = src->height / 2;
+  int channels = src->channels;
+  const uint8_t *in = src->bytes;
+  uint8_t *out = dst->bytes;
+
+  swt_init_tables();
+
+  for (int y = 0; y < height; y++) {
+    const uint8_t *top = in + (size_t)2 * y * src->width * channels;
+    const uint8_t *bottom = top + (size_t)src->width * channels;
+    uint8_t *row = out + (size_t)y * width * channels;
+
+    if (channels == 1) {
+      swt__kernels->downsample_row(top, bottom, row, width);
+      continue;
+    }
+
+    for (int x = 0; x < width * channels; x++) {
+      int left = (x / channels) * 2 * channels + x % channels;
+      row[x] = (uint8_t)((top[left] + top[left + channels] + bottom[left] +
+                          bottom[left + channels] + 2) >> 2);
+    }
+  }
+
+  dst->width = width;
+  dst->height = height;
+  dst->channels = channels;
+}
+
+// Levels smaller than this in either direction are too coarse to find text in
+#define SWT__PYRAMID_MIN_SIZE 32
+
+static int swt__boxes_intersect(SWTBox a, SWTBox b) {
+  return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height &&
+         b.y < a.y + a.height;
+}
+
+// Unites overlapping regions in place and returns how many are left. A grown
+// region may now touch any other, earlier ones included, so every merge
+// starts the scan over.
+static int swt__merge_regions(SWTBox *regions, int regionCount) {
+  for (int i = 0; i < regionCount; i++) {
+    for (int j = i + 1; j < regionCount; j++) {
+      if (!swt__boxes_intersect(regions[i], regions[j])) continue;
+
+      SWTBox a = regions[i], b = regions[j];
+      int x0 = a.x < b.x ? a.x : b.x, y0 = a.y < b.y ? a.y : b.y;
+      int x1 = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+      int y1 = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+      regions[i] = (SWTBox){x0, y0, x1 - x0, y1 - y0};
+      regions[j] = regions[--regionCount];
+      i = -1;
+      break;
+    }
+  }
+  return regionCount;
+}
+
+SWTDEF void swt_apply_stroke_width_transform_pyramid(SWTImage *image,
+                                                     SWTComponents *components,
+                                                     SWTResults *results,
+                                                     int levels,
+                                                     int confidenceThreshold) {
+  SWTStats *stats = results->stats;
+  const SWTAllocator *allocator = components->allocator;
+  SWT__STATS_CLOCK(start, stats);
+  results->status = SWT_STATUS_OK;
+  results->degraded = 0;
+  results->scale = 1;
+
+  if (image->width > SWT_MAX_DIMENSION || image->height > SWT_MAX_DIMENSION) {
+    swt_apply_stroke_width_transform(image, components, results);
+    return;
+  }
+
+  swt_apply_grayscale(image);
+
+  int scale = 1;
+  SWTImage coarse = *image;
+  uint8_t *levelBytes = NULL;
+
+  for (int l = 0; l < levels && coarse.width / 2 >= SWT__PYRAMID_MIN_SIZE &&
+                  coarse.height / 2 >= SWT__PYRAMID_MIN_SIZE;
+       l++) {
+    // every level after the first is halved in place
+    if (levelBytes == NULL) {
+      levelBytes = (uint8_t *)swt__malloc(allocator, (size_t)(image->width / 2) * (image->height / 2));
+      if (levelBytes == NULL) {
+        break;
+      }
+      coarse.bytes = levelBytes;
+    }
+    swt_downsample_2x(l == 0 ? image : &coarse, &coarse);
+    scale *= 2;
+  }
+
+  if (scale == 1) {
+    swt_apply_stroke_width_transform(image, components, results);
+    return;
+  }
+
+  // text at the coarse level, the strokes are `scale` times thinner there
+  size_t coarseSize = (size_t)coarse.width * coarse.height;
+  SWTComponents *coarseComponents = swt__create_components(coarseSize, allocator);
+  SWTResults *coarseResults = swt__allocate_results(coarseSize, allocator);
+  if (coarseComponents == NULL || coarseResults == NULL) {
+    swt__out_of_memory(results);
+    swt__free_components(coarseComponents);
+    swt__free_results(coarseResults);
+    swt__free(allocator, levelBytes);
+    return;
+  }
+  coarseResults->deadlineMs = results->deadlineMs;
+  coarseResults->cancel = results->cancel;
+  swt__apply_stroke_width_transform(&coarse, coarseComponents, coarseResults, 1);
+  results->status = coarseResults->status;
+
+  int coarseThreshold = confidenceThreshold / scale > 1 ? confidenceThreshold / scale : 1;
+  SWTBox *regions = (SWTBox *)swt__malloc(allocator, (coarseResults->itemCount + 1) * sizeof(SWTBox));
+  int regionCount = 0;
+  if (regions == NULL) {
+    swt__out_of_memory(results);
+    coarseResults->itemCount = 0;
+  }
+
+  for (int i = 0; i < coarseResults->itemCount; i++) {
+    if (coarseResults->confidences[i] > coarseThreshold) continue;
+
+    // padded by half the box so glyph edges lost in the downsampling are
+    // still inside the region, then mapped back to full resolution
+    SWTBox box = swt_get_result_box(coarseResults, i);
+    int pad = (box.width > box.height ? box.width : box.height) / 2 + 1;
+    int x0 = (box.x - pad) * scale, y0 = (box.y - pad) * scale;
+    int x1 = (box.x + box.width + pad) * scale, y1 = (box.y + box.height + pad) * scale;
+    x0 = x0 < 0 ? 0 : x0;
+    y0 = y0 < 0 ? 0 : y0;
+    x1 = x1 > image->width ? image->width : x1;
+    y1 = y1 > image->height ? image->height : y1;
+
+    regions[regionCount++] = (SWTBox){x0, y0, x1 - x0, y1 - y0};
+  }
+
+  swt__free_components(coarseComponents);
+  swt__free_results(coarseResults);
+  swt__free(allocator, levelBytes);
+
+  // Overlapping regions are united until none overlap, so no pixel is
+  // labeled twice and every detection comes out exactly once. This takes the
+  // place of a non-maximum suppression pass over the detections.
+  regionCount = swt__merge_regions(regions, regionCount);
+
+  size_t regionSize = 0;
+  for (int i = 0; i < regionCount; i++) {
+    if ((size_t)regions[i].width * regions[i].height > regionSize) {
+      regionSize = (size_t)regions[i].width * regions[i].height;
+    }
+  }
+
+  // the full resolution pass runs on a copy of each region so the image
+  // itself stays gray, and its components are moved over into `components`
+  uint8_t *regionBytes = (uint8_t *)swt__malloc(allocator, regionSize + 1);
+  SWTComponents *regionComponents = swt__create_components(regionSize + 1, allocator);
+  SWTResults *regionResults = swt__allocate_results(regionSize + 1, allocator);
+  if (regionBytes == NULL || regionComponents == NULL || regionResults == NULL) {
+    swt__out_of_memory(results);
+    regionCount = 0;
+  } else {
+    regionResults->deadlineMs = results->deadlineMs;
+    regionResults->cancel = results->cancel;
+  }
+
+  for (int r = 0; r < regionCount && !swt__should_stop(results); r++) {
+    SWTBox region = regions[r];
+    SWTImage crop = {regionBytes, region.width, region.height, 1};
+    for (int y = 0; y < region.height; y++) {
+      memcpy(regionBytes + (size_t)y * region.width,
+             image->bytes + (size_t)(region.y + y) * image->width + region.x,
+             region.width);
+    }
+
+    swt__apply_stroke_width_transform(&crop, regionComponents, regionResults, 1);
+
+    // a run cut short still hands over the components it found, but only
+    // the ones that got a result
+    for (int i = 0; i < regionResults->itemCount; i++) {
+      SWTComponent component = *regionResults->components[i];
+      for (int j = 0; j < component.pointCount; j++) {
+        component.points[j].x += region.x;
+        component.points[j].y += region.y;
+      }
+
+      SWTComponent *added = swt__add_component(components, results, component);
+      if (added != NULL) {
+        regionResults->components[i]->points = NULL;
+      }
+      if (added == NULL || !swt__add_result(results, added, regionResults->confidences[i],
+                                            regionResults->variations[i])) {
+        swt__out_of_memory(results);
+        break;
+      }
+    }
+
+    if (regionResults->status != SWT_STATUS_OK) {
+      results->status = regionResults->status;
+    }
+
+    // moved points now belong to `components`, the rest are dropped
+    for (int i = 0; i < regionComponents->itemCount; i++) {
+      swt__free(allocator, regionComponents->items[i].points);
+    }
+    regionComponents->itemCount = 0;
+    regionResults->itemCount = 0;
+  }
+
+  swt__free(allocator, regionBytes);
+  swt__free(allocator, regions);
+  swt__free_components(regionComponents);
+  swt__free_results(regionResults);
+
+#ifndef SWT_NO_STATS
+  // the per stage numbers of the region runs aren't kept, only the totals
+  if (stats) {
+    memset(stats, 0, sizeof(SWTStats));
+    stats->pixels = (long long)image->width * image->height;
+    stats->components = components->itemCount;
+  }
+#endif
+  SWT__STATS_LAP(stats, totalMs, start);
+}
+
+
+/*
+   Threads
+
+   Used by the tiled transform. Define SWT_NO_THREADS to build without
+   pthreads, everything then runs on the calling thread.
+*/
+
+#ifndef SWT_NO_THREADS
+#include <pthread.h>
+typedef pthread_mutex_t SWTMutex;
+#define SWT__MUTEX_INIT(m) pthread_mutex_init(m, NULL)
+#define SWT__MUTEX_LOCK(m) pthread_mutex_lock(m)
+#define SWT__MUTEX_UNLOCK(m) pthread_mutex_unlock(m)
+#define SWT__MUTEX_DESTROY(m) pthread_mutex_destroy(m)
+#else
+typedef int SWTMutex;
+#define SWT__MUTEX_INIT(m) ((void)(m))
+#define SWT__MUTEX_LOCK(m) ((void)(m))
+#define SWT__MUTEX_UNLOCK(m) ((void)(m))
+#define SWT__MUTEX_DESTROY(m) ((void)(m))
+#endif
+
+// task(context, index, worker) for each index, `worker` tells apart the
+// threads so they can keep their own scratch
+typedef void (*SWTTask)(void *context, int index, int worker);
+
+typedef struct {
+  SWTTask task;
+  void *context;
+  int count;
+  int next;
+  int workers;
+  SWTMutex lock;
+} SWTParallelFor;
+
+#ifndef SWT_NO_THREADS
+static void *swt__parallel_worker(void *arg) {
+  SWTParallelFor *job = (SWTParallelFor *)arg;
+
+  SWT__MUTEX_LOCK(&job->lock);
+  int worker = job->workers++;
+  for (;;) {
+    int index = job->next++;
+    SWT__MUTEX_UNLOCK(&job->lock);
+    if (index >= job->count) break;
+
+    job->task(job->context, index, worker);
+    SWT__MUTEX_LOCK(&job->lock);
+  }
+
+  return NULL;
+}
+#endif
+
+// Runs the task for every index in [0, count) on up to `threads` threads, the
+// caller's included, and returns once all are done. Indices are handed out in
+// order, one at a time.
+static void swt__parallel_for(const SWTAllocator *allocator, int count,
+                              int threads, SWTTask task, void *context) {
+  SWTParallelFor job;
+  memset(&job, 0, sizeof(job));
+  job.task = task;
+  job.context = context;
+  job.count = count;
+#ifndef SWT_NO_THREADS
+  if (threads > count) threads = count;
+  // without memory for the handles everything runs on this thread
+  pthread_t *handles =
+      threads > 1 ? (pthread_t *)swt__malloc(allocator, (threads - 1) * sizeof(pthread_t)) : NULL;
+  if (handles != NULL) {
+    SWT__MUTEX_INIT(&job.lock);
+
+    // a thread that fails to start just leaves more work for the others
+    int started = 0;
+    for (int i = 0; i < threads - 1; i++) {
+      if (pthread_create(&handles[started], NULL, swt__parallel_worker, &job) == 0) {
+        started++;
+      }
+    }
+    swt__parallel_worker(&job);
+    for (int i = 0; i < started; i++) {
+      pthread_join(handles[i], NULL);
+    }
+
+    SWT__MUTEX_DESTROY(&job.lock);
+    swt__free(allocator, handles);
+    return;
+  }
+#endif
+  (void)threads;
+  (void)allocator;
+  for (int i = 0; i < count; i++) {
+    task(context, i, 0);
+  }
+}
+
+// Rows thresholded per task, and the smallest tiles worth splitting into
+#define SWT__TILED_BAND 64
+#define SWT__TILED_MIN_TILE 16
+
+typedef struct {
+  SWTComponent component; // points are in image coordinates
+  float confidence;
+  float variation;
+} SWTTiledResult;
+
+typedef struct {
+  SWTImage *image;
+  double deadlineMs;
+  const volatile int *cancel;
+  int tileSize;
+  int halo;
+  int tilesX;
+  int connectivity;
+
+  // per worker scratch
+  uint8_t **crops;
+  SWTComponents **cropComponents;
+
+  // filled by the workers, under `lock`
+  SWTTiledResult *found;
+  int foundCount;
+  int foundCapacity;
+  SWTPoint *seeds; // first pixels of components that reach past a halo
+  int seedCount;
+  int seedCapacity;
+  int status;
+  SWTMutex lock;
+  const SWTAllocator *allocator;
+} SWTTiled;
+
+static void swt__tiled_threshold_band(void *context, int index, int worker) {
+  SWTTiled *tiled = (SWTTiled *)context;
+  SWTImage *image = tiled->image;
+  int y0 = index * SWT__TILED_BAND;
+  int rows = image->height - y0 < SWT__TILED_BAND ? image->height - y0 : SWT__TILED_BAND;
+  (void)worker;
+
+  swt__kernels->threshold(image->bytes + (size_t)y0 * image->width,
+                          rows * image->width, SWT_THRESHOLD);
+}
+
+// SWTResults that only carries the bounds of the whole run, for the parts
+// worked on by each thread
+static SWTResults swt__tiled_local_results(SWTTiled *tiled) {
+  SWTResults local;
+  memset(&local, 0, sizeof(local));
+  local.deadlineMs = tiled->deadlineMs;
+  local.cancel = tiled->cancel;
+  local.allocator = tiled->allocator;
+  return local;
+}
+
+// Takes over the points, a component there's no room for is dropped and the
+// run marked as out of memory
+static void swt__tiled_add(SWTTiled *tiled, SWTComponent component,
+                           float confidence, float variation) {
+  if (tiled->foundCount == tiled->foundCapacity) {
+    int capacity = tiled->foundCapacity ? tiled->foundCapacity * 2 : 1024;
+    SWTTiledResult *found = (SWTTiledResult *)swt__realloc(tiled->allocator,
+        tiled->found, swt__array_size(capacity, sizeof(SWTTiledResult)));
+    if (found == NULL) {
+      swt__free(tiled->allocator, component.points);
+      tiled->status = SWT_STATUS_NO_MEMORY;
+      return;
+    }
+    tiled->found = found;
+    tiled->foundCapacity = capacity;
+  }
+  tiled->found[tiled->foundCount].component = component;
+  tiled->found[tiled->foundCount].confidence = confidence;
+  tiled->found[tiled->foundCount].variation = variation;
+  tiled->foundCount++;
+}
+
+// Labels and measures one tile together with its halo. A component belongs
+// to the tile its first pixel in scan order is in, which is the pixel the
+// labeling starts it from, so each one is kept exactly once. Kept components
+// that touch the edge of the halo (not the edge of the image) may go on
+// outside it and are only noted down for stitching.
+static void swt__tiled_process_tile(void *context, int index, int worker) {
+  SWTTiled *tiled = (SWTTiled *)context;
+  SWTImage *image = tiled->image;
+  SWTResults local = swt__tiled_local_results(tiled);
+  if (swt__should_stop(&local)) {
+    SWT__MUTEX_LOCK(&tiled->lock);
+    tiled->status = local.status;
+    SWT__MUTEX_UNLOCK(&tiled->lock);
+    return;
+  }
+
+  int x0 = (index % tiled->tilesX) * tiled->tileSize;
+  int y0 = (index / tiled->tilesX) * tiled->tileSize;
+  int x1 = x0 + tiled->tileSize < image->width ? x0 + tiled->tileSize : image->width;
+  int y1 = y0 + tiled->tileSize < image->height ? y0 + tiled->tileSize : image->height;
+
+  int cropX0 = x0 - tiled->halo > 0 ? x0 - tiled->halo : 0;
+  int cropY0 = y0 - tiled->halo > 0 ? y0 - tiled->halo : 0;
+  int cropX1 = x1 + tiled->halo < image->width ? x1 + tiled->halo : image->width;
+  int cropY1 = y1 + tiled->halo < image->height ? y1 + tiled->halo : image->height;
+
+  SWTImage crop = {tiled->crops[worker], cropX1 - cropX0, cropY1 - cropY0, 1};
+  for (int y = 0; y < crop.height; y++) {
+    memcpy(crop.bytes + (size_t)y * crop.width,
+           image->bytes + (size_t)(cropY0 + y) * image->width + cropX0,
+           crop.width);
+  }
+
+  SWTComponents *components = tiled->cropComponents[worker];
+  swt__connected_component_analysis(&crop, components, &local);
+
+  for (int i = 0; i < components->itemCount; i++) {
+    SWTComponent *component = &components->items[i];
+    SWTPoint seed = component->points[0];
+    seed.x += cropX0;
+    seed.y += cropY0;
+
+    if (seed.x < x0 || seed.x >= x1 || seed.y < y0 || seed.y >= y1) {
+      swt__free(tiled->allocator, component->points);
+      continue;
+    }
+
+    SWTBox box = swt_compute_component_box(component);
+    if ((box.x == 0 && cropX0 > 0) || (box.y == 0 && cropY0 > 0) ||
+        (box.x + box.width == crop.width && cropX1 < image->width) ||
+        (box.y + box.height == crop.height && cropY1 < image->height)) {
+      swt__free(tiled->allocator, component->points);
+
+      SWT__MUTEX_LOCK(&tiled->lock);
+      if (tiled->seedCount == tiled->seedCapacity) {
+        int capacity = tiled->seedCapacity ? tiled->seedCapacity * 2 : 256;
+        SWTPoint *seeds = (SWTPoint *)swt__realloc(tiled->allocator,
+            tiled->seeds, swt__array_size(capacity, sizeof(SWTPoint)));
+        if (seeds != NULL) {
+          tiled->seeds = seeds;
+          tiled->seedCapacity = capacity;
+        }
+      }
+      if (tiled->seedCount < tiled->seedCapacity) {
+        tiled->seeds[tiled->seedCount++] = seed;
+      } else {
+        tiled->status = SWT_STATUS_NO_MEMORY;
+      }
+      SWT__MUTEX_UNLOCK(&tiled->lock);
+      continue;
+    }
+
+    // the component and every pixel around it are inside the crop, so this
+    // is the same width the whole image would give
+    float variation;
+    float confidence = swt__compute_stroke_width(&crop, component, &local, &variation);
+    for (int j = 0; j < component->pointCount; j++) {
+      component->points[j].x += cropX0;
+      component->points[j].y += cropY0;
+    }
+
+    SWT__MUTEX_LOCK(&tiled->lock);
+    swt__tiled_add(tiled, *component, confidence, variation);
+    SWT__MUTEX_UNLOCK(&tiled->lock);
+  }
+  components->itemCount = 0;
+
+  if (local.status != SWT_STATUS_OK) {
+    SWT__MUTEX_LOCK(&tiled->lock);
+    tiled->status = local.status;
+    SWT__MUTEX_UNLOCK(&tiled->lock);
+  }
+}
+
+static void swt__tiled_measure(void *context, int index, int worker) {
+  SWTTiled *tiled = (SWTTiled *)context;
+  SWTResults local = swt__tiled_local_results(tiled);
+  (void)worker;
+
+  SWTTiledResult *result = &tiled->found[index];
+  if (result->confidence < 0 && !swt__should_stop(&local)) {
+    result->confidence = swt__compute_stroke_width(tiled->image, &result->component, &local,
+                                                   &result->variation);
+  }
+
+  if (local.status == SWT_STATUS_NO_MEMORY) {
+    SWT__MUTEX_LOCK(&tiled->lock);
+    tiled->status = local.status;
+    SWT__MUTEX_UNLOCK(&tiled->lock);
+  }
+}
+
+static int swt__compare_seeds(const void *a, const void *b) {
+  const SWTPoint *pa = (const SWTPoint *)a, *pb = (const SWTPoint *)b;
+  if (pa->y != pb->y) return pa->y - pb->y;
+  return pa->x - pb->x;
+}
+
+static int swt__compare_tiled_results(const void *a, const void *b) {
+  return swt__compare_seeds(((const SWTTiledResult *)a)->component.points,
+                            ((const SWTTiledResult *)b)->component.points);
+}
+
+// Labels the components noted down by the tiles on the whole image. A seed
+// that doesn't turn out to be the first pixel of its component isn't where
+// the component belongs: either an earlier seed already labeled it or a tile
+// kept it whole.
+static void swt__tiled_stitch(SWTTiled *tiled, SWTResults *results) {
+  SWTImage *image = tiled->image;
+  int width = image->width;
+
+  if (tiled->seedCount == 0) {
+    return;
+  }
+  qsort(tiled->seeds, tiled->seedCount, sizeof(SWTPoint), swt__compare_seeds);
+
+  size_t words = ((size_t)width * image->height + 63) / 64;
+  uint64_t *visited = (uint64_t *)swt__calloc(tiled->allocator, words, sizeof(uint64_t));
+  SWTFloodFill fill;
+  if (visited == NULL || !swt__flood_fill_init(&fill, NULL, tiled->allocator)) {
+    swt__free(tiled->allocator, visited);
+    tiled->status = SWT_STATUS_NO_MEMORY;
+    return;
+  }
+
+  for (int s = 0; s < tiled->seedCount && tiled->status == SWT_STATUS_OK; s++) {
+    if ((s & 15) == 0 && swt__should_stop(results)) {
+      break;
+    }
+
+    SWTPoint seed = tiled->seeds[s];
+    if (swt__bit_test(visited, (size_t)seed.y * width + seed.x)) continue;
+
+    int status = swt__flood_fill(&fill, image, visited, seed.x, seed.y, tiled->connectivity,
+                                 NULL, tiled->allocator);
+    if (status != SWT__FILL_OK || fill.area > INT_MAX) {
+      tiled->status = SWT_STATUS_NO_MEMORY;
+      break;
+    }
+
+    int first = 1;
+    for (int i = 0; i < fill.spanCount && first; i++) {
+      first = fill.spans[i].y > seed.y ||
+              (fill.spans[i].y == seed.y && fill.spans[i].x0 >= seed.x);
+    }
+    if (!first) continue;
+
+    SWTComponent component;
+    component.pointCount = (int)fill.area;
+    component.points = (SWTPoint *)swt__malloc(tiled->allocator, fill.area * sizeof(SWTPoint));
+    if (component.points == NULL) {
+      tiled->status = SWT_STATUS_NO_MEMORY;
+      continue;
+    }
+    SWTPoint *point = component.points;
+    for (int i = 0; i < fill.spanCount; i++) {
+      for (int x = fill.spans[i].x0; x < fill.spans[i].x1; x++, point++) {
+        point->x = x;
+        point->y = fill.spans[i].y;
+      }
+    }
+
+    // measured afterwards, on all threads
+    swt__tiled_add(tiled, component, -1.0f, 0);
+  }
+
+  swt__flood_fill_free(&fill, NULL, tiled->allocator);
+  swt__free(tiled->allocator, visited);
+}
+
+SWTDEF void swt_apply_stroke_width_transform_tiled(SWTImage *image,
+                                                   SWTComponents *components,
+                                                   SWTResults *results,
+                                                   int tileSize, int halo,
+                                                   int threads) {
+  SWTStats *stats = results->stats;
+  SWT__STATS_CLOCK(start, stats);
+  results->status = SWT_STATUS_OK;
+  results->degraded = 0;
+  results->scale = 1;
+
+  if (image->width > SWT_MAX_DIMENSION || image->height > SWT_MAX_DIMENSION) {
+    swt_apply_stroke_width_transform(image, components, results);
+    return;
+  }
+
+  if (tileSize < SWT__TILED_MIN_TILE) tileSize = SWT__TILED_MIN_TILE;
+  if (halo < 1) halo = 1;
+  if (threads < 1) threads = 1;
+
+  SWTTiled tiled;
+  memset(&tiled, 0, sizeof(tiled));
+  tiled.image = image;
+  tiled.deadlineMs = results->deadlineMs;
+  tiled.cancel = results->cancel;
+  tiled.tileSize = tileSize;
+  tiled.halo = halo;
+  tiled.tilesX = (image->width + tileSize - 1) / tileSize;
+  tiled.connectivity = components->connectivity;
+  tiled.allocator = components->allocator;
+  SWT__MUTEX_INIT(&tiled.lock);
+  int tileCount = tiled.tilesX * ((image->height + tileSize - 1) / tileSize);
+
+  // the rgb to gray conversion packs pixels towards the start of the buffer,
+  // so only it runs on one thread
+  swt_apply_grayscale(image);
+  swt__parallel_for(tiled.allocator, (image->height + SWT__TILED_BAND - 1) / SWT__TILED_BAND,
+                    threads, swt__tiled_threshold_band, &tiled);
+
+  size_t cropSize = swt__array_size(tileSize + 2 * (size_t)halo, tileSize + 2 * (size_t)halo);
+  tiled.crops = (uint8_t **)swt__calloc(tiled.allocator, threads, sizeof(uint8_t *));
+  tiled.cropComponents = (SWTComponents **)swt__calloc(tiled.allocator, threads, sizeof(SWTComponents *));
+  for (int i = 0; tiled.crops != NULL && tiled.cropComponents != NULL && i < threads; i++) {
+    tiled.crops[i] = (uint8_t *)swt__malloc(tiled.allocator, cropSize);
+    tiled.cropComponents[i] = swt__create_components(cropSize, tiled.allocator);
+    if (tiled.crops[i] == NULL || tiled.cropComponents[i] == NULL) {
+      tiled.status = SWT_STATUS_NO_MEMORY;
+    } else {
+      tiled.cropComponents[i]->connectivity = tiled.connectivity;
+    }
+  }
+  if (tiled.crops == NULL || tiled.cropComponents == NULL) {
+    tiled.status = SWT_STATUS_NO_MEMORY;
+  }
+
+  if (tiled.status == SWT_STATUS_OK) {
+    swt__parallel_for(tiled.allocator, tileCount, threads, swt__tiled_process_tile, &tiled);
+  }
+  results->status = tiled.status;
+
+  for (int i = 0; tiled.crops != NULL && tiled.cropComponents != NULL && i < threads; i++) {
+    swt__free(tiled.allocator, tiled.crops[i]);
+    swt__free_components(tiled.cropComponents[i]);
+  }
+  swt__free(tiled.allocator, tiled.crops);
+  swt__free(tiled.allocator, tiled.cropComponents);
+
+  if (!swt__should_stop(results)) {
+    swt__tiled_stitch(&tiled, results);
+  }
+  swt__parallel_for(tiled.allocator, tiled.foundCount, threads, swt__tiled_measure, &tiled);
+  if (results->status == SWT_STATUS_OK) {
+    results->status = tiled.status;
+  }
+  if (results->status == SWT_STATUS_OK) {
+    swt__should_stop(results);
+  }
+
+  // in the order the single pass labels them
+  if (tiled.foundCount > 0) {
+    qsort(tiled.found, tiled.foundCount, sizeof(SWTTiledResult),
+          swt__compare_tiled_results);
+  }
+
+  for (int i = 0; i < tiled.foundCount; i++) {
+    // stitched components the time ran out on never got a result
+    if (tiled.found[i].confidence < 0) {
+      swt__free(tiled.allocator, tiled.found[i].component.points);
+      continue;
+    }
+
+    SWTComponent *added = swt__add_component(components, results, tiled.found[i].component);
+    if (added == NULL || !swt__add_result(results, added, tiled.found[i].confidence,
+                                          tiled.found[i].variation)) {
+      if (added == NULL) {
+        swt__free(tiled.allocator, tiled.found[i].component.points);
+      }
+      swt__out_of_memory(results);
+    }
+  }
+
+  swt__free(tiled.allocator, tiled.found);
+  swt__free(tiled.allocator, tiled.seeds);
+  SWT__MUTEX_DESTROY(&tiled.lock);
+
+#ifndef SWT_NO_STATS
+  // the work is spread over the tiles, only the totals are kept
+  if (stats) {
+    memset(stats, 0, sizeof(SWTStats));
+    stats->pixels = (long long)image->width * image->height;
+    stats->components = components->itemCount;
+  }
+#endif
+  SWT__STATS_LAP(stats, totalMs, start);
+}
+
+// Triage works on square tiles of this size, text taller than half a tile is
+// not recognized
+#define SWT__TRIAGE_TILE 256
+// only every this many rows are scanned to rank the tiles
+#define SWT__TRIAGE_ROW_STEP 4
+// glyph like components needed for a tile to count as text
+#define SWT__TRIAGE_GLYPHS 3
+
+typedef struct {
+  SWTBox box;
+  int edges;       // foreground/background changes along the sampled rows
+  int mostInARow;  // most changes along any single one of them
+} SWTTriageTile;
+
+static int swt__compare_triage_tiles(const void *a, const void *b) {
+  return ((const SWTTriageTile *)b)->edges - ((const SWTTriageTile *)a)->edges;
+}
+
+static inline int swt__gray_at(const uint8_t *pixel, int channels) {
+  if (channels < 3) {
+    return pixel[0];
+  }
+  int sum = SWT__GRAY_R * pixel[0] + SWT__GRAY_G * pixel[1] +
+            SWT__GRAY_B * pixel[2];
+  return (sum * SWT__GRAY_DIV_MUL) >> SWT__GRAY_DIV_SHIFT;
+}
+
+// Glyph shaped, small enough for the tile, and with strokes that are thin
+// compared to its height
+static int swt__is_glyph_like(SWTImage *tile, SWTComponent *component,
+                              int confidenceThreshold, SWTResults *results) {
+  SWTBox box = swt_compute_component_box(component);
+  if (box.height > SWT__TRIAGE_TILE / 2 || !swt__has_glyph_shape(component, box)) {
+    return 0;
+  }
+
+  int width = swt__compute_stroke_width(tile, component, results, NULL);
+  return width > 0 && width <= confidenceThreshold && width * 2 <= box.height;
+}
+
+SWTDEF SWTTriage swt_triage_text(const SWTImage *image, int confidenceThreshold,
+                                 double budgetMs) {
+  return swt_triage_text_with(image, confidenceThreshold, budgetMs, NULL);
+}
+
+SWTDEF SWTTriage swt_triage_text_with(const SWTImage *image, int confidenceThreshold,
+                                      double budgetMs, const SWTAllocator *allocator) {
+  SWTTriage triage;
+  memset(&triage, 0, sizeof(triage));
+  double start = swt__now_ms();
+  int width = image->width, height = image->height, channels = image->channels;
+
+  swt_init_tables();
+
+  int tilesX = (width + SWT__TRIAGE_TILE - 1) / SWT__TRIAGE_TILE;
+  int tilesY = (height + SWT__TRIAGE_TILE - 1) / SWT__TRIAGE_TILE;
+  triage.tileCount = tilesX * tilesY;
+
+  // the tile scratch holds the gray row while the tiles are ranked
+  SWTTriageTile *tiles = (SWTTriageTile *)swt__calloc(allocator, triage.tileCount, sizeof(SWTTriageTile));
+  uint8_t *bytes = (uint8_t *)swt__malloc(allocator, SWT__TRIAGE_TILE * SWT__TRIAGE_TILE);
+  uint8_t *gray = width <= SWT__TRIAGE_TILE * SWT__TRIAGE_TILE ? bytes : (uint8_t *)swt__malloc(allocator, width);
+  SWTComponents *components = swt__create_components(SWT__TRIAGE_TILE * SWT__TRIAGE_TILE, allocator);
+  if (tiles == NULL || bytes == NULL || gray == NULL || components == NULL) {
+    if (gray != bytes) swt__free(allocator, gray);
+    swt__free(allocator, bytes);
+    swt__free(allocator, tiles);
+    swt__free_components(components);
+    triage.outOfMemory = 1;
+    return triage;
+  }
+
+  for (int ty = 0; ty < tilesY; ty++) {
+    for (int tx = 0; tx < tilesX; tx++) {
+      SWTBox *box = &tiles[ty * tilesX + tx].box;
+      box->x = tx * SWT__TRIAGE_TILE;
+      box->y = ty * SWT__TRIAGE_TILE;
+      box->width = width - box->x < SWT__TRIAGE_TILE ? width - box->x : SWT__TRIAGE_TILE;
+      box->height = height - box->y < SWT__TRIAGE_TILE ? height - box->y : SWT__TRIAGE_TILE;
+    }
+  }
+
+  // rank the tiles by how often the sampled rows cross the threshold
+
+  for (int y = SWT__TRIAGE_ROW_STEP / 2; y < height; y += SWT__TRIAGE_ROW_STEP) {
+    const uint8_t *row = image->bytes + (size_t)y * width * channels;
+    SWTTriageTile *tileRow = tiles + (y / SWT__TRIAGE_TILE) * tilesX;
+
+    if (channels == 1) {
+      memcpy(gray, row, width);
+    } else if (channels == 3) {
+      swt__kernels->grayscale(row, gray, width);
+    } else {
+      for (int x = 0; x < width; x++) {
+        gray[x] = (uint8_t)swt__gray_at(row + x * channels, channels);
+      }
+    }
+
+    for (int tx = 0; tx < tilesX; tx++) {
+      int x0 = tx * SWT__TRIAGE_TILE, x1 = x0 + tileRow[tx].box.width;
+      int edges = 0, previous = gray[x0] > SWT_THRESHOLD;
+
+      for (int x = x0 + 1; x < x1; x++) {
+        int background = gray[x] > SWT_THRESHOLD;
+        edges += background != previous;
+        previous = background;
+      }
+
+      tileRow[tx].edges += edges;
+      if (edges > tileRow[tx].mostInARow) tileRow[tx].mostInARow = edges;
+    }
+  }
+
+  if (gray != bytes) swt__free(allocator, gray);
+  qsort(tiles, triage.tileCount, sizeof(SWTTriageTile), swt__compare_triage_tiles);
+
+  for (int i = 0; i < triage.tileCount && !triage.containsText && !triage.outOfMemory; i++) {
+    // a line of text crosses some sampled row at least twice per glyph,
+    // tiles without such a row are skipped
+    if (tiles[i].mostInARow < 2 * SWT__TRIAGE_GLYPHS) {
+      continue;
+    }
+    if (budgetMs > 0 && swt__now_ms() - start > budgetMs) {
+      triage.timedOut = 1;
+      break;
+    }
+
+    SWTBox box = tiles[i].box;
+    SWTImage tile = {bytes, box.width, box.height, 1};
+    for (int y = 0; y < box.height; y++) {
+      const uint8_t *in = image->bytes + ((size_t)(box.y + y) * width + box.x) * channels;
+      uint8_t *out = bytes + y * box.width;
+
+      if (channels == 1) {
+        memcpy(out, in, box.width);
+      } else if (channels == 3) {
+        swt__kernels->grayscale(in, out, box.width);
+      } else {
+        for (int x = 0; x < box.width; x++) {
+          out[x] = (uint8_t)swt__gray_at(in + x * channels, channels);
+        }
+      }
+    }
+
+    swt_apply_threshold(&tile, SWT_THRESHOLD);
+    SWTResults local;
+    memset(&local, 0, sizeof(local));
+    local.allocator = allocator;
+    swt__connected_component_analysis(&tile, components, &local);
+    triage.tilesChecked++;
+    if (local.status == SWT_STATUS_NO_MEMORY) {
+      triage.outOfMemory = 1;
+    }
+
+    int glyphs = 0;
+    for (int c = 0; c < components->itemCount && glyphs < SWT__TRIAGE_GLYPHS; c++) {
+      glyphs += swt__is_glyph_like(&tile, &components->items[c], confidenceThreshold, &local);
+    }
+
+    if (glyphs >= SWT__TRIAGE_GLYPHS) {
+      triage.containsText = 1;
+      triage.tile = box;
+    }
+
+    for (int c = 0; c < components->itemCount; c++) {
+      swt__free(allocator, components->items[c].points);
+    }
+    components->itemCount = 0;
+  }
+
+  swt__free(allocator, bytes);
+  swt__free(allocator, tiles);
+  swt__free_components(components);
+
+  return triage;
+}
+
+
+// Video frames are compared in square tiles of this size
+#define SWT__VIDEO_TILE 64
+
+SWTDEF SWTVideo *swt_video_create(int width, int height) {
+  return swt_video_create_with(width, height, NULL);
+}
+
+SWTDEF SWTVideo *swt_video_create_with(int width, int height,
+                                       const SWTAllocator *allocator) {
+  if (width > SWT_MAX_DIMENSION || height > SWT_MAX_DIMENSION) {
+    return NULL;
+  }
+  SWTVideo *video = (SWTVideo *)swt__calloc(allocator, 1, sizeof(SWTVideo));
+  if (video == NULL) {
+    return NULL;
+  }
+  video->allocator = allocator;
+
+  size_t size = (size_t)width * height;
+  video->width = width;
+  video->height = height;
+  video->tilesX = (width + SWT__VIDEO_TILE - 1) / SWT__VIDEO_TILE;
+  video->tilesY = (height + SWT__VIDEO_TILE - 1) / SWT__VIDEO_TILE;
+  video->tileCount = video->tilesX * video->tilesY;
+  video->nextId = 1;
+
+  video->data = swt_allocate_with(size, allocator);
+  if (video->data != NULL) {
+    video->ids = (int *)swt__malloc(allocator, swt__array_size(video->data->components->capacity, sizeof(int)));
+  }
+  video->previous = (uint8_t *)swt__malloc(allocator, size);
+  video->dirty = (uint8_t *)swt__malloc(allocator, video->tileCount);
+  video->labels = (int *)swt__calloc(allocator, size, sizeof(int));
+  video->queueCapacity = SWT__QUEUE_START;
+  video->queue = (SWTPoint *)swt__malloc(allocator, video->queueCapacity * sizeof(SWTPoint));
+  if (video->ids == NULL || video->previous == NULL || video->dirty == NULL ||
+      video->labels == NULL || video->queue == NULL) {
+    swt_video_free(video);
+    return NULL;
+  }
+
+  return video;
+}
+
+SWTDEF void swt_video_free(SWTVideo *video) {
+  if (video == NULL) {
+    return;
+  }
+
+  const SWTAllocator *allocator = video->allocator;
+  swt_free(video->data);
+  swt__free(allocator, video->ids);
+  swt__free(allocator, video->previous);
+  swt__free(allocator, video->dirty);
+  swt__free(allocator, video->labels);
+  swt__free(allocator, video->queue);
+  swt__free(allocator, video);
+}
+
+// A component there was no memory for is left out, its pixels are marked like
+// lone ones so they aren't labeled again until something changes near them
+static int swt__video_unlabel(SWTVideo *video, int count) {
+  for (int i = 0; i < count; i++) {
+    video->labels[(size_t)video->queue[i].y * video->width + video->queue[i].x] = -1;
+  }
+  swt__out_of_memory(video->data->results);
+  return 0;
+}
+
+// Labels and queues (x, y) if it's unlabeled foreground, 0 if the queue
+// can't grow
+static inline int swt__video_visit(SWTVideo *video, const SWTImage *mask, int id,
+                                   int *qEnd, int x, int y) {
+  if (x < 0 || x >= video->width || y < 0 || y >= video->height)
+    return 1;
+  size_t index = (size_t)y * video->width + x;
+  if (mask->bytes[index] == SWT_CLR_BLACK || video->labels[index] != 0)
+    return 1;
+
+  if (*qEnd == video->queueCapacity) {
+    SWTPoint *grown = swt__grow_queue(video->allocator, video->queue, &video->queueCapacity);
+    if (grown == NULL) {
+      return 0;
+    }
+    video->queue = grown;
+  }
+  video->queue[(*qEnd)++] = (SWTPoint){x, y};
+  video->labels[index] = id;
+  return 1;
+}
+
+// Same components as the CCA, with the persistent label map standing in for
+// the visited flags. Returns 1 if a component was added.
+static int swt__video_label(SWTVideo *video, SWTImage *mask, int x, int y) {
+  int eight = SWT__CONNECTIVITY(video->data->components->connectivity) == 8;
+  int id = video->nextId++;
+  int qBegin = 0, qEnd = 0;
+
+  video->queue[qEnd++] = (SWTPoint){x, y};
+  video->labels[(size_t)y * video->width + x] = id;
+
+  while (qEnd > qBegin) {
+    SWTPoint point = video->queue[qBegin++];
+    int px = point.x, py = point.y;
+
+    int grown = swt__video_visit(video, mask, id, &qEnd, px - 1, py) &&
+                swt__video_visit(video, mask, id, &qEnd, px + 1, py) &&
+                swt__video_visit(video, mask, id, &qEnd, px, py - 1) &&
+                swt__video_visit(video, mask, id, &qEnd, px, py + 1);
+    if (grown && eight) {
+      grown = swt__video_visit(video, mask, id, &qEnd, px - 1, py - 1) &&
+              swt__video_visit(video, mask, id, &qEnd, px + 1, py - 1) &&
+              swt__video_visit(video, mask, id, &qEnd, px - 1, py + 1) &&
+              swt__video_visit(video, mask, id, &qEnd, px + 1, py + 1);
+    }
+    if (!grown) {
+      return swt__video_unlabel(video, qEnd);
+    }
+  }
+
+  // lone pixels are noise, like in the CCA
+  if (qEnd == 1) {
+    video->labels[(size_t)y * video->width + x] = -1;
+    return 0;
+  }
+
+  // results are pointed at the components once the frame is done, the ids
+  // grow along with them
+  SWTComponents *components = video->data->components;
+  int capacity = components->capacity;
+  if (!swt__reserve_components(components, NULL, components->itemCount + 1)) {
+    return swt__video_unlabel(video, qEnd);
+  }
+  if (components->capacity != capacity) {
+    int *ids = (int *)swt__realloc(video->allocator, video->ids, swt__array_size(components->capacity, sizeof(int)));
+    if (ids == NULL) {
+      return swt__video_unlabel(video, qEnd);
+    }
+    video->ids = ids;
+  }
+
+  SWTComponent component;
+  component.pointCount = qEnd;
+  component.points = (SWTPoint *)swt__malloc(video->allocator, qEnd * sizeof(SWTPoint));
+  if (component.points == NULL) {
+    return swt__video_unlabel(video, qEnd);
+  }
+  memcpy(component.points, video->queue, qEnd * sizeof(SWTPoint));
+
+  swt__add_component(components, NULL, component);
+  video->ids[components->itemCount - 1] = id;
+  return 1;
+}
+
+SWTDEF void swt_video_apply(SWTVideo *video, SWTImage *frame) {
+  SWT_ASSERT(frame->width == video->width && frame->height == video->height);
+  SWTComponents *components = video->data->components;
+  SWTResults *results = video->data->results;
+  SWTStats *stats = results->stats;
+  SWT__STATS_CLOCK(start, stats);
+  int width = video->width, height = video->height;
+  int tilesX = video->tilesX, tilesY = video->tilesY;
+  results->status = SWT_STATUS_OK;
+
+  // Without these the previous frame's results are left as they are
+  uint8_t *changed = (uint8_t *)swt__calloc(video->allocator, components->itemCount + 1, 1);
+  SWTComponent *dropped = (SWTComponent *)swt__malloc(video->allocator, (components->itemCount + 1) * sizeof(SWTComponent));
+  if (changed == NULL || dropped == NULL) {
+    swt__free(video->allocator, changed);
+    swt__free(video->allocator, dropped);
+    results->status = SWT_STATUS_NO_MEMORY;
+    return;
+  }
+
+  swt_apply_grayscale(frame);
+  swt_apply_threshold(frame, SWT_THRESHOLD);
+
+  // tiles whose mask changed, everything on the first frame
+  memset(video->dirty, video->frames == 0, video->tileCount);
+  for (int ty = 0; ty < tilesY && video->frames > 0; ty++) {
+    for (int tx = 0; tx < tilesX; tx++) {
+      int x0 = tx * SWT__VIDEO_TILE, y0 = ty * SWT__VIDEO_TILE;
+      int tileWidth = width - x0 < SWT__VIDEO_TILE ? width - x0 : SWT__VIDEO_TILE;
+      int y1 = height - y0 < SWT__VIDEO_TILE ? height : y0 + SWT__VIDEO_TILE;
+
+      for (int y = y0; y < y1; y++) {
+        size_t offset = (size_t)y * width + x0;
+        if (swt__kernels->count_changes(video->previous + offset,
+                                        frame->bytes + offset, tileWidth)) {
+          video->dirty[ty * tilesX + tx] = 1;
+          break;
+        }
+      }
+    }
+  }
+
+  video->dirtyTiles = 0;
+  for (int t = 0; t < video->tileCount; t++) {
+    if (video->dirty[t] != 1) continue;
+    video->dirtyTiles++;
+
+    int tx = t % tilesX, ty = t / tilesX;
+    for (int ny = ty - 1; ny <= ty + 1; ny++) {
+      for (int nx = tx - 1; nx <= tx + 1; nx++) {
+        if (nx >= 0 && nx < tilesX && ny >= 0 && ny < tilesY &&
+            video->dirty[ny * tilesX + nx] == 0) {
+          video->dirty[ny * tilesX + nx] = 2;
+        }
+      }
+    }
+  }
+
+  // A component is unchanged unless a changed pixel is in it or any of the 8
+  // around it, whatever the connectivity, since the gradients read the full
+  // 3x3 neighbourhood.
+  // Ids only ever grow and new components are appended, so `ids` is sorted
+  // and the owner of a label is found with a binary search.
+
+  for (int t = 0; t < video->tileCount && video->frames > 0; t++) {
+    if (video->dirty[t] != 1) continue;
+
+    int x0 = (t % tilesX) * SWT__VIDEO_TILE, y0 = (t / tilesX) * SWT__VIDEO_TILE;
+    int x1 = x0 + SWT__VIDEO_TILE < width ? x0 + SWT__VIDEO_TILE : width;
+    int y1 = y0 + SWT__VIDEO_TILE < height ? y0 + SWT__VIDEO_TILE : height;
+    for (int y = y0; y < y1; y++) {
+      for (int x = x0; x < x1; x++) {
+        size_t index = (size_t)y * width + x;
+        if (video->previous[index] == frame->bytes[index]) continue;
+
+        for (int d = 0; d < 9; d++) {
+          int xx = x + d % 3 - 1, yy = y + d / 3 - 1;
+          if (xx < 0 || xx >= width || yy < 0 || yy >= height) continue;
+
+          int label = video->labels[(size_t)yy * width + xx];
+          int low = 0, high = components->itemCount - 1;
+          while (label > 0 && low <= high) {
+            int middle = (low + high) / 2;
+            if (video->ids[middle] < label) {
+              low = middle + 1;
+            } else if (video->ids[middle] > label) {
+              high = middle - 1;
+            } else {
+              changed[middle] = 1;
+              break;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // the changed ones are set aside and their pixels unlabeled, they are
+  // labeled again below
+  int droppedCount = 0, kept = 0;
+
+  for (int i = 0; i < components->itemCount; i++) {
+    SWTComponent component = components->items[i];
+
+    if (changed[i]) {
+      for (int j = 0; j < component.pointCount; j++) {
+        video->labels[(size_t)component.points[j].y * width + component.points[j].x] = 0;
+      }
+      dropped[droppedCount++] = component;
+    } else {
+      components->items[kept] = component;
+      swt__move_result(results, kept, i);
+      video->ids[kept] = video->ids[i];
+      kept++;
+    }
+  }
+  swt__free(video->allocator, changed);
+  components->itemCount = kept;
+
+  // Lone pixels next to a change may have joined a component now
+  for (int t = 0; t < video->tileCount; t++) {
+    if (video->dirty[t] == 0) continue;
+
+    int x0 = (t % tilesX) * SWT__VIDEO_TILE, y0 = (t / tilesX) * SWT__VIDEO_TILE;
+    int x1 = x0 + SWT__VIDEO_TILE < width ? x0 + SWT__VIDEO_TILE : width;
+    int y1 = y0 + SWT__VIDEO_TILE < height ? y0 + SWT__VIDEO_TILE : height;
+    for (int y = y0; y < y1; y++) {
+      for (int x = x0; x < x1; x++) {
+        if (video->labels[(size_t)y * width + x] < 0) video->labels[(size_t)y * width + x] = 0;
+      }
+    }
+  }
+
+  // Anything not labeled yet is either in a tile that changed or next to one,
+  // or part of a dropped component
+  for (int t = 0; t < video->tileCount; t++) {
+    if (video->dirty[t] == 0) continue;
+
+    int x0 = (t % tilesX) * SWT__VIDEO_TILE, y0 = (t / tilesX) * SWT__VIDEO_TILE;
+    int x1 = x0 + SWT__VIDEO_TILE < width ? x0 + SWT__VIDEO_TILE : width;
+    int y1 = y0 + SWT__VIDEO_TILE < height ? y0 + SWT__VIDEO_TILE : height;
+    for (int y = y0; y < y1; y++) {
+      const uint8_t *row = frame->bytes + (size_t)y * width;
+      for (int x = swt__kernels->find_foreground(row, x0, x1); x < x1;
+           x = swt__kernels->find_foreground(row, x + 1, x1)) {
+        if (video->labels[(size_t)y * width + x] == 0) swt__video_label(video, frame, x, y);
+      }
+    }
+  }
+
+  for (int i = 0; i < droppedCount; i++) {
+    for (int j = 0; j < dropped[i].pointCount; j++) {
+      SWTPoint point = dropped[i].points[j];
+      size_t index = (size_t)point.y * width + point.x;
+      if (frame->bytes[index] != SWT_CLR_BLACK && video->labels[index] == 0) {
+        swt__video_label(video, frame, point.x, point.y);
+      }
+    }
+    swt__free(video->allocator, dropped[i].points);
+  }
+  swt__free(video->allocator, dropped);
+
+  // components without room for a result, or whose width couldn't be
+  // measured, never count as text
+  int count = components->itemCount;
+  if (!swt__reserve_results(results, count)) {
+    swt__out_of_memory(results);
+    count = results->capacity < count ? results->capacity : count;
+  }
+  for (int i = 0; i < count; i++) {
+    if (i < kept) {
+      results->components[i] = &components->items[i];
+    } else {
+      float variation;
+      int strokeWidth = swt__compute_stroke_width(frame, &components->items[i], results, &variation);
+      swt__set_result(results, i, &components->items[i],
+                      strokeWidth < 0 ? (float)INT_MAX : strokeWidth, variation);
+    }
+  }
+  results->itemCount = count;
+  video->reused = kept;
+
+  memcpy(video->previous, frame->bytes, (size_t)width * height);
+  video->frames++;
+
+#ifndef SWT_NO_STATS
+  if (stats) {
+    memset(stats, 0, sizeof(SWTStats));
+    stats->pixels = (long long)width * height;
+    stats->components = components->itemCount;
+  }
+#endif
+  SWT__STATS_LAP(stats, totalMs, start);
+}
+
+
+#pragma GCC diagnostic ignored "-Wunused-function"
 
 static int swt__confidence_sum(SWTResults *results) {
     int sum = 0;
     for (int i = 0; i < results->itemCount; i++) {
-        sum += results->items[i].confidence;
+        sum += results->confidences[i];
     }
     return sum;
 }
 
 
+SWTDEF SWTResult swt_get_result(const SWTResults *results, int i) {
+  SWTResult result = {results->components[i], results->confidences[i]};
+  return result;
+}
+
+SWTDEF int swt_add_result(SWTResults *results, SWTComponent *component,
+                          float confidence, float variation) {
+  return swt__add_result(results, component, confidence, variation);
+}
+
+SWTDEF int swt_filter_results(const SWTResults *results, const SWTFilter *filter,
+                              int *indices) {
+  int set = filter->set;
+  SWTFilterBounds bounds = {
+      set & SWT_FILTER_MAX_CONFIDENCE ? filter->maxConfidence : FLT_MAX,
+      set & SWT_FILTER_MAX_VARIATION ? filter->maxVariation : FLT_MAX,
+      set & SWT_FILTER_MAX_ASPECT ? filter->maxAspect : FLT_MAX,
+      set & SWT_FILTER_MIN_AREA ? filter->minArea : INT_MIN,
+      set & SWT_FILTER_MAX_AREA ? filter->maxArea : INT_MAX,
+      set & SWT_FILTER_MIN_HEIGHT ? filter->minHeight : INT_MIN,
+      set & SWT_FILTER_MAX_HEIGHT ? filter->maxHeight : INT_MAX,
+  };
+
+  swt_init_tables();
+  return swt__kernels->filter_results(results, 0, &bounds, indices);
+}
+
+// Ranks by confidence, then index, so no two results tie
+static int swt__result_before(const SWTResults *results, int a, int b) {
+  float confidenceA = results->confidences[a], confidenceB = results->confidences[b];
+  return confidenceA < confidenceB || (confidenceA == confidenceB && a < b);
+}
+
+// Quickselect around a median of three until the k-th smallest is in place,
+// everything before it is then smaller
+SWTDEF int swt_select_top_results(const SWTResults *results, int *indices,
+                                  int count, int k) {
+  k = k < 0 ? 0 : k > count ? count : k;
+  int target = k - 1, low = 0, high = count - 1;
+
+  while (target >= 0 && low < high) {
+    int middle = low + (high - low) / 2;
+    if (swt__result_before(results, indices[middle], indices[low])) SWT_SWAP(indices[middle], indices[low]);
+    if (swt__result_before(results, indices[high], indices[low])) SWT_SWAP(indices[high], indices[low]);
+    if (swt__result_before(results, indices[high], indices[middle])) SWT_SWAP(indices[high], indices[middle]);
+
+    int pivot = indices[middle];
+    SWT_SWAP(indices[middle], indices[high]);
+    int store = low;
+    for (int i = low; i < high; i++) {
+      if (swt__result_before(results, indices[i], pivot)) {
+        SWT_SWAP(indices[i], indices[store]);
+        store++;
+      }
+    }
+    SWT_SWAP(indices[store], indices[high]);
+
+    if (store == target) break;
+    if (store < target) {
+      low = store + 1;
+    } else {
+      high = store - 1;
+    }
+  }
+
+  return k;
+}
+
+SWTDEF SWTBox swt_get_result_box(const SWTResults *results, int i) {
+  SWTBox box = {results->lefts[i], results->tops[i], results->widths[i], results->heights[i]};
+  return box;
+}
+
 SWTDEF void swt_visualize_text_on_image(SWTImage *image, SWTResults *results, const int confidenceThreshold) {
-  if (image == NULL || results == NULL) {
+  if (image == NULL || results == NULL || results->itemCount == 0) {
+    return;
+  }
+
+  int *indices = (int *)swt__malloc(results->allocator, sizeof(int) * (size_t)results->itemCount);
+  if (indices == NULL) {
     return;
   }
 
-  for (int i = 1; i < results->itemCount; i++) {
-    SWTComponent *component = results->items[i].component;
-    int confidence = results->items[i].confidence;
+  SWTFilter filter = {0};
+  filter.set = SWT_FILTER_MAX_CONFIDENCE;
+  filter.maxConfidence = (float)confidenceThreshold;
+  int count = swt_filter_results(results, &filter, indices);
 
-    if (confidenceThreshold < confidence) continue;
+  for (int n = 0; n < count; n++) {
+    SWTComponent *component = results->components[indices[n]];
 
     if (component == NULL) {
       continue;
@@ -582,10 +5028,11 @@ SWTDEF void swt_visualize_text_on_image(SWTImage *image, SWTResults *results, co
     for (int j = 0; j < component->pointCount; j++) {
       SWTPoint point = component->points[j];
 
-      int index = (point.y * image->width + point.x) * image->channels;
+      size_t index = ((size_t)point.y * image->width + point.x) * image->channels;
       image->bytes[index] = 128; 
     }
   }
+  swt__free(results->allocator, indices);
 }
 
 #endif // SWT_IMPLEMENTATION
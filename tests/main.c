@@ -2,10 +2,14 @@
 
 extern MunitTest GrayscaleTests[];
 extern MunitTest CCATests[];
+extern MunitTest KernelTests[];
+extern MunitTest SWTTests[];
 
 static MunitSuite test_suites[] = {
     //{ (char*) "Grayscale_Tests", GrayscaleTests, NULL, 1, MUNIT_SUITE_OPTION_NONE },
     { (char*) "CCA_Tests", CCATests, NULL, 1, MUNIT_SUITE_OPTION_NONE },
+    { (char*) "Kernel_Tests", KernelTests, NULL, 1, MUNIT_SUITE_OPTION_NONE },
+    { (char*) "SWT_Tests", SWTTests, NULL, 1, MUNIT_SUITE_OPTION_NONE },
     { NULL, NULL, NULL, 0, MUNIT_SUITE_OPTION_NONE }
 };
 
@@ -22,13 +22,13 @@ CCA_SmallImage_hasExpectedComponents(const MunitParameter params[],
 
   int width, height, channels;
   uint8_t *image_data =
-      stbi_load(CCA_TEST_1_PATH, &width, &height, &channels, 0);
+      stbi_load(CCA_TEST_1_PATH, &width, &height, &channels, 1);
 
   SWTImage image = {
       .bytes = image_data,
       .width = width,
       .height = height,
-      .channels = channels,
+      .channels = 1,
   };
 
   SWTComponents *components =
@@ -41,7 +41,7 @@ CCA_SmallImage_hasExpectedComponents(const MunitParameter params[],
 
   munit_assert_int(components->itemCount, ==, CCA_TEST_1_COUNT);
 
-  swt_free_components(components);
+  swt__free_components(components);
 
   stbi_image_free(image.bytes);
 
@@ -56,13 +56,13 @@ CCA_MediumImage_hasExpectedComponents(const MunitParameter params[],
 
   int width, height, channels;
   uint8_t *image_data =
-      stbi_load(CCA_TEST_2_PATH, &width, &height, &channels, 0);
+      stbi_load(CCA_TEST_2_PATH, &width, &height, &channels, 1);
 
   SWTImage image = {
       .bytes = image_data,
       .width = width,
       .height = height,
-      .channels = channels,
+      .channels = 1,
   };
 
   SWTComponents *components =
@@ -75,13 +75,310 @@ CCA_MediumImage_hasExpectedComponents(const MunitParameter params[],
 
   munit_assert_int(components->itemCount, ==, CCA_TEST_2_COUNT);
 
-  swt_free_components(components);
+  swt__free_components(components);
 
   stbi_image_free(image.bytes);
 
   return MUNIT_OK;
 }
 
+// Past 2^31 pixels, where int offsets overflow. The image is calloc'd and
+// mostly left alone, so the untouched pages never take up real memory.
+#define CCA_TEST_HUGE_SIZE 50000
+
+static MunitResult
+CCA_HugeSparseImage_hasComponentsPastIntRange(const MunitParameter params[],
+                                              void *user_data) {
+  (void)params;
+  (void)user_data;
+
+  size_t pixels = (size_t)CCA_TEST_HUGE_SIZE * CCA_TEST_HUGE_SIZE;
+  uint8_t *bytes = (uint8_t *)calloc(pixels, 1);
+  if (bytes == NULL) {
+    return MUNIT_SKIP;
+  }
+
+  SWTImage image = {
+      .bytes = bytes,
+      .width = CCA_TEST_HUGE_SIZE,
+      .height = CCA_TEST_HUGE_SIZE,
+      .channels = 1,
+  };
+
+  // 3x3 squares in scan order, the second one well past pixel 2^31
+  const SWTPoint corners[3] = {{10, 10}, {100, 45000}, {49990, 49990}};
+  for (int i = 0; i < 3; i++) {
+    for (int y = 0; y < 3; y++) {
+      for (int x = 0; x < 3; x++) {
+        bytes[(size_t)(corners[i].y + y) * image.width + corners[i].x + x] = SWT_CLR_WHITE;
+      }
+    }
+  }
+
+  SWTData *data = swt_allocate(pixels);
+  swt_apply_stroke_width_transform_to_mask(&image, data->components, data->results);
+
+  munit_assert_int(data->components->itemCount, ==, 3);
+  munit_assert_int(data->results->itemCount, ==, 3);
+  for (int i = 0; i < 3; i++) {
+    SWTBox box = swt_compute_component_box(&data->components->items[i]);
+    munit_assert_int(box.x, ==, corners[i].x);
+    munit_assert_int(box.y, ==, corners[i].y);
+    munit_assert_int(box.width, ==, 3);
+    munit_assert_int(box.height, ==, 3);
+  }
+
+  swt_free(data);
+  free(bytes);
+
+  return MUNIT_OK;
+}
+
+// Counts the blocks handed out, every one of them has to come back
+typedef struct {
+  int live;
+  int calls;
+} CountingArena;
+
+static void *counting_malloc(size_t size, void *user) {
+  CountingArena *arena = (CountingArena *)user;
+  arena->live++;
+  arena->calls++;
+  return malloc(size);
+}
+
+static void *counting_realloc(void *ptr, size_t size, void *user) {
+  CountingArena *arena = (CountingArena *)user;
+  arena->live += ptr == NULL;
+  arena->calls++;
+  return realloc(ptr, size);
+}
+
+static void counting_free(void *ptr, void *user) {
+  ((CountingArena *)user)->live--;
+  free(ptr);
+}
+
+static MunitResult
+CCA_CustomAllocator_getsEveryAllocation(const MunitParameter params[],
+                                        void *user_data) {
+  (void)params;
+  (void)user_data;
+
+  int width, height, channels;
+  uint8_t *image_data =
+      stbi_load(CCA_TEST_2_PATH, &width, &height, &channels, 1);
+  SWTImage image = {image_data, width, height, 1};
+
+  CountingArena arena = {0, 0};
+  SWTAllocator allocator = {counting_malloc, counting_realloc, counting_free, &arena};
+
+  SWTData *data = swt_allocate_with((size_t)width * height, &allocator);
+  swt_apply_stroke_width_transform(&image, data->components, data->results);
+  munit_assert_int(data->results->itemCount, >, 0);
+  munit_assert_int(arena.live, >, data->components->itemCount);
+
+  swt_free(data);
+  munit_assert_int(arena.live, ==, 0);
+  munit_assert_int(arena.calls, >, 0);
+
+  stbi_image_free(image_data);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+CCA_LabelImage_matchesComponents(const MunitParameter params[],
+                                 void *user_data) {
+  (void)params;
+  (void)user_data;
+
+  int width, height, channels;
+  uint8_t *image_data =
+      stbi_load(CCA_TEST_2_PATH, &width, &height, &channels, 1);
+  SWTImage image = {image_data, width, height, 1};
+  swt_apply_threshold(&image, 128);
+
+  SWTComponents *components = swt__allocate_components((size_t)width * height);
+  swt_connected_component_analysis(&image, components);
+  SWTLabels *labels = swt_label_components(&image, 0, NULL);
+  munit_assert_not_null(labels);
+  munit_assert_int(labels->labelCount, ==, components->itemCount);
+
+  for (int i = 0; i < components->itemCount; i++) {
+    SWTComponent *component = &components->items[i];
+    SWTBox box = swt_compute_component_box(component);
+    munit_assert_int(labels->stats[i].area, ==, component->pointCount);
+    munit_assert_memory_equal(sizeof(SWTBox), &labels->stats[i].box, &box);
+
+    for (int j = 0; j < component->pointCount; j++) {
+      SWTPoint point = component->points[j];
+      munit_assert_uint32(swt_get_label(labels, point.x, point.y), ==, (uint32_t)i + 1);
+    }
+  }
+
+  swt_free_labels(labels);
+  swt__free_components(components);
+  stbi_image_free(image_data);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+CCA_Diagonal_joinsOnlyWith8Connectivity(const MunitParameter params[],
+                                        void *user_data) {
+  (void)params;
+  (void)user_data;
+
+  // a one pixel wide diagonal stroke, like a thin anti-aliased slash
+  uint8_t bytes[8 * 8] = {0};
+  for (int i = 0; i < 8; i++) {
+    bytes[i * 8 + i] = SWT_CLR_WHITE;
+  }
+  SWTImage image = {bytes, 8, 8, 1};
+
+  SWTComponents *components = swt__allocate_components(8 * 8);
+  swt_connected_component_analysis(&image, components);
+  munit_assert_int(components->itemCount, ==, 1);
+  munit_assert_int(components->items[0].pointCount, ==, 8);
+  swt__free_components(components);
+
+  // every pixel is on its own with 4-connectivity, and dropped as noise
+  components = swt__allocate_components(8 * 8);
+  components->connectivity = 4;
+  swt_connected_component_analysis(&image, components);
+  munit_assert_int(components->itemCount, ==, 0);
+  swt__free_components(components);
+
+  SWTLabels *labels = swt_label_components(&image, 4, NULL);
+  munit_assert_not_null(labels);
+  munit_assert_int(labels->labelCount, ==, 0);
+  swt_free_labels(labels);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+CCA_BlockLabeling_matchesFloodFill(const MunitParameter params[],
+                                   void *user_data) {
+  (void)params;
+  (void)user_data;
+
+  int width, height, channels;
+  uint8_t *image_data =
+      stbi_load(CCA_TEST_2_PATH, &width, &height, &channels, 1);
+  SWTImage image = {image_data, width, height, 1};
+  swt_apply_threshold(&image, 128);
+
+  SWTComponents *components = swt__allocate_components((size_t)width * height);
+  SWTComponents *blocks = swt__allocate_components((size_t)width * height);
+  swt_connected_component_analysis(&image, components);
+  swt_connected_component_analysis_blocks(&image, blocks);
+  munit_assert_int(blocks->itemCount, ==, CCA_TEST_2_COUNT);
+  munit_assert_int(blocks->itemCount, ==, components->itemCount);
+
+  SWTLabels *labels = swt_label_components(&image, 0, NULL);
+  SWTLabels *blockLabels = swt_label_components_blocks(&image, NULL);
+  munit_assert_not_null(blockLabels);
+  munit_assert_int(blockLabels->labelCount, ==, labels->labelCount);
+
+  for (int i = 0; i < components->itemCount; i++) {
+    munit_assert_int(blocks->items[i].pointCount, ==, components->items[i].pointCount);
+    munit_assert_memory_equal(sizeof(SWTLabelStats), &blockLabels->stats[i], &labels->stats[i]);
+    // the block labeling writes points in scan order, the first is the
+    // flood fill's seed
+    munit_assert_memory_equal(sizeof(SWTPoint), &blocks->items[i].points[0],
+                              &components->items[i].points[0]);
+  }
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      munit_assert_uint32(swt_get_label(blockLabels, x, y), ==, swt_get_label(labels, x, y));
+    }
+  }
+
+  swt_free_labels(blockLabels);
+  swt_free_labels(labels);
+  swt__free_components(blocks);
+  swt__free_components(components);
+  stbi_image_free(image_data);
+
+  return MUNIT_OK;
+}
+
+static void *no_realloc(void *ptr, size_t size, void *user) {
+  (void)ptr;
+  (void)size;
+  (void)user;
+  return NULL;
+}
+
+static MunitResult
+CCA_LabelImage_skipsComponentsItCantStore(const MunitParameter params[],
+                                          void *user_data) {
+  (void)params;
+  (void)user_data;
+
+  // a bar with more rows than the first span list holds, then two squares
+  const int width = 16, height = 2100;
+  uint8_t *bytes = (uint8_t *)calloc((size_t)width * height, 1);
+  for (int y = 0; y < 2000; y++) {
+    bytes[y * width + 1] = bytes[y * width + 2] = SWT_CLR_WHITE;
+  }
+  for (int y = 2050; y < 2053; y++) {
+    for (int x = 1; x < 4; x++) {
+      bytes[y * width + x] = bytes[y * width + x + 8] = SWT_CLR_WHITE;
+    }
+  }
+  SWTImage image = {bytes, width, height, 1};
+
+  // nothing can grow, the bar's spans don't fit but its pixels are all visited
+  CountingArena arena = {0, 0};
+  SWTAllocator allocator = {counting_malloc, no_realloc, counting_free, &arena};
+  SWTLabels *labels = swt_label_components(&image, 0, &allocator);
+  munit_assert_not_null(labels);
+  munit_assert_int(labels->status, ==, SWT_STATUS_OK);
+  munit_assert_int(labels->degraded, ==, SWT_DEGRADED_SKIPPED);
+  munit_assert_int(labels->labelCount, ==, 2);
+  munit_assert_uint32(swt_get_label(labels, 1, 0), ==, 0);
+  munit_assert_uint32(swt_get_label(labels, 1, 2050), ==, 1);
+  munit_assert_uint32(swt_get_label(labels, 9, 2050), ==, 2);
+
+  swt_free_labels(labels);
+  munit_assert_int(arena.live, ==, 0);
+  free(bytes);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+CCA_LabelStrokeWidth_stopsWhenPointsRunOut(const MunitParameter params[],
+                                           void *user_data) {
+  (void)params;
+  (void)user_data;
+
+  uint8_t bytes[12 * 12] = {0};
+  for (int y = 4; y < 8; y++) {
+    for (int x = 4; x < 7; x++) {
+      bytes[y * 12 + x] = SWT_CLR_WHITE;
+    }
+  }
+  SWTImage image = {bytes, 12, 12, 1};
+
+  SWTLabels *labels = swt_label_components(&image, 0, NULL);
+  munit_assert_not_null(labels);
+  munit_assert_int(labels->labelCount, ==, 1);
+  int width = swt_compute_stroke_width_for_label(&image, labels, 1);
+  munit_assert_int(width, >, 0);
+
+  // stats that promise more points than the label image has
+  labels->stats[0].area += 5;
+  munit_assert_int(swt_compute_stroke_width_for_label(&image, labels, 1), ==, width);
+
+  swt_free_labels(labels);
+
+  return MUNIT_OK;
+}
+
 MunitTest CCATests[] = {{"/CCA_SmallImage_hasExpectedComponents",
                          CCA_SmallImage_hasExpectedComponents,
                          NULL, // No setup needed
@@ -92,6 +389,41 @@ MunitTest CCATests[] = {{"/CCA_SmallImage_hasExpectedComponents",
                          NULL, // No setup needed
                          NULL, // No teardown needed
                          MUNIT_TEST_OPTION_NONE, NULL},
+                        {"/CCA_HugeSparseImage_hasComponentsPastIntRange",
+                         CCA_HugeSparseImage_hasComponentsPastIntRange,
+                         NULL, // No setup needed
+                         NULL, // No teardown needed
+                         MUNIT_TEST_OPTION_NONE, NULL},
+                        {"/CCA_CustomAllocator_getsEveryAllocation",
+                         CCA_CustomAllocator_getsEveryAllocation,
+                         NULL, // No setup needed
+                         NULL, // No teardown needed
+                         MUNIT_TEST_OPTION_NONE, NULL},
+                        {"/CCA_LabelImage_matchesComponents",
+                         CCA_LabelImage_matchesComponents,
+                         NULL, // No setup needed
+                         NULL, // No teardown needed
+                         MUNIT_TEST_OPTION_NONE, NULL},
+                        {"/CCA_Diagonal_joinsOnlyWith8Connectivity",
+                         CCA_Diagonal_joinsOnlyWith8Connectivity,
+                         NULL, // No setup needed
+                         NULL, // No teardown needed
+                         MUNIT_TEST_OPTION_NONE, NULL},
+                        {"/CCA_BlockLabeling_matchesFloodFill",
+                         CCA_BlockLabeling_matchesFloodFill,
+                         NULL, // No setup needed
+                         NULL, // No teardown needed
+                         MUNIT_TEST_OPTION_NONE, NULL},
+                        {"/CCA_LabelImage_skipsComponentsItCantStore",
+                         CCA_LabelImage_skipsComponentsItCantStore,
+                         NULL, // No setup needed
+                         NULL, // No teardown needed
+                         MUNIT_TEST_OPTION_NONE, NULL},
+                        {"/CCA_LabelStrokeWidth_stopsWhenPointsRunOut",
+                         CCA_LabelStrokeWidth_stopsWhenPointsRunOut,
+                         NULL, // No setup needed
+                         NULL, // No teardown needed
+                         MUNIT_TEST_OPTION_NONE, NULL},
                         {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
 
 };
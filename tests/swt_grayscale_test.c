@@ -1,6 +1,5 @@
 #include "../thirdparty/munit.h"
 
-#define SWT_IMPLEMENTATION
 #include "../swt.h"
 
 
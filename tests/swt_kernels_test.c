@@ -0,0 +1,238 @@
+#include "../thirdparty/munit.h"
+
+// A private copy of the implementation so the kernel tables and other
+// internals can be reached directly, the other test files link against the
+// one in the CCA tests
+#define SWTDEF static inline
+#define SWT_IMPLEMENTATION
+#include "../swt.h"
+
+// Odd lengths so every vector loop also runs its scalar tail
+static const int KERNEL_TEST_LENGTHS[] = {1, 3, 7, 15, 17, 31, 33, 63, 65, 127, 129, 255, 257, 1001};
+#define KERNEL_TEST_LENGTH_COUNT (int)(sizeof(KERNEL_TEST_LENGTHS) / sizeof(KERNEL_TEST_LENGTHS[0]))
+#define KERNEL_TEST_MAX_LENGTH 1001
+
+// munit_rand_int_range divides by zero when min == max
+static int random_between(int min, int max) {
+  return min + (int)(munit_rand_uint32() % (uint32_t)(max - min + 1));
+}
+
+static void random_bytes(uint8_t *bytes, int count) {
+  munit_rand_memory((size_t)count, bytes);
+}
+
+// Mostly background, with the odd foreground pixel for find_foreground to stop at
+static void random_sparse_row(uint8_t *bytes, int count) {
+  for (int i = 0; i < count; i++) {
+    bytes[i] = random_between(0, 99) < 3 ? SWT_CLR_WHITE : SWT_CLR_BLACK;
+  }
+}
+
+static MunitResult
+Kernels_EveryIsa_matchesScalar(const MunitParameter params[], void *user_data) {
+  (void)params;
+  (void)user_data;
+
+  const SWTKernels *supported[4];
+  int count = swt__supported_kernels(supported);
+  const SWTKernels *scalar = supported[0];
+  munit_assert_string_equal(scalar->name, "scalar");
+
+  static uint8_t a[3 * KERNEL_TEST_MAX_LENGTH + 2], b[3 * KERNEL_TEST_MAX_LENGTH + 2];
+  static uint8_t c[3 * KERNEL_TEST_MAX_LENGTH + 2];
+  static uint8_t expected[3 * KERNEL_TEST_MAX_LENGTH + 2], actual[3 * KERNEL_TEST_MAX_LENGTH + 2];
+  static int16_t expectedX[KERNEL_TEST_MAX_LENGTH], expectedY[KERNEL_TEST_MAX_LENGTH];
+  static int16_t actualX[KERNEL_TEST_MAX_LENGTH], actualY[KERNEL_TEST_MAX_LENGTH];
+
+  for (int k = 1; k < count; k++) {
+    const SWTKernels *kernels = supported[k];
+
+    for (int l = 0; l < KERNEL_TEST_LENGTH_COUNT; l++) {
+      int length = KERNEL_TEST_LENGTHS[l];
+
+      random_bytes(a, 3 * length);
+      scalar->grayscale(a, expected, length);
+      kernels->grayscale(a, actual, length);
+      munit_assert_memory_equal((size_t)length, actual, expected);
+      // gray aliasing rgb
+      memcpy(b, a, 3 * length);
+      kernels->grayscale(b, b, length);
+      munit_assert_memory_equal((size_t)length, b, expected);
+
+      int threshold = random_between(0, 255);
+      random_bytes(a, length);
+      memcpy(expected, a, length);
+      memcpy(actual, a, length);
+      scalar->threshold(expected, length, threshold);
+      kernels->threshold(actual, length, threshold);
+      munit_assert_memory_equal((size_t)length, actual, expected);
+
+      int expectedHistogram[256] = {0}, actualHistogram[256] = {0};
+      scalar->histogram(a, length, expectedHistogram);
+      kernels->histogram(a, length, actualHistogram);
+      munit_assert_memory_equal(sizeof(expectedHistogram), actualHistogram, expectedHistogram);
+
+      // one pixel of padding either side of the row
+      random_bytes(a, length + 2);
+      random_bytes(b, length + 2);
+      random_bytes(c, length + 2);
+      scalar->sobel_row(a + 1, b + 1, c + 1, length, expectedX, expectedY);
+      kernels->sobel_row(a + 1, b + 1, c + 1, length, actualX, actualY);
+      munit_assert_memory_equal(length * sizeof(int16_t), actualX, expectedX);
+      munit_assert_memory_equal(length * sizeof(int16_t), actualY, expectedY);
+
+      random_sparse_row(a, length);
+      for (int start = 0; start <= length; start += random_between(1, 40)) {
+        int end = random_between(start, length);
+        munit_assert_int(kernels->find_foreground(a, start, end), ==,
+                         scalar->find_foreground(a, start, end));
+        munit_assert_int(kernels->find_foreground(a, start, length), ==,
+                         scalar->find_foreground(a, start, length));
+      }
+
+      random_bytes(a, 2 * length);
+      random_bytes(b, 2 * length);
+      scalar->downsample_row(a, b, expected, length);
+      kernels->downsample_row(a, b, actual, length);
+      munit_assert_memory_equal((size_t)length, actual, expected);
+
+      // a few changed bytes and a fully random row
+      random_bytes(a, length);
+      memcpy(b, a, length);
+      for (int i = 0; i < length; i += random_between(1, 20)) {
+        b[i] ^= 0x10;
+      }
+      munit_assert_int(kernels->count_changes(a, b, length), ==,
+                       scalar->count_changes(a, b, length));
+      random_bytes(b, length);
+      munit_assert_int(kernels->count_changes(a, b, length), ==,
+                       scalar->count_changes(a, b, length));
+    }
+  }
+
+  return count > 1 ? MUNIT_OK : MUNIT_SKIP;
+}
+
+// The filter as a plain loop, to hold every kernel to
+static int filter_reference(const SWTResults *results, int start,
+                            const SWTFilterBounds *bounds, int *indices) {
+  int count = 0;
+  for (int i = start; i < results->itemCount; i++) {
+    if (results->confidences[i] <= bounds->maxConfidence &&
+        results->variations[i] <= bounds->maxVariation &&
+        results->areas[i] >= bounds->minArea && results->areas[i] <= bounds->maxArea &&
+        results->heights[i] >= bounds->minHeight && results->heights[i] <= bounds->maxHeight &&
+        (float)results->widths[i] <= bounds->maxAspect * (float)results->heights[i]) {
+      indices[count++] = i;
+    }
+  }
+  return count;
+}
+
+#define FILTER_TEST_ROWS 200
+
+static MunitResult
+Kernels_FilterResults_matchesLoop(const MunitParameter params[], void *user_data) {
+  (void)params;
+  (void)user_data;
+
+  const SWTKernels *supported[4];
+  int count = swt__supported_kernels(supported);
+
+  SWTResults *results = swt__allocate_results(FILTER_TEST_ROWS, NULL);
+  munit_assert_not_null(results);
+  munit_assert_true(swt__reserve_results(results, FILTER_TEST_ROWS));
+  int expected[FILTER_TEST_ROWS], actual[FILTER_TEST_ROWS];
+
+  for (int round = 0; round < 50; round++) {
+    // few distinct values, so rows often sit exactly on a bound
+    int rows = random_between(0, FILTER_TEST_ROWS);
+    for (int i = 0; i < rows; i++) {
+      results->components[i] = NULL;
+      results->confidences[i] = (float)random_between(0, 8);
+      results->variations[i] = (float)random_between(0, 4) / 4;
+      results->areas[i] = random_between(1, 40);
+      results->lefts[i] = results->tops[i] = 0;
+      results->widths[i] = random_between(1, 8);
+      results->heights[i] = random_between(1, 8);
+    }
+    results->itemCount = rows;
+
+    // each bound either open all the way or somewhere within the values
+    SWTFilterBounds bounds = {
+        random_between(0, 1) ? FLT_MAX : (float)random_between(0, 8),
+        random_between(0, 1) ? FLT_MAX : (float)random_between(0, 4) / 4,
+        random_between(0, 1) ? FLT_MAX : (float)random_between(1, 8) / 4,
+        random_between(0, 1) ? INT_MIN : random_between(1, 40),
+        random_between(0, 1) ? INT_MAX : random_between(1, 40),
+        random_between(0, 1) ? INT_MIN : random_between(1, 8),
+        random_between(0, 1) ? INT_MAX : random_between(1, 8),
+    };
+
+    for (int start = 0; start <= rows; start += random_between(1, 37)) {
+      int expectedCount = filter_reference(results, start, &bounds, expected);
+      for (int k = 0; k < count; k++) {
+        int actualCount = supported[k]->filter_results(results, start, &bounds, actual);
+        munit_assert_int(actualCount, ==, expectedCount);
+        munit_assert_memory_equal(expectedCount * sizeof(int), actual, expected);
+      }
+    }
+  }
+
+  results->itemCount = 0;
+  swt__free_results(results);
+
+  return MUNIT_OK;
+}
+
+// R1 and R2 only meet each other, but their union overlaps R0, which comes
+// before both. Any region left overlapping another would have its text
+// labeled, and detected, twice.
+static MunitResult
+Pyramid_MergeRegions_revisitsEarlierRegions(const MunitParameter params[], void *user_data) {
+  (void)params;
+  (void)user_data;
+
+  const SWTBox boxes[3] = {{0, 20, 10, 10}, {5, 0, 10, 10}, {12, 5, 8, 20}};
+  static const int orders[6][3] = {{0, 1, 2}, {0, 2, 1}, {1, 0, 2},
+                                   {1, 2, 0}, {2, 0, 1}, {2, 1, 0}};
+
+  for (int o = 0; o < 6; o++) {
+    SWTBox regions[3];
+    for (int i = 0; i < 3; i++) {
+      regions[i] = boxes[orders[o][i]];
+    }
+
+    int count = swt__merge_regions(regions, 3);
+    munit_assert_int(count, ==, 1);
+    munit_assert_int(regions[0].x, ==, 0);
+    munit_assert_int(regions[0].y, ==, 0);
+    munit_assert_int(regions[0].width, ==, 20);
+    munit_assert_int(regions[0].height, ==, 30);
+  }
+
+  // regions that never touch are all kept
+  SWTBox apart[3] = {{0, 0, 4, 4}, {4, 0, 4, 4}, {0, 4, 4, 4}};
+  munit_assert_int(swt__merge_regions(apart, 3), ==, 3);
+
+  return MUNIT_OK;
+}
+
+MunitTest KernelTests[] = {{"/Kernels_EveryIsa_matchesScalar",
+                            Kernels_EveryIsa_matchesScalar,
+                            NULL, // No setup needed
+                            NULL, // No teardown needed
+                            MUNIT_TEST_OPTION_NONE, NULL},
+                           {"/Kernels_FilterResults_matchesLoop",
+                            Kernels_FilterResults_matchesLoop,
+                            NULL, // No setup needed
+                            NULL, // No teardown needed
+                            MUNIT_TEST_OPTION_NONE, NULL},
+                           {"/Pyramid_MergeRegions_revisitsEarlierRegions",
+                            Pyramid_MergeRegions_revisitsEarlierRegions,
+                            NULL, // No setup needed
+                            NULL, // No teardown needed
+                            MUNIT_TEST_OPTION_NONE, NULL},
+                           {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
+
+};
@@ -1,8 +1,9 @@
 #include "../thirdparty/munit.h"
 
-#define STB_IMAGE_IMPLEMENTATION
 #include "../thirdparty/stb_image.h"
 
+#include "../swt.h"
+
 
 static MunitResult
 SWT_SmallImage_hasExpectedCharactersAsStrokes(const MunitParameter params[],
@@ -38,6 +39,401 @@ SWT_SmallImage_hasExpectedCharactersAsStrokes(const MunitParameter params[],
     return MUNIT_SKIP;
 }
 
+#define SWT_TEST_IMG_PATH "./thirdparty/test3.jpg"
+
+static MunitResult
+SWT_Tiled_matchesWholeImage(const MunitParameter params[], void *user_data) {
+    (void)params;
+    (void)user_data;
+
+    int width, height, channels;
+    uint8_t *original = stbi_load(SWT_TEST_IMG_PATH, &width, &height, &channels, 1);
+    munit_assert_not_null(original);
+    size_t size = (size_t)width * height;
+    uint8_t *bytes = (uint8_t *)malloc(size);
+
+    memcpy(bytes, original, size);
+    SWTImage image = {bytes, width, height, 1};
+    SWTData *expected = swt_allocate(size);
+    swt_apply_stroke_width_transform(&image, expected->components, expected->results);
+    munit_assert_int(expected->results->itemCount, >, 0);
+
+    // down to one pixel tiles with no halo, where every component is stitched
+    const int tiles[][2] = {{1, 0}, {7, 0}, {16, 3}, {64, 16}, {1024, 0}};
+    for (int t = 0; t < (int)(sizeof(tiles) / sizeof(tiles[0])); t++) {
+        memcpy(bytes, original, size);
+        image = (SWTImage){bytes, width, height, 1};
+        SWTData *tiled = swt_allocate(size);
+        swt_apply_stroke_width_transform_tiled(&image, tiled->components, tiled->results,
+                                               tiles[t][0], tiles[t][1], 4);
+
+        munit_assert_int(tiled->results->status, ==, SWT_STATUS_OK);
+        munit_assert_int(tiled->components->itemCount, ==, expected->components->itemCount);
+        munit_assert_int(tiled->results->itemCount, ==, expected->results->itemCount);
+        for (int i = 0; i < expected->results->itemCount; i++) {
+            munit_assert_float(tiled->results->confidences[i], ==, expected->results->confidences[i]);
+            SWTBox box = swt_get_result_box(tiled->results, i);
+            SWTBox expectedBox = swt_get_result_box(expected->results, i);
+            munit_assert_memory_equal(sizeof(SWTBox), &box, &expectedBox);
+        }
+
+        swt_free(tiled);
+    }
+
+    swt_free(expected);
+    free(bytes);
+    stbi_image_free(original);
+
+    return MUNIT_OK;
+}
+
+// A 60x60 square, too large to measure on a tight budget, and six 4x4 ones
+#define SWT_TEST_MASK_SIZE 128
+
+static void fill_budget_mask(uint8_t *bytes) {
+    memset(bytes, SWT_CLR_BLACK, SWT_TEST_MASK_SIZE * SWT_TEST_MASK_SIZE);
+    for (int y = 2; y < 62; y++) {
+        for (int x = 2; x < 62; x++) {
+            bytes[y * SWT_TEST_MASK_SIZE + x] = SWT_CLR_WHITE;
+        }
+    }
+    for (int k = 0; k < 6; k++) {
+        for (int y = 80; y < 84; y++) {
+            for (int x = 10 + k * 12; x < 14 + k * 12; x++) {
+                bytes[y * SWT_TEST_MASK_SIZE + x] = SWT_CLR_WHITE;
+            }
+        }
+    }
+}
+
+static SWTData *run_with_budget(uint8_t *bytes, size_t memoryBudget) {
+    fill_budget_mask(bytes);
+    SWTImage mask = {bytes, SWT_TEST_MASK_SIZE, SWT_TEST_MASK_SIZE, 1};
+    SWTData *data = swt_allocate(SWT_TEST_MASK_SIZE * SWT_TEST_MASK_SIZE);
+    data->results->memoryBudget = memoryBudget;
+    swt_apply_stroke_width_transform_to_mask(&mask, data->components, data->results);
+    return data;
+}
+
+// Runs with growing budgets until one ends up degraded exactly as asked, the
+// exact budget depends on the build (eg. SWT_COMPACT_POINTS)
+static SWTData *run_with_budget_until(uint8_t *bytes, int degraded, int scale) {
+    for (size_t budget = 1024; budget <= 256 * 1024; budget += 1024) {
+        SWTData *data = run_with_budget(bytes, budget);
+        if (data->results->status == SWT_STATUS_OK && data->results->degraded == degraded &&
+            data->results->scale == scale) {
+            return data;
+        }
+        swt_free(data);
+    }
+    munit_error("no budget degrades the run like that");
+    return NULL;
+}
+
+static MunitResult
+SWT_MemoryBudget_downscalesImage(const MunitParameter params[], void *user_data) {
+    (void)params;
+    (void)user_data;
+
+    static uint8_t bytes[SWT_TEST_MASK_SIZE * SWT_TEST_MASK_SIZE];
+    SWTData *data = run_with_budget(bytes, 0);
+    munit_assert_int(data->results->degraded, ==, 0);
+    munit_assert_int(data->results->scale, ==, 1);
+    munit_assert_int(data->results->itemCount, ==, 7);
+    swt_free(data);
+
+    data = run_with_budget_until(bytes, SWT_DEGRADED_DOWNSCALED, 2);
+    munit_assert_int(data->results->itemCount, ==, 7);
+    // the points are in the coordinates of the halved mask
+    SWTBox box = swt_get_result_box(data->results, 0);
+    munit_assert_int(box.width, ==, 30);
+    munit_assert_int(box.height, ==, 30);
+    swt_free(data);
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+SWT_MemoryBudget_skipsLargeComponents(const MunitParameter params[], void *user_data) {
+    (void)params;
+    (void)user_data;
+
+    static uint8_t bytes[SWT_TEST_MASK_SIZE * SWT_TEST_MASK_SIZE];
+    SWTData *data = run_with_budget_until(bytes, SWT_DEGRADED_SKIPPED, 1);
+    // the big square is left out, of the components already or just of the results
+    munit_assert_int(data->components->itemCount, >=, 6);
+    munit_assert_int(data->results->itemCount, ==, 6);
+    for (int i = 0; i < data->results->itemCount; i++) {
+        munit_assert_int(data->results->areas[i], ==, 16);
+    }
+    swt_free(data);
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+SWT_CompactPoints_flagTooLargeImages(const MunitParameter params[], void *user_data) {
+    (void)params;
+    (void)user_data;
+
+#ifdef SWT_COMPACT_POINTS
+    // one pixel wider than 16 bit points reach, halved even without a budget
+    const int width = SWT_MAX_DIMENSION + 1, height = 8;
+    uint8_t *bytes = (uint8_t *)calloc((size_t)width * height, 1);
+    munit_assert_not_null(bytes);
+    for (int y = 2; y < 6; y++) {
+        for (int x = width - 8; x < width - 4; x++) {
+            bytes[(size_t)y * width + x] = SWT_CLR_WHITE;
+        }
+    }
+
+    SWTImage mask = {bytes, width, height, 1};
+    SWTData *data = swt_allocate((size_t)width * height);
+    swt_apply_stroke_width_transform_to_mask(&mask, data->components, data->results);
+    munit_assert_int(data->results->status, ==, SWT_STATUS_OK);
+    munit_assert_int(data->results->degraded, ==, SWT_DEGRADED_TOO_LARGE);
+    munit_assert_int(data->results->scale, ==, 2);
+    munit_assert_int(mask.width, ==, width / 2);
+    swt_free(data);
+    free(bytes);
+
+    return MUNIT_OK;
+#else
+    return MUNIT_SKIP;
+#endif
+}
+
+// Hands out `remaining` blocks and then fails, counting the ones still alive
+typedef struct {
+    int remaining;
+    int live;
+} FailingArena;
+
+static void *failing_malloc(size_t size, void *user) {
+    FailingArena *arena = (FailingArena *)user;
+    if (arena->remaining-- <= 0) return NULL;
+    arena->live++;
+    return malloc(size);
+}
+
+static void *failing_realloc(void *ptr, size_t size, void *user) {
+    FailingArena *arena = (FailingArena *)user;
+    if (arena->remaining-- <= 0) return NULL;
+    arena->live += ptr == NULL;
+    return realloc(ptr, size);
+}
+
+static void failing_free(void *ptr, void *user) {
+    ((FailingArena *)user)->live -= ptr != NULL;
+    free(ptr);
+}
+
+static MunitResult
+SWT_FailingAllocator_reportsNoMemory(const MunitParameter params[], void *user_data) {
+    (void)params;
+    (void)user_data;
+
+    static uint8_t bytes[SWT_TEST_MASK_SIZE * SWT_TEST_MASK_SIZE];
+    FailingArena arena = {1 << 30, 0};
+    SWTAllocator allocator = {failing_malloc, failing_realloc, failing_free, &arena};
+
+    // every allocation the transform makes fails in turn, until it needs no more
+    int failed = 0;
+    for (int allowed = 0;; allowed++) {
+        arena.remaining = 1 << 30;
+        SWTData *data = swt_allocate_with(SWT_TEST_MASK_SIZE * SWT_TEST_MASK_SIZE, &allocator);
+        munit_assert_not_null(data);
+
+        fill_budget_mask(bytes);
+        SWTImage mask = {bytes, SWT_TEST_MASK_SIZE, SWT_TEST_MASK_SIZE, 1};
+        arena.remaining = allowed;
+        swt_apply_stroke_width_transform_to_mask(&mask, data->components, data->results);
+        int status = data->results->status;
+        int done = arena.remaining >= 0;
+
+        swt_free(data);
+        munit_assert_int(arena.live, ==, 0);
+        if (done) {
+            munit_assert_int(status, ==, SWT_STATUS_OK);
+            break;
+        }
+        munit_assert_int(status, ==, SWT_STATUS_NO_MEMORY);
+        failed++;
+    }
+    munit_assert_int(failed, >, 0);
+
+    return MUNIT_OK;
+}
+
+// Results for one shared single pixel component, only the confidences differ
+static SWTData *results_with_confidences(const float *confidences, int count) {
+    static SWTPoint point = {3, 4};
+    static SWTComponent component = {&point, 1};
+    SWTData *data = swt_allocate(64);
+    for (int i = 0; i < count; i++) {
+        munit_assert_true(swt_add_result(data->results, &component, confidences[i], 0));
+    }
+    return data;
+}
+
+static int compare_top(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+static MunitResult
+SWT_SelectTopResults_breaksTiesByIndex(const MunitParameter params[], void *user_data) {
+    (void)params;
+    (void)user_data;
+
+    const float confidences[] = {3, 1, 2, 1, 3, 0, 2, 1, 3, 2};
+    const int count = (int)(sizeof(confidences) / sizeof(confidences[0]));
+    // by confidence, then index
+    const int ranked[] = {5, 1, 3, 7, 2, 6, 9, 0, 4, 8};
+    SWTData *data = results_with_confidences(confidences, count);
+
+    for (int k = 0; k <= count + 2; k++) {
+        int indices[10];
+        for (int i = 0; i < count; i++) indices[i] = i;
+
+        int selected = swt_select_top_results(data->results, indices, count, k);
+        munit_assert_int(selected, ==, k < count ? k : count);
+
+        // the first `selected` are the top ones in any order
+        int expected[10];
+        memcpy(expected, ranked, selected * sizeof(int));
+        qsort(indices, selected, sizeof(int), compare_top);
+        qsort(expected, selected, sizeof(int), compare_top);
+        munit_assert_memory_equal(selected * sizeof(int), indices, expected);
+    }
+
+    // nothing to pick from
+    munit_assert_int(swt_select_top_results(data->results, NULL, 0, 3), ==, 0);
+    swt_free(data);
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+SWT_FilterResults_appliesOnlySetBounds(const MunitParameter params[], void *user_data) {
+    (void)params;
+    (void)user_data;
+
+    const float confidences[] = {0, 2, 0, 5, 1};
+    SWTData *data = results_with_confidences(confidences, 5);
+    int indices[5];
+
+    SWTFilter filter = {0};
+    munit_assert_int(swt_filter_results(data->results, &filter, indices), ==, 5);
+
+    // a bound of 0 applies once it is set
+    filter.set = SWT_FILTER_MAX_CONFIDENCE;
+    munit_assert_int(swt_filter_results(data->results, &filter, indices), ==, 2);
+    munit_assert_int(indices[0], ==, 0);
+    munit_assert_int(indices[1], ==, 2);
+
+    filter.maxConfidence = 2;
+    filter.set |= SWT_FILTER_MIN_AREA;
+    filter.minArea = 2;
+    munit_assert_int(swt_filter_results(data->results, &filter, indices), ==, 0);
+
+    SWTResult result = swt_get_result(data->results, 3);
+    munit_assert_float(result.confidence, ==, 5);
+    munit_assert_int(result.component->pointCount, ==, 1);
+    swt_free(data);
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+SWT_PackedComponents_matchComponents(const MunitParameter params[], void *user_data) {
+    (void)params;
+    (void)user_data;
+
+    int width, height, channels;
+    uint8_t *bytes = stbi_load(SWT_TEST_IMG_PATH, &width, &height, &channels, 1);
+    munit_assert_not_null(bytes);
+    SWTImage image = {bytes, width, height, 1};
+    SWTData *data = swt_allocate((size_t)width * height);
+    // leaves the image binarized, as the stroke width functions want it
+    swt_apply_stroke_width_transform(&image, data->components, data->results);
+    munit_assert_int(data->components->itemCount, >, 0);
+
+    for (int i = 0; i < data->components->itemCount; i++) {
+        SWTComponent *component = &data->components->items[i];
+        SWTPackedComponent packed;
+        munit_assert_true(swt_pack_component(component, &packed, NULL));
+        munit_assert_int(packed.pointCount, ==, component->pointCount);
+        SWTBox box = swt_compute_component_box(component);
+        munit_assert_memory_equal(sizeof(SWTBox), &packed.box, &box);
+
+        SWTPoint *points = (SWTPoint *)malloc(sizeof(SWTPoint) * packed.pointCount);
+        munit_assert_int(swt_unpack_component(&packed, points), ==, packed.pointCount);
+        munit_assert_memory_equal(sizeof(SWTPoint) * packed.pointCount, points, component->points);
+        free(points);
+
+        munit_assert_int(swt_compute_stroke_width_for_packed(&image, &packed), ==,
+                         swt_compute_stroke_width_for_component(&image, component));
+        swt_free_packed_component(&packed, NULL);
+    }
+
+    swt_free(data);
+    stbi_image_free(bytes);
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+SWT_PackedComponents_stayWithinCorruptStreams(const MunitParameter params[], void *user_data) {
+    (void)params;
+    (void)user_data;
+
+    // a 6x4 block in a 16x16 image
+    uint8_t bytes[16 * 16] = {0};
+    SWTPoint points[6 * 4];
+    int pointCount = 0;
+    for (int y = 5; y < 9; y++) {
+        for (int x = 5; x < 11; x++) {
+            bytes[y * 16 + x] = SWT_CLR_WHITE;
+            points[pointCount++] = (SWTPoint){x, y};
+        }
+    }
+    SWTImage image = {bytes, 16, 16, 1};
+    SWTComponent component = {points, pointCount};
+
+    SWTPackedComponent packed;
+    munit_assert_true(swt_pack_component(&component, &packed, NULL));
+    int width = swt_compute_stroke_width_for_packed(&image, &packed);
+    munit_assert_int(width, >, 0);
+    SWTPoint unpacked[6 * 4];
+
+    // a stream cut short stops at its last whole point
+    SWTPackedComponent cut = packed;
+    cut.size = packed.size / 2;
+    int count = swt_unpack_component(&cut, unpacked);
+    munit_assert_int(count, <, pointCount);
+    munit_assert_memory_equal(sizeof(SWTPoint) * count, unpacked, points);
+    munit_assert_int(swt_compute_stroke_width_for_packed(&image, &cut), >=, 0);
+
+    // an unterminated varint at the end reads nothing past it
+    packed.bytes[packed.size - 1] |= 0x80;
+    munit_assert_int(swt_unpack_component(&packed, unpacked), ==, pointCount - 1);
+    munit_assert_int(swt_compute_stroke_width_for_packed(&image, &packed), >, 0);
+
+    // deltas that walk far outside the box and the image
+    for (size_t i = 0; i < packed.size; i++) {
+        packed.bytes[i] = (uint8_t)(i % 5 == 4 ? 0x7f : 0xfe);
+    }
+    munit_assert_int(swt_compute_stroke_width_for_packed(&image, &packed), >=, 0);
+
+    // a box that reaches outside the image
+    packed.box = (SWTBox){-8, -8, 64, 64};
+    munit_assert_int(swt_compute_stroke_width_for_packed(&image, &packed), >=, 0);
+
+    swt_free_packed_component(&packed, NULL);
+
+    return MUNIT_OK;
+}
+
 MunitTest SWTTests[] = {
     {"/SWT_SmallImage_hasExpectedWidths",
      SWT_SmallImage_hasExpectedCharactersAsStrokes,
@@ -45,5 +441,59 @@ MunitTest SWTTests[] = {
      NULL, // No teardown needed
      MUNIT_TEST_OPTION_NONE,
      NULL},
+    {"/SWT_Tiled_matchesWholeImage",
+     SWT_Tiled_matchesWholeImage,
+     NULL, // No setup needed
+     NULL, // No teardown needed
+     MUNIT_TEST_OPTION_NONE,
+     NULL},
+    {"/SWT_MemoryBudget_downscalesImage",
+     SWT_MemoryBudget_downscalesImage,
+     NULL, // No setup needed
+     NULL, // No teardown needed
+     MUNIT_TEST_OPTION_NONE,
+     NULL},
+    {"/SWT_MemoryBudget_skipsLargeComponents",
+     SWT_MemoryBudget_skipsLargeComponents,
+     NULL, // No setup needed
+     NULL, // No teardown needed
+     MUNIT_TEST_OPTION_NONE,
+     NULL},
+    {"/SWT_FailingAllocator_reportsNoMemory",
+     SWT_FailingAllocator_reportsNoMemory,
+     NULL, // No setup needed
+     NULL, // No teardown needed
+     MUNIT_TEST_OPTION_NONE,
+     NULL},
+    {"/SWT_SelectTopResults_breaksTiesByIndex",
+     SWT_SelectTopResults_breaksTiesByIndex,
+     NULL, // No setup needed
+     NULL, // No teardown needed
+     MUNIT_TEST_OPTION_NONE,
+     NULL},
+    {"/SWT_FilterResults_appliesOnlySetBounds",
+     SWT_FilterResults_appliesOnlySetBounds,
+     NULL, // No setup needed
+     NULL, // No teardown needed
+     MUNIT_TEST_OPTION_NONE,
+     NULL},
+    {"/SWT_PackedComponents_matchComponents",
+     SWT_PackedComponents_matchComponents,
+     NULL, // No setup needed
+     NULL, // No teardown needed
+     MUNIT_TEST_OPTION_NONE,
+     NULL},
+    {"/SWT_CompactPoints_flagTooLargeImages",
+     SWT_CompactPoints_flagTooLargeImages,
+     NULL, // No setup needed
+     NULL, // No teardown needed
+     MUNIT_TEST_OPTION_NONE,
+     NULL},
+    {"/SWT_PackedComponents_stayWithinCorruptStreams",
+     SWT_PackedComponents_stayWithinCorruptStreams,
+     NULL, // No setup needed
+     NULL, // No teardown needed
+     MUNIT_TEST_OPTION_NONE,
+     NULL},
     {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
 };